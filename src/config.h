@@ -59,7 +59,11 @@
 /*
  * Alignment requirement in bytes (either 4 or 8)
  */
+/* Payload alignment the driver checks; build with -DALIGNMENT=16 for
+   the x86-64 ABI (long double, SSE types, max_align_t) */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 /*
  * Maximum heap size in bytes
@@ -0,0 +1,392 @@
+/*
+ * framebench.cc - Coroutine frame allocation benchmark (C++20)
+ *
+ * Every thread resumes a tree of lazy coroutines over and over: a
+ * node awaits two children, one after the other, down to the leaves,
+ * which keep a LEAF_BYTES buffer in their frame.  Each node and leaf
+ * is a frame allocated when it is called and freed when its parent
+ * resumes, so the run is almost nothing but frame allocation, the
+ * pattern of a request pipeline built out of coroutines.  The same
+ * tree is run with its frames taken from
+ *
+ *   global   the global operator new (the C library's malloc)
+ *   mm_mt    mm_mt_malloc and mm_mt_free, one call per frame
+ *   frame    the per-thread frame pools of mm_frame.h
+ *
+ * and the time per frame is reported, fastest of RUNS runs, with the
+ * pool hits of the frame runs.
+ */
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <utility>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm_frame.h"
+
+extern "C" {
+#include "memlib.h"
+}
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define RUNS         3 /* keep the fastest of this many runs per policy */
+#define LEAF_BYTES 320 /* buffer kept in a leaf's frame */
+
+/* Default workload */
+#define DEF_THREADS  4
+#define DEF_DEPTH    8
+#define DEF_ITERS    2000
+
+/******************************
+ * The key compound data types
+ ******************************/
+
+/* Frames from the global operator new */
+struct global_frames {
+};
+
+/* Frames from mm_mt, one call per frame */
+struct mt_frames {
+	static void *operator new(std::size_t n)
+	{
+		return mm_frame::aligned_new(n);
+	}
+	static void operator delete(void *frame) noexcept
+	{
+		mm_frame::aligned_delete(frame);
+	}
+};
+
+static_assert(mm_frame::FRAME_ALIGN >= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+		"frames must be aligned as operator new promises");
+
+/*
+ * task - A lazy coroutine returning a long; the promise type derives
+ *    from Frames, which decides where the frame comes from.  Awaiting
+ *    a task starts it, and it resumes its awaiter when it finishes.
+ */
+template <class Frames>
+struct task {
+	struct promise_type : Frames {
+		long value = 0;
+		std::coroutine_handle<> awaiter;
+
+		task get_return_object()
+		{
+			auto h = std::coroutine_handle<promise_type>::from_promise(*this);
+
+			if ((std::uintptr_t)h.address() % __STDCPP_DEFAULT_NEW_ALIGNMENT__ != 0) {
+				fprintf(stderr, "framebench: frame %p is misaligned\n", h.address());
+				abort();
+			}
+			return task(h);
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		struct final_awaiter {
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<>
+			await_suspend(std::coroutine_handle<promise_type> h) noexcept
+			{
+				return h.promise().awaiter;
+			}
+			void await_resume() noexcept {}
+		};
+		final_awaiter final_suspend() noexcept { return {}; }
+		void return_value(long v) { value = v; }
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> h;
+
+	explicit task(std::coroutine_handle<promise_type> h) : h(h) {}
+	task(task &&t) noexcept : h(std::exchange(t.h, nullptr)) {}
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+	~task()
+	{
+		if (h)
+			h.destroy();
+	}
+
+	bool await_ready() { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> a)
+	{
+		h.promise().awaiter = a;
+		return h;
+	}
+	long await_resume() { return h.promise().value; }
+
+	/* Run the task to completion from outside any coroutine */
+	long run()
+	{
+		h.promise().awaiter = std::noop_coroutine();
+		h.resume();
+		return h.promise().value;
+	}
+};
+
+/* One benchmark policy */
+typedef struct {
+	const char *name;
+	long (*tree)(int depth, long x);
+} policy_t;
+
+/* Per-thread state */
+typedef struct {
+	const policy_t *policy;
+	long sum;             /* of the tree results, so nothing is elided */
+	mm_frame::stats stats;
+	double start, end;    /* wall clock around the runs */
+} bench_thread_t;
+
+/*********************
+ * Function prototypes
+ *********************/
+
+template <class Frames> static task<Frames> node(int depth, long x);
+template <class Frames> static task<Frames> leaf(long x);
+template <class Frames> static long tree(int depth, long x);
+static void run_policy(const policy_t *policy);
+static void *bench_thread(void *arg);
+static long tree_frames(int depth);
+static double wallclock(void);
+static void usage(void);
+static void unix_error(const char *msg);
+
+/**************
+ * Global data
+ **************/
+
+static const policy_t policies[] = {
+	{ "global", tree<global_frames> },
+	{ "mm_mt", tree<mt_frames> },
+	{ "frame", tree<mm_frame::allocated> },
+};
+
+static int nthreads = DEF_THREADS;
+static int depth = DEF_DEPTH;
+static long niters = DEF_ITERS;
+
+static pthread_barrier_t barrier;
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+	int c;
+	size_t i, j;
+	int ran = 0;
+
+	while ((c = getopt(argc, argv, "ht:d:i:")) != EOF) {
+		switch (c) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'i':
+			niters = atol(optarg);
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+	if (nthreads < 1 || depth < 0 || depth > 20 || niters < 1) {
+		usage();
+		exit(1);
+	}
+
+	mem_init();
+	mm_mt_init(MT_CACHE_THREAD);
+	printf("%d threads, trees of depth %d (%ld frames), %ld per thread\n",
+			nthreads, depth, tree_frames(depth), niters);
+	for (i = optind; i < (size_t)argc; i++) {
+		for (j = 0; j < sizeof(policies) / sizeof(policies[0]); j++)
+			if (strcmp(argv[i], policies[j].name) == 0)
+				break;
+		if (j == sizeof(policies) / sizeof(policies[0])) {
+			fprintf(stderr, "framebench: unknown policy %s\n", argv[i]);
+			exit(1);
+		}
+		run_policy(&policies[j]);
+		ran = 1;
+	}
+	if (!ran)
+		for (j = 0; j < sizeof(policies) / sizeof(policies[0]); j++)
+			run_policy(&policies[j]);
+	exit(0);
+}
+
+/*
+ * node - Await the trees below, one after the other
+ */
+template <class Frames>
+static task<Frames> node(int depth, long x)
+{
+	if (depth == 0)
+		co_return co_await leaf<Frames>(x);
+	long a = co_await node<Frames>(depth - 1, 2 * x);
+	long b = co_await node<Frames>(depth - 1, 2 * x + 1);
+	co_return a + b;
+}
+
+/*
+ * leaf - Fill a buffer that lives in the frame, and sum it
+ */
+template <class Frames>
+static task<Frames> leaf(long x)
+{
+	unsigned char buf[LEAF_BYTES];
+	long sum = 0;
+	int i;
+
+	memset(buf, (int)x, sizeof(buf));
+	co_await std::suspend_never();
+	for (i = 0; i < LEAF_BYTES; i += 64)
+		sum += buf[i];
+	co_return sum;
+}
+
+template <class Frames>
+static long tree(int depth, long x)
+{
+	return node<Frames>(depth, x).run();
+}
+
+/*
+ * run_policy - Run the trees with one policy on every thread, RUNS
+ *    times, and print the time per frame of the fastest run
+ */
+static void run_policy(const policy_t *policy)
+{
+	bench_thread_t *threads;
+	pthread_t *tids;
+	double secs, best = 0;
+	long hits = 0, misses = 0, spills = 0;
+	int r, t;
+
+	threads = (bench_thread_t *)calloc(nthreads, sizeof(bench_thread_t));
+	tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+	if (threads == NULL || tids == NULL)
+		unix_error("calloc failed in run_policy");
+	pthread_barrier_init(&barrier, NULL, nthreads);
+
+	for (r = 0; r < RUNS; r++) {
+		for (t = 0; t < nthreads; t++) {
+			threads[t].policy = policy;
+			if (pthread_create(&tids[t], NULL, bench_thread, &threads[t]) != 0)
+				unix_error("pthread_create failed in run_policy");
+		}
+		for (t = 0; t < nthreads; t++)
+			pthread_join(tids[t], NULL);
+
+		secs = 0;
+		for (t = 0; t < nthreads; t++)
+			if (threads[t].end - threads[t].start > secs)
+				secs = threads[t].end - threads[t].start;
+		if (r == 0 || secs < best) {
+			best = secs;
+			hits = misses = spills = 0;
+			for (t = 0; t < nthreads; t++) {
+				hits += threads[t].stats.hits;
+				misses += threads[t].stats.misses;
+				spills += threads[t].stats.spills;
+			}
+		}
+	}
+
+	printf("%-8s %8.1f ns/frame", policy->name,
+			best * 1e9 / ((double)tree_frames(depth) * niters));
+	if (hits + misses > 0)
+		printf("  pool hits %.2f%% (%ld misses, %ld spills)",
+				100.0 * hits / (hits + misses), misses, spills);
+	printf("\n");
+
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+	free(tids);
+}
+
+/*
+ * bench_thread - Run niters trees, timed between the barrier and the
+ *    end of the last one
+ */
+static void *bench_thread(void *arg)
+{
+	bench_thread_t *t = (bench_thread_t *)arg;
+	mm_frame::stats before;
+	long i;
+
+	before = mm_frame::thread_stats();
+	pthread_barrier_wait(&barrier);
+	t->start = wallclock();
+	t->sum = 0;
+	for (i = 0; i < niters; i++)
+		t->sum += t->policy->tree(depth, i);
+	t->end = wallclock();
+
+	t->stats = mm_frame::thread_stats();
+	t->stats.hits -= before.hits;
+	t->stats.misses -= before.misses;
+	t->stats.spills -= before.spills;
+	return NULL;
+}
+
+/*
+ * tree_frames - Frames of one tree of the given depth
+ */
+static long tree_frames(int depth)
+{
+	return depth == 0 ? 2 : 1 + 2 * tree_frames(depth - 1);
+}
+
+/*
+ * wallclock - Monotonic wall clock time in seconds
+ */
+static double wallclock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: framebench [-h] [-t <n>] [-d <n>] [-i <n>] "
+			"[policy...]\n");
+	fprintf(stderr, "Options\n");
+	fprintf(stderr, "\t-h         Print this message.\n");
+	fprintf(stderr, "\t-t <n>     Run <n> threads (default %d).\n", DEF_THREADS);
+	fprintf(stderr, "\t-d <n>     Tree depth, at most 20 (default %d).\n",
+			DEF_DEPTH);
+	fprintf(stderr, "\t-i <n>     Trees per thread (default %d).\n", DEF_ITERS);
+	fprintf(stderr, "Policies: global mm_mt frame (default: all)\n");
+}
+
+/*
+ * unix_error - Report Unix-style error and terminate the program
+ */
+static void unix_error(const char *msg)
+{
+	fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+	exit(1);
+}
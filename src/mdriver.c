@@ -9,7 +9,10 @@
  */
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
+#include <math.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -18,14 +21,21 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifndef __GCC__
 #  define __attribute__(args)
 #endif
 
 #include "mm.h"
+#include "mm_mt.h"
+#include "mm_shm.h"
+#include "mm_null.h"
+#include "mm_cachesim.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
 
 /**********************
@@ -37,6 +47,41 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Multithreaded replay (-T) */
+#define MT_RUNS        3 /* keep the fastest of this many runs per mode */
+#define MT_MAXSWEEP   32 /* max thread counts in one -T list */
+
+/* Per-request latency (-R, -B) */
+#define LAT_BUCKETS   16 /* log2 latency buckets, the first is < 2^LAT_MINLOG ns */
+#define LAT_MINLOG     6
+#define MAXBUDGETS    32 /* max search budgets in one -B list */
+
+/* Interleaved replay (-I) */
+#define MAXQUANTA     32 /* max quanta in one -I list */
+
+/* Timeline (-L) */
+#define PHASE_COST     2 /* a phase ends when the cycles per op change this much ... */
+#define PHASE_MIX   0.25 /* ... or the net allocs per op cross this ... */
+#define PHASE_RUN      2 /* ... for this many rows in a row */
+
+/* Checkpoints (-k, -r) */
+#define CKPT_MAGIC  0x6d6d636b  /* "mmck" */
+#define CKPT_VERSION 1
+
+/* Timing a trace (run_tests): K-best, as in fcyc, over samples of the
+   replays against mm and against the null allocator taken in turn */
+#define SPEED_K          3 /* the K fastest samples of each ... */
+#define SPEED_EPSILON 0.01 /* ... within this of the fastest, ... */
+#define SPEED_MAXSAMPLES 20 /* ... or this many samples, whichever first */
+#define SPEED_MINSECS 1e-3 /* timed replays in one sample add up to this */
+
+/* Baselines (-b, -C): the same samples, but all of them kept */
+#define BASE_SAMPLES  21 /* timed samples per trace ... */
+#define BASE_MINSECS 2e-3 /* ... each repeating the replay for this long */
+#define BASE_ALPHA  0.01 /* a slowdown must be this significant ... */
+#define BASE_SHIFT  0.10 /* ... and move the median by more than run-to-run noise */
+#define BASE_UTIL  0.001 /* utilization may drop this much (it is exact) */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
@@ -79,6 +124,22 @@ typedef struct {
 	int *block_rand_base;/* index into random_data, if debug is on */
 } trace_t;
 
+/*
+ * One trace request, pre-decoded for the direct-threaded replay used to
+ * time the mm package: the address of the code that runs it (a label
+ * of the replay function) and the block table entry it works on are
+ * resolved up front, so replaying is a load and an indirect jump per
+ * request.  The stream ends with a request whose code returns.
+ */
+typedef struct {
+	const void *code;    /* where the replay function runs it */
+	char **slot;         /* its entry in trace->blocks */
+	size_t size;         /* byte size of alloc/realloc request */
+	int type;            /* ALLOC, FREE, REALLOC or DOP_END */
+} dop_t;
+
+#define DOP_END (REALLOC + 1)  /* type of the request ending the stream */
+
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
  * This struct is necessary because fcyc accepts only a pointer array
@@ -87,8 +148,77 @@ typedef struct {
 typedef struct {
 	trace_t *trace;
 	range_t *ranges;
+	dop_t *dops;         /* the trace, decoded for the mm replay */
 } speed_t;
 
+/* Holds the state of one thread of a multithreaded replay */
+typedef struct {
+	trace_t *trace;
+	char **blocks;       /* this thread's private copy of trace->blocks */
+	int failed;          /* an allocation failed (the heap is full) */
+	double start, end;   /* wall-clock time around this thread's replay */
+} mt_thread_t;
+
+/* Latencies of the requests of one timed trace replay (-R, -B) */
+typedef struct {
+	double *ns;                  /* latency of each request */
+	int n;                       /* number of requests timed */
+	long hist[LAT_BUCKETS];      /* log2 histogram of ns */
+	double util;                 /* peak payload / final heap size */
+} lat_t;
+
+/*
+ * Holds the traces of an interleaved replay (-I), which runs them all
+ * against one heap, round robin, quantum requests per turn.  Every
+ * trace keeps its own block table, so block ids are per trace.
+ */
+typedef struct mix_t {
+	trace_t **traces;
+	int ntraces;
+	int quantum;         /* requests per turn; 0 runs each trace to the end */
+	int *next;           /* next request of each trace */
+	range_t *ranges;     /* payload extents, for the correctness pass */
+	size_t total, peak;  /* live payload bytes now and at most */
+} mix_t;
+
+/* Runs request opnum of trace within a mix; returns 0 on failure */
+typedef int (*mix_op_t)(mix_t *mix, trace_t *trace, int opnum);
+
+/* One row of a timeline (-L): the state after a window of requests */
+typedef struct {
+	int op;              /* requests replayed so far */
+	size_t live;         /* payload bytes allocated */
+	size_t heap, mapped; /* bytes of heap and of mappings */
+	long free_blocks;    /* -1 if the mm package does not say */
+	long largest_free;
+	double cycles;       /* spent in the window */
+	int net;             /* allocations less frees in the window */
+	int phase;
+} row_t;
+
+/*
+ * The header of a checkpoint file (-k), which goes on with mm's saved
+ * globals (mm_size bytes), the heap (heap_size bytes) and the trace's
+ * block table: num_ids block pointers, then num_ids payload sizes
+ */
+typedef struct {
+	unsigned magic;      /* CKPT_MAGIC */
+	unsigned version;    /* CKPT_VERSION */
+	char trace[MAXLINE]; /* path of the trace file */
+	int op;              /* requests replayed before the checkpoint */
+	int num_ids;
+	void *heap_lo;       /* where the heap was */
+	size_t heap_size;
+	size_t mm_size;
+} ckpt_t;
+
+/* What the fcyc-timed functions of a restore (-r) work on */
+typedef struct {
+	const ckpt_t *ckpt;  /* the checkpoint file, mapped */
+	trace_t *trace;
+	int end;             /* replay requests ckpt->op to end */
+} restore_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
 	/* set in read_trace */
@@ -102,6 +232,13 @@ typedef struct {
 
 	/* defined only for the student malloc package */
 	double util;     /* space utilization for this trace (always 0 for libc) */
+	double heap;     /* heap bytes at the end of a replay */
+	double null_secs;/* median secs of the null replay (-b, -C) */
+	int unresolved;  /* secs was too close to the null replay to tell */
+
+	/* set only when saving or comparing a baseline (-b, -C) */
+	int nsamples;
+	double samples[BASE_SAMPLES]; /* wall-clock secs per replay */
 
 	/* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -157,6 +294,39 @@ int verbose = 1;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 int onetime_flag = 0;
 
+/* thread counts of the multithreaded replay (-T); none runs the normal tests */
+static int mt_sweep[MT_MAXSWEEP];
+static int mt_nsweep = 0;
+static pthread_barrier_t mt_barrier;
+
+/* requests timed per trace by the cold-start replay (-R); 0 runs the normal tests */
+static int cold_nops = 0;
+
+/* find_fit budgets swept by the latency replay (-B); none runs the normal tests */
+static unsigned budgets[MAXBUDGETS];
+static int nbudgets = 0;
+
+/* quanta of the interleaved replay (-I); none runs the normal tests */
+static int quanta[MAXQUANTA];
+static int nquanta = 0;
+
+/* checkpoint to write after ckpt_op requests (-k), or to time from (-r)
+   up to request restore_end (0 for the end of the trace) */
+static char *ckpt_file = NULL;
+static int ckpt_op = -1;
+static char *restore_file = NULL;
+static int restore_end = 0;
+
+/* if set, count simulated cache misses instead (-M) */
+static int sim_flag = 0;
+
+/* requests per row of the timeline (-L); 0 runs the normal tests */
+static int timeline_every = 0;
+
+/* baseline files written (-b) and compared against (-C) */
+static char *base_save = NULL;
+static char *base_compare = NULL;
+
 /* by default, no timeouts */
 static int set_timeout = 0;
 
@@ -198,7 +368,70 @@ static void eval_libc_speed(void *ptr);
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum);
-static void eval_mm_speed(void *ptr);
+static void time_replays(speed_t *params, double *secs, double *null_secs);
+static double time_replay(speed_t *params, int null, int reps);
+static int add_sample(double *best, int *nbest, double secs);
+static dop_t *decode_trace(trace_t *trace);
+static int replay_mm(dop_t *op, int patch);
+static int replay_null(dop_t *op, int patch);
+
+/* Routines for the multithreaded replay through mm_mt */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles, int nthreads);
+static void parse_mt_sweep(const char *arg);
+static void *mt_replay(void *ptr);
+static double mt_wallclock(void);
+
+/* Per-request latency: cold start (-R) and search budgets (-B) */
+static void run_cold_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles, int nops);
+static void run_budget_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles);
+static void parse_budgets(const char *arg);
+static int lat_replay(trace_t *trace, lat_t *lat, int touch);
+static double lat_percentile(lat_t *lat, double pct);
+static int cmp_double(const void *a, const void *b);
+
+/* Interleaved replay of all traces on one heap (-I) */
+static void run_mix_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles);
+static void parse_quanta(const char *arg);
+static int mix_run(mix_t *mix, mix_op_t op);
+static int mix_valid_op(mix_t *mix, trace_t *trace, int opnum);
+static int mix_util_op(mix_t *mix, trace_t *trace, int opnum);
+static int mix_speed_op(mix_t *mix, trace_t *trace, int opnum);
+static void eval_mix_speed(void *ptr);
+
+/* Checkpoints of a trace (-k) and replays from them (-r) */
+static void save_checkpoint(const char *tracedir, const char *tracefile,
+		int op, const char *file);
+static void run_restore_tests(const char *file, int end);
+static void restore_checkpoint(restore_t *r);
+static void eval_restore(void *ptr);
+static void eval_restore_speed(void *ptr);
+static int range_replay(trace_t *trace, int lo, int hi);
+
+/* Simulated cache misses of each trace (-M) */
+static void run_sim_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles);
+static int sim_replay(trace_t *trace, int touch, mm_sim_stats_t *sim);
+
+/* Timeline of each trace (-L) */
+static void run_timeline_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles);
+static int timeline_replay(trace_t *trace, row_t *rows);
+static int timeline_phases(row_t *rows, int nrows);
+static int timeline_kind(int net, int ops);
+
+/* these functions save and compare baselines */
+static void save_baseline(const char *file, const char *variant,
+		int n, stats_t *stats);
+static int compare_baseline(const char *file, const char *variant,
+		int n, stats_t *stats);
+static void sample_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles, stats_t *mm_stats);
+static double mann_whitney(const double *x, int nx, const double *y, int ny);
+static double median(const double *x, int n);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
@@ -224,6 +457,7 @@ static void run_tests(int num_tracefiles, const char *tracedir,
 		stats_t *mm_stats, range_t *ranges, speed_t *speed_params) {
 	volatile int i;
 	volatile int timed_out = 0;
+	double secs, null_secs;
 
 	for (i=0; i < num_tracefiles; i++) {
 		/* handle timeouts */
@@ -255,7 +489,23 @@ static void run_tests(int num_tracefiles, const char *tracedir,
 			speed_params->ranges = ranges;
 			if (verbose > 1)
 				printf("and performance.\n");
-			mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+
+			/* Charge the mm package only for what it adds to the
+			   replay against the null allocator.  A difference
+			   within SPEED_EPSILON of the replay is below what
+			   the K-best samples resolve: the trace is reported
+			   unresolved and left out of the throughput */
+			speed_params->dops = decode_trace(trace);
+			time_replays(speed_params, &secs, &null_secs);
+			mm_stats[i].secs = secs - null_secs;
+			mm_stats[i].unresolved =
+				mm_stats[i].secs <= SPEED_EPSILON * secs;
+			if (verbose > 1)
+				printf("Replay overhead %.0f%% of %.6f secs\n",
+						100 * null_secs / secs, secs);
+
+			mm_stats[i].heap = mem_heapsize();
+			free(speed_params->dops);
 		}
 		free_trace(trace);
 	}
@@ -283,6 +533,7 @@ int main(int argc, char **argv)
 	double secs, ops, util, avg_mm_util, avg_mm_throughput = 0, p1, p2, perfindex;
 	double weight = 0;
 	int numcorrect;
+	const char *variant;
 
 
 	setbuf(stdout, 0);
@@ -291,7 +542,7 @@ int main(int argc, char **argv)
 	/*
 	 * Read and interpret the command line arguments
 	 */
-	while ((c = getopt(argc, argv, "d:f:c:s:t:v:hVAlD")) != EOF) {
+	while ((c = getopt(argc, argv, "d:f:c:s:t:v:T:R:B:I:L:b:C:k:r:hVAlDMS")) != EOF) {
 		switch (c) {
 
 			case 'A': /* Hidden Autolab driver argument */
@@ -349,6 +600,65 @@ int main(int argc, char **argv)
 				set_timeout = atoi(optarg);
 				break;
 
+			case 'T': /* Replay traces in these many threads through mm_mt */
+				parse_mt_sweep(optarg);
+				break;
+
+			case 'R': /* Latency of the first n requests from a cold heap */
+				if ((cold_nops = atoi(optarg)) < 1)
+					app_error("-R needs at least one request\n");
+				break;
+
+			case 'B': /* Latency and utilization at these find_fit budgets */
+				parse_budgets(optarg);
+				break;
+
+			case 'I': /* Interleave all traces on one heap with these quanta */
+				parse_quanta(optarg);
+				break;
+
+			case 'k': /* Save a checkpoint after the first K requests */
+				ckpt_op = atoi(optarg);
+				if (ckpt_op < 0 || (ckpt_file = strchr(optarg, ':')) == NULL)
+					app_error("-k needs <K>:<file>\n");
+				ckpt_file++;
+				break;
+
+			case 'r': /* Time the requests after a checkpoint */
+				restore_file = optarg;
+				if ((optarg = strrchr(optarg, ':')) != NULL) {
+					*optarg = '\0';
+					restore_end = atoi(optarg + 1);
+				}
+				break;
+
+			case 'M': /* Count simulated cache misses */
+#ifndef CACHESIM
+				app_error("-M needs a driver built with -DCACHESIM (make mdriver-sim)\n");
+#endif
+				sim_flag = 1;
+				break;
+
+			case 'L': /* Print a timeline of each trace, a row per n requests */
+				if ((timeline_every = atoi(optarg)) < 1)
+					app_error("-L needs at least one request per row\n");
+				break;
+
+			case 'b': /* Save the results as a baseline */
+				base_save = optarg;
+				break;
+
+			case 'C': /* Compare the results against a baseline */
+				base_compare = optarg;
+				break;
+
+			case 'S': /* Publish live statistics for mmtop */
+				if (mm_shm_open(NULL) < 0)
+					unix_error("ERROR: mm_shm_open failed in main");
+				atexit(mm_shm_close);
+				printf("Publishing statistics: mmtop %ld\n", (long)getpid());
+				break;
+
 			case 'h': /* Print this message */
 				usage();
 				exit(0);
@@ -359,7 +669,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (tracefiles == NULL) {
+	if (tracefiles == NULL && restore_file == NULL) {
 		tracefiles = default_tracefiles;
 		num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
 		printf("Using default tracefiles in %s\n", tracedir);
@@ -378,6 +688,57 @@ int main(int argc, char **argv)
 		signal(SIGALRM, timeout_handler);
 	}
 
+	/*
+	 * The multithreaded replay replaces the normal tests
+	 */
+	if (mt_nsweep > 0) {
+		mem_init();
+		for (i = 0; i < mt_nsweep; i++)
+			run_mt_tests(num_tracefiles, tracedir, tracefiles, mt_sweep[i]);
+		exit(0);
+	}
+
+	/*
+	 * So does the cold-start latency measurement
+	 */
+	if (cold_nops > 0) {
+		mem_init();
+		run_cold_tests(num_tracefiles, tracedir, tracefiles, cold_nops);
+		exit(0);
+	}
+	if (nbudgets > 0) {
+		mem_init();
+		run_budget_tests(num_tracefiles, tracedir, tracefiles);
+		exit(0);
+	}
+	if (nquanta > 0) {
+		mem_init();
+		run_mix_tests(num_tracefiles, tracedir, tracefiles);
+		exit(0);
+	}
+	if (ckpt_file != NULL) {
+		if (num_tracefiles != 1)
+			app_error("-k needs a single trace (-f)\n");
+		mem_init();
+		save_checkpoint(tracedir, tracefiles[0], ckpt_op, ckpt_file);
+		exit(0);
+	}
+	if (restore_file != NULL) {
+		mem_init();
+		run_restore_tests(restore_file, restore_end);
+		exit(0);
+	}
+	if (sim_flag) {
+		mem_init();
+		run_sim_tests(num_tracefiles, tracedir, tracefiles);
+		exit(0);
+	}
+	if (timeline_every > 0) {
+		mem_init();
+		run_timeline_tests(num_tracefiles, tracedir, tracefiles);
+		exit(0);
+	}
+
 	/*
 	 * Optionally run and evaluate the libc malloc package
 	 */
@@ -429,6 +790,8 @@ int main(int argc, char **argv)
 
 	run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
 			ranges, &speed_params);
+	if ((base_save != NULL || base_compare != NULL) && !onetime_flag)
+		sample_tests(num_tracefiles, tracedir, tracefiles, mm_stats);
 
 
 	/* Display the mm results in a compact table */
@@ -455,8 +818,10 @@ int main(int argc, char **argv)
 	util = 0;
 	numcorrect = 0;
 	for (i=0; i < num_tracefiles; i++) {
-		secs += mm_stats[i].secs * mm_stats[i].weight;
-		ops += mm_stats[i].ops * mm_stats[i].weight;
+		if (!mm_stats[i].unresolved) {
+			secs += mm_stats[i].secs * mm_stats[i].weight;
+			ops += mm_stats[i].ops * mm_stats[i].weight;
+		}
 		util += mm_stats[i].util * mm_stats[i].weight;
 		weight += mm_stats[i].weight;
 		if (mm_stats[i].valid)
@@ -518,6 +883,14 @@ int main(int argc, char **argv)
 	  printf("Perfpoints: %0.f\n", (40.0+((3.0*perfindex)/5.0)));
 	else
 	  printf("Perfpoints: 100\n");
+
+	/* The allocator is named after the driver it is linked into */
+	variant = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+	if (base_save != NULL)
+		save_baseline(base_save, variant, num_tracefiles, mm_stats);
+	if (base_compare != NULL &&
+			compare_baseline(base_compare, variant, num_tracefiles, mm_stats) > 0)
+		exit(2);
 	exit(0);
 }
 
@@ -549,9 +922,11 @@ static int add_range(range_t **ranges, char *lo, int size,
 		return 0;
 	}
 
-	/* The payload must lie within the extent of the heap */
-	if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-			(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+	/* The payload must lie within the extent of the heap, or within one
+	   of the mappings the allocator made for large blocks */
+	if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+			(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+			!mem_is_mapped(lo, hi)) {
 		malloc_error(trace, opnum,
 				"Payload (%p:%p) lies outside heap (%p:%p)",
 				lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -959,7 +1334,9 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
  *   size of the heap in bytes after running the student's malloc
  *   package on the trace. Note that our implementation of mem_sbrk()
  *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   is always the high water mark of the heap.  Mappings the package
+ *   makes for large blocks count too: the denominator is memlib's
+ *   footprint, the high water mark of heap plus mapped bytes.
  *
  *   A higher number is better: 1 is optimal.
  */
@@ -1044,63 +1421,168 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 
 	printf("max_total_size = %f\n", (double)max_total_size);
 	printf("mem_heapsize = %f\n", (double)mem_heapsize());
+	printf("mem_footprint = %f\n", (double)mem_footprint());
 	
-	return ((double)max_total_size / (double)mem_heapsize());
+	return ((double)max_total_size / (double)mem_footprint());
 }
 
 
 /*
- * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
+ * time_replays - Time the replay of params->dops against mm, each from
+ *    a fresh heap, and against the null allocator.  Samples of the two
+ *    alternate, so that both see the same state of the machine, until
+ *    the SPEED_K fastest of each are within SPEED_EPSILON of the
+ *    fastest (fcyc's K-best scheme) or there are SPEED_MAXSAMPLES of
+ *    each; return the fastest of each.  A sample repeats the replay
+ *    until the timed replays add up to SPEED_MINSECS, since a single
+ *    replay of the short traces takes microseconds.
  */
-static void eval_mm_speed(void *ptr)
+static void time_replays(speed_t *params, double *secs, double *null_secs)
 {
-	int i, index, size, newsize;
-	char *p, *newp, *oldp, *block;
-	trace_t *trace = ((speed_t *)ptr)->trace;
-	reinit_trace(trace);
-
-	/* Reset the heap and initialize the mm package */
-	mem_reset_brk();
-	if (mm_init() < 0)
-		app_error("mm_init failed in eval_mm_speed");
+	double best[SPEED_K], null_best[SPEED_K];
+	int j, reps, nbest = 0, null_nbest = 0, done = 0;
+
+	for (reps = 1; time_replay(params, 0, reps) * reps < SPEED_MINSECS; reps *= 2)
+		;
+	for (j = 0; j < SPEED_MAXSAMPLES && !done; j++) {
+		done = add_sample(null_best, &null_nbest, time_replay(params, 1, reps));
+		done &= add_sample(best, &nbest, time_replay(params, 0, reps));
+	}
+	*secs = best[0];
+	*null_secs = null_best[0];
+}
 
-	/* Interpret each trace request */
-	for (i = 0;  i < trace->num_ops;  i++)
-		switch (trace->ops[i].type) {
+/*
+ * time_replay - Secs per replay of params->dops against mm (null 0) or
+ *    the null allocator (null 1), over reps replays.  Only the replays
+ *    are timed: the heap reset and mm_init before each are not.
+ */
+static double time_replay(speed_t *params, int null, int reps)
+{
+	double start, secs = 0;
+	int r;
 
-			case ALLOC: /* mm_malloc */
-				index = trace->ops[i].index;
-				size = trace->ops[i].size;
-				if ((p = mm_malloc(size)) == NULL)
-					app_error("mm_malloc error in eval_mm_speed");
-				trace->blocks[index] = p;
-				break;
+	if (null)
+		replay_null(params->dops, 1);
+	else
+		replay_mm(params->dops, 1);
+	for (r = 0; r < reps; r++) {
+		if (null) {
+			start = mt_wallclock();
+			replay_null(params->dops, 0);
+		} else {
+			mem_reset_brk();
+			if (mm_init() < 0)
+				app_error("mm_init failed in time_replay");
+			start = mt_wallclock();
+			if (replay_mm(params->dops, 0) < 0)
+				app_error("mm_malloc or mm_realloc error in time_replay");
+		}
+		secs += mt_wallclock() - start;
+	}
+	return secs / reps;
+}
 
-			case REALLOC: /* mm_realloc */
-				index = trace->ops[i].index;
-				newsize = trace->ops[i].size;
-				oldp = trace->blocks[index];
-				if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
-					app_error("mm_realloc error in eval_mm_speed");
-				trace->blocks[index] = newp;
-				break;
+/*
+ * add_sample - Add secs to the *nbest fastest samples, kept sorted in
+ *    best[0..SPEED_K); return whether the SPEED_K fastest converged
+ */
+static int add_sample(double *best, int *nbest, double secs)
+{
+	int i;
 
-			case FREE: /* mm_free */
-				index = trace->ops[i].index;
-				if(index < 0) {
-					block = 0;
-				} else {
-					block = trace->blocks[index];
-				}
-				mm_free(block);
-				break;
+	if (*nbest < SPEED_K || secs < best[SPEED_K - 1]) {
+		i = *nbest < SPEED_K ? (*nbest)++ : SPEED_K - 1;
+		for (; i > 0 && best[i - 1] > secs; i--)
+			best[i] = best[i - 1];
+		best[i] = secs;
+	}
+	return *nbest == SPEED_K && (1 + SPEED_EPSILON) * best[0] >= best[SPEED_K - 1];
+}
 
-			default:
-				app_error("Nonexistent request type in eval_mm_speed");
+/*
+ * decode_trace - Decode trace into a dop_t stream for replay_mm and
+ *    replay_null, which fill in the code addresses.  Every slot is
+ *    written before it is read, so the replays need not clear the
+ *    block table: the first request on a block that is a realloc
+ *    becomes a malloc (it reallocs NULL) and one that is a free, or a
+ *    realloc to size zero, frees NULL.
+ */
+static dop_t *decode_trace(trace_t *trace)
+{
+	static char *null_slot = NULL;   /* the block of free(NULL) */
+	dop_t *dops, *op;
+	char *seen;
+	int i, index;
+
+	if ((dops = calloc(trace->num_ops + 1, sizeof(dop_t))) == NULL ||
+			(seen = calloc(trace->num_ids + 1, 1)) == NULL)
+		unix_error("calloc failed in decode_trace");
+	for (i = 0; i < trace->num_ops; i++) {
+		op = &dops[i];
+		index = trace->ops[i].index;
+		op->type = trace->ops[i].type;
+		op->size = trace->ops[i].size;
+		op->slot = index < 0 ? &null_slot : &trace->blocks[index];
+		if (index >= 0 && !seen[index]) {
+			if (op->type == FREE || (op->type == REALLOC && op->size == 0)) {
+				op->type = FREE;
+				op->slot = &null_slot;
+				continue;
+			}
+			op->type = ALLOC;
+			seen[index] = 1;
 		}
+	}
+	dops[i].type = DOP_END;
+	free(seen);
+	return dops;
+}
+
+/*
+ * REPLAY - Define a direct-threaded replay function over the given
+ *    allocator.  With patch set, it points the code of every request
+ *    in a decoded stream at its own labels; otherwise it replays the
+ *    stream, returning -1 if an allocation fails.  Uses the GCC
+ *    labels-as-values extension.
+ */
+#define REPLAY(name, malloc_fn, realloc_fn, free_fn) \
+static int name(dop_t *op, int patch) \
+{ \
+	static const void *const code[] = { \
+		[ALLOC] = &&do_alloc, [FREE] = &&do_free, \
+		[REALLOC] = &&do_realloc, [DOP_END] = &&do_end \
+	}; \
+	\
+	if (patch) { \
+		for (; op->type != DOP_END; op++) \
+			op->code = code[op->type]; \
+		op->code = code[DOP_END]; \
+		return 0; \
+	} \
+	goto *op->code; \
+	\
+do_alloc: \
+	if ((*op->slot = malloc_fn(op->size)) == NULL) \
+		return -1; \
+	op++; \
+	goto *op->code; \
+do_realloc: \
+	if ((*op->slot = realloc_fn(*op->slot, op->size)) == NULL && op->size != 0) \
+		return -1; \
+	op++; \
+	goto *op->code; \
+do_free: \
+	free_fn(*op->slot); \
+	op++; \
+	goto *op->code; \
+do_end: \
+	return 0; \
 }
 
+REPLAY(replay_mm, mm_malloc, mm_realloc, mm_free)
+REPLAY(replay_null, null_malloc, null_realloc, null_free)
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1198,28 +1680,1473 @@ static void eval_libc_speed(void *ptr)
 	}
 }
 
-/*************************************
- * Some miscellaneous helper routines
- ************************************/
+/*
+ * run_mt_tests - Replay every trace concurrently in nthreads threads
+ *    through the mm_mt front end, once per cache mode, and report
+ *    throughput next to the memory the caches hold on to.  Each thread
+ *    has its own block table, so the threads run independent copies of
+ *    the trace against one shared heap.
+ */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles, int nthreads)
+{
+	static const int modes[] = {
+		MT_CACHE_NONE, MT_CACHE_SHARED, MT_CACHE_THREAD, MT_CACHE_CPU,
+		MT_CACHE_THREAD | MT_ISOLATE, MT_CACHE_CPU | MT_ISOLATE
+	};
+	stats_t stats;
+	trace_t *trace;
+	mt_thread_t *threads;
+	pthread_t *tids;
+	mt_stats_t mts, best_mts;
+	double start, end, secs, best;
+	size_t heapsize, best_heapsize;
+	int i, m, r, t, failed;
+
+	if ((threads = calloc(nthreads, sizeof(mt_thread_t))) == NULL ||
+			(tids = calloc(nthreads, sizeof(pthread_t))) == NULL)
+		unix_error("calloc failed in run_mt_tests");
+
+	printf("\nResults for mm_mt with %d threads:\n", nthreads);
+	printf("%10s%9s%10s%10s%10s%6s  %s\n",
+			"cache", "Kops", "heap(KB)", "cache(KB)", "meta(KB)", "hit%", "trace");
+
+	for (i = 0; i < num_tracefiles; i++) {
+		trace = read_trace(&stats, tracedir, tracefiles[i]);
+		for (t = 0; t < nthreads; t++) {
+			threads[t].trace = trace;
+			if ((threads[t].blocks = calloc(trace->num_ids, sizeof(char *))) == NULL)
+				unix_error("calloc failed in run_mt_tests");
+		}
+
+		for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+			best = DBL_MAX;
+			best_heapsize = 0;
+			failed = 0;
+			memset(&best_mts, 0, sizeof(best_mts));
+			for (r = 0; r < MT_RUNS && !failed; r++) {
+				mem_reset_brk();
+				if (mm_init() < 0 || mm_mt_init(modes[m]) < 0)
+					app_error("mm_init failed in run_mt_tests\n");
+				pthread_barrier_init(&mt_barrier, NULL, nthreads + 1);
+				for (t = 0; t < nthreads; t++) {
+					threads[t].failed = 0;
+					if (pthread_create(&tids[t], NULL, mt_replay, &threads[t]) != 0)
+						unix_error("pthread_create failed in run_mt_tests");
+				}
+
+				pthread_barrier_wait(&mt_barrier);	/* start */
+				pthread_barrier_wait(&mt_barrier);	/* all threads done */
+				start = DBL_MAX;
+				end = 0;
+				for (t = 0; t < nthreads; t++) {
+					start = threads[t].start < start ? threads[t].start : start;
+					end = threads[t].end > end ? threads[t].end : end;
+				}
+				secs = end - start;
+				mm_mt_stats(&mts);
+				heapsize = mem_footprint();
+				pthread_barrier_wait(&mt_barrier);	/* let them exit */
+
+				for (t = 0; t < nthreads; t++) {
+					pthread_join(tids[t], NULL);
+					failed |= threads[t].failed;
+				}
+				pthread_barrier_destroy(&mt_barrier);
+
+				if (secs < best) {
+					best = secs;
+					best_mts = mts;
+					best_heapsize = heapsize;
+				}
+			}
+
+			if (failed) {
+				printf("%10s%9s%10s%10s%10s%6s  %s\n", mm_mt_modename(modes[m]),
+						"oom", "-", "-", "-", "-", trace->filename);
+				continue;
+			}
+			printf("%10s%9.0f%10.1f%10.1f%10.1f%5.0f%%  %s%s\n",
+					mm_mt_modename(modes[m]),
+					(double)trace->num_ops * nthreads / 1e3 / best,
+					best_heapsize / 1024.0,
+					best_mts.cached_bytes / 1024.0,
+					best_mts.meta_bytes / 1024.0,
+					100.0 * best_mts.hits /
+						(best_mts.hits + best_mts.misses ? best_mts.hits + best_mts.misses : 1),
+					trace->filename,
+					(modes[m] & ~MT_ISOLATE) == MT_CACHE_CPU && !best_mts.rseq ? " (no rseq)" : "");
+		}
 
+		for (t = 0; t < nthreads; t++)
+			free(threads[t].blocks);
+		free_trace(trace);
+	}
+	free(threads);
+	free(tids);
+}
 
 /*
- * printresults - prints a performance summary for some malloc package
+ * parse_mt_sweep - Parse the -T argument: a comma-separated list of
+ *    thread counts, or "cores" for 1, 2, 4, ... up to the number of
+ *    online CPUs.
  */
-static void printresults(int n, stats_t *stats)
+static void parse_mt_sweep(const char *arg)
+{
+	char *copy, *tok;
+	long ncores, n;
+
+	mt_nsweep = 0;
+	if (strcmp(arg, "cores") == 0) {
+		ncores = sysconf(_SC_NPROCESSORS_ONLN);
+		for (n = 1; n < ncores && mt_nsweep < MT_MAXSWEEP - 1; n *= 2)
+			mt_sweep[mt_nsweep++] = n;
+		mt_sweep[mt_nsweep++] = ncores < 1 ? 1 : ncores;
+		return;
+	}
+
+	if ((copy = strdup(arg)) == NULL)
+		unix_error("strdup failed in parse_mt_sweep");
+	for (tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if (mt_nsweep == MT_MAXSWEEP)
+			app_error("-T takes at most %d thread counts\n", MT_MAXSWEEP);
+		if ((mt_sweep[mt_nsweep++] = atoi(tok)) < 1)
+			app_error("-T needs thread counts of at least one\n");
+	}
+	free(copy);
+}
+
+/*
+ * mt_replay - Thread body of run_mt_tests: run one copy of the trace
+ *    between the start and done barriers, timing it, then wait until
+ *    the main thread has sampled the caches before exiting (which
+ *    flushes them).  The threads time themselves because the main
+ *    thread may not be scheduled while they run.
+ */
+static void *mt_replay(void *ptr)
+{
+	mt_thread_t *t = ptr;
+	trace_t *trace = t->trace;
+	int i, index;
+	size_t size;
+	char *p;
+
+	memset(t->blocks, 0, trace->num_ids * sizeof(*t->blocks));
+	pthread_barrier_wait(&mt_barrier);
+	t->start = mt_wallclock();
+	for (i = 0; i < trace->num_ops && !t->failed; i++) {
+		index = trace->ops[i].index;
+		size = trace->ops[i].size;
+		switch (trace->ops[i].type) {
+
+			case ALLOC: /* mm_mt_malloc */
+				if ((p = mm_mt_malloc(size)) == NULL)
+					t->failed = 1;
+				t->blocks[index] = p;
+				break;
+
+			case REALLOC: /* mm_mt_realloc */
+				if ((p = mm_mt_realloc(t->blocks[index], size)) == NULL && size != 0)
+					t->failed = 1;
+				t->blocks[index] = p;
+				break;
+
+			case FREE: /* mm_mt_free */
+				mm_mt_free(index < 0 ? NULL : t->blocks[index]);
+				break;
+		}
+	}
+	t->end = mt_wallclock();
+	pthread_barrier_wait(&mt_barrier);
+	pthread_barrier_wait(&mt_barrier);
+	return NULL;
+}
+
+/*
+ * mt_wallclock - Wall-clock time in seconds; the cycle counter used by
+ *    fsecs only measures a single thread.
+ */
+static double mt_wallclock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * run_cold_tests - Time each of the first nops requests of every trace
+ *    on a heap whose pages have never been touched, three ways: as is
+ *    (cold), after mm_reserve of the heap those requests end up using
+ *    (reserve), and after mm_reserve with MM_RESERVE_PREFAULT
+ *    (prefault).  A request is timed together with the first write to
+ *    its payload, which is where a fresh heap page faults.
+ */
+static void run_cold_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles, int nops)
+{
+	static const char *setups[] = { "cold", "reserve", "prefault" };
+	static const int nsetups = sizeof(setups) / sizeof(setups[0]);
+	stats_t stats;
+	trace_t *trace;
+	lat_t lat, total[3];
+	size_t heapsize = 0;
+	int i, s, b;
+
+	memset(total, 0, sizeof(total));
+	if ((lat.ns = calloc(nops, sizeof(double))) == NULL)
+		unix_error("calloc failed in run_cold_tests");
+
+	printf("\nLatency of the first %d requests from a cold heap (ns):\n", nops);
+	printf("%9s%9s%9s%9s%10s%10s  %s\n",
+			"heap", "p50", "p99", "max", "total", "heap(KB)", "trace");
+
+	for (i = 0; i < num_tracefiles; i++) {
+		trace = read_trace(&stats, tracedir, tracefiles[i]);
+		lat.n = trace->num_ops < nops ? trace->num_ops : nops;
+		for (s = 0; s < nsetups; s++) {
+			mem_cold_reset();
+			if (mm_init() < 0)
+				app_error("mm_init failed in run_cold_tests\n");
+			/* Reserve what the cold replay of the same requests grew to */
+			if (s > 0 && mm_reserve(heapsize, s == 2 ? MM_RESERVE_PREFAULT : 0) < 0)
+				app_error("mm_reserve failed in run_cold_tests\n");
+
+			if (lat_replay(trace, &lat, 1) < 0)
+				app_error("out of memory in run_cold_tests\n");
+			if (s == 0)
+				heapsize = mem_heapsize();
+
+			for (b = 0; b < LAT_BUCKETS; b++)
+				total[s].hist[b] += lat.hist[b];
+			total[s].n += lat.n;
+			printf("%9s%9.0f%9.0f%9.0f%10.0f%10.1f  %s\n", setups[s],
+					lat_percentile(&lat, 50), lat_percentile(&lat, 99),
+					lat_percentile(&lat, 100), lat_percentile(&lat, -1),
+					mem_heapsize() / 1024.0, trace->filename);
+		}
+		free_trace(trace);
+	}
+
+	printf("\nHistogram over all traces (requests per latency bucket):\n");
+	printf("%12s", "ns");
+	for (s = 0; s < nsetups; s++)
+		printf("%10s", setups[s]);
+	printf("\n");
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		if (b == LAT_BUCKETS - 1)
+			printf("%4s%8ld", ">=", 1L << (LAT_MINLOG + b - 1));
+		else
+			printf("%4s%8ld", "<", 1L << (LAT_MINLOG + b));
+		for (s = 0; s < nsetups; s++)
+			printf("%10ld", total[s].hist[b]);
+		printf("\n");
+	}
+	free(lat.ns);
+}
+
+/*
+ * run_budget_tests - Replay every trace at each find_fit search budget,
+ *    timing every request, and report utilization next to the latency
+ *    percentiles over all requests of all traces at that budget
+ */
+static void run_budget_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles)
+{
+	stats_t stats;
+	trace_t **traces;
+	lat_t lat, all;
+	double util, secs;
+	int i, j, b, failed, total_ops = 0;
+
+	if ((traces = calloc(num_tracefiles, sizeof(trace_t *))) == NULL)
+		unix_error("calloc failed in run_budget_tests");
+	for (i = 0; i < num_tracefiles; i++) {
+		traces[i] = read_trace(&stats, tracedir, tracefiles[i]);
+		total_ops += traces[i]->num_ops;
+	}
+	memset(&all, 0, sizeof(all));
+	if ((all.ns = calloc(total_ops, sizeof(double))) == NULL)
+		unix_error("calloc failed in run_budget_tests");
+
+	printf("\nLatency (ns) and utilization by find_fit search budget:\n");
+	printf("%8s%6s%9s%9s%9s%9s%9s\n",
+			"budget", "util", "Kops", "p50", "p99", "p99.9", "max");
+
+	for (b = 0; b < nbudgets; b++) {
+		mm_set_search_budget(budgets[b]);
+		util = secs = 0;
+		all.n = 0;
+		failed = 0;
+		for (i = 0; i < num_tracefiles && !failed; i++) {
+			lat.ns = all.ns + all.n;
+			lat.n = traces[i]->num_ops;
+			mem_reset_brk();
+			if (mm_init() < 0)
+				app_error("mm_init failed in run_budget_tests\n");
+			if (lat_replay(traces[i], &lat, 0) < 0) {
+				failed = 1;
+				break;
+			}
+			if (verbose > 1)
+				printf("%8u%5.0f%%%9.0f%9.0f%9.0f%9.0f%9.0f  %s\n", budgets[b],
+						100 * lat.util,
+						lat.n / lat_percentile(&lat, -1) * 1e6,
+						lat_percentile(&lat, 50), lat_percentile(&lat, 99),
+						lat_percentile(&lat, 99.9), lat_percentile(&lat, 100),
+						traces[i]->filename);
+			for (j = 0; j < lat.n; j++)
+				secs += lat.ns[j] / 1e9;
+			util += lat.util;
+			all.n += lat.n;
+		}
+
+		if (failed) {
+			printf("%8u%6s%9s%9s%9s%9s%9s  (%s out of memory)\n", budgets[b],
+					"-", "-", "-", "-", "-", "-", traces[i]->filename);
+			continue;
+		}
+		printf("%8u%5.0f%%%9.0f%9.0f%9.0f%9.0f%9.0f\n", budgets[b],
+				100 * util / num_tracefiles, all.n / secs / 1e3,
+				lat_percentile(&all, 50), lat_percentile(&all, 99),
+				lat_percentile(&all, 99.9), lat_percentile(&all, 100));
+	}
+	mm_set_search_budget(0);
+
+	for (i = 0; i < num_tracefiles; i++)
+		free_trace(traces[i]);
+	free(traces);
+	free(all.ns);
+}
+
+/*
+ * parse_budgets - Read the comma separated -B list; 0 is no budget
+ */
+static void parse_budgets(const char *arg)
+{
+	char *copy, *tok;
+
+	nbudgets = 0;
+	if ((copy = strdup(arg)) == NULL)
+		unix_error("strdup failed in parse_budgets");
+	for (tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if (nbudgets == MAXBUDGETS)
+			app_error("-B takes at most %d budgets\n", MAXBUDGETS);
+		budgets[nbudgets++] = (unsigned)strtoul(tok, NULL, 0);
+	}
+	free(copy);
+}
+
+/*
+ * lat_replay - Replay the first lat->n requests of trace through the
+ *    mm package, timing each one (with the first touch of its payload
+ *    if touch is set), and set lat->util.  Return -1 if the heap ran
+ *    out of memory, 0 otherwise.
+ */
+static int lat_replay(trace_t *trace, lat_t *lat, int touch)
+{
+	int i, b, index;
+	size_t size, total = 0, peak = 0;
+	double start;
+	char *p;
+
+	reinit_trace(trace);
+	memset(lat->hist, 0, sizeof(lat->hist));
+	for (i = 0; i < lat->n; i++) {
+		index = trace->ops[i].index;
+		size = trace->ops[i].size;
+		start = mt_wallclock();
+		switch (trace->ops[i].type) {
+
+			case ALLOC: /* mm_malloc */
+				if ((p = mm_malloc(size)) == NULL)
+					return -1;
+				if (touch)
+					memset(p, 0, size);
+				trace->blocks[index] = p;
+				trace->block_sizes[index] = size;
+				total += size;
+				break;
+
+			case REALLOC: /* mm_realloc */
+				if ((p = mm_realloc(trace->blocks[index], size)) == NULL && size != 0)
+					return -1;
+				if (touch)
+					memset(p, 0, size);
+				total += size - trace->block_sizes[index];
+				trace->blocks[index] = p;
+				trace->block_sizes[index] = size;
+				break;
+
+			case FREE: /* mm_free */
+				if (index >= 0) {
+					mm_free(trace->blocks[index]);
+					total -= trace->block_sizes[index];
+				}
+				break;
+		}
+		lat->ns[i] = (mt_wallclock() - start) * 1e9;
+		for (b = 0; b < LAT_BUCKETS - 1 &&
+				lat->ns[i] >= (double)(1L << (LAT_MINLOG + b)); b++)
+			;
+		lat->hist[b]++;
+		peak = total > peak ? total : peak;
+	}
+	lat->util = mem_footprint() ? (double)peak / mem_footprint() : 0;
+	return 0;
+}
+
+/*
+ * lat_percentile - The pct-th percentile of the timed latencies;
+ *    100 is the maximum and a negative pct the sum of all of them.
+ *    Sorts lat->ns in place.
+ */
+static double lat_percentile(lat_t *lat, double pct)
 {
+	double sum = 0;
 	int i;
-	/* weighted sums all */
-	double sumsecs = 0;
-	double sumops  = 0;
-	double sumutil = 0;
-	int sumweight = 0;
 
-	/* Print the individual results for each trace */
-	printf("  %6s%6s %5s%8s%9s  %s\n",
-			"valid", "util", "ops", "secs", "Kops", "trace");
-	for (i=0; i < n; i++) {
-		if (stats[i].valid) {
+	if (lat->n == 0)
+		return 0;
+	if (pct < 0) {
+		for (i = 0; i < lat->n; i++)
+			sum += lat->ns[i];
+		return sum;
+	}
+	qsort(lat->ns, lat->n, sizeof(double), cmp_double);
+	i = (int)(pct / 100 * (lat->n - 1) + 0.5);
+	return lat->ns[i];
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * run_mix_tests - Replay all traces interleaved on a single heap, once
+ *    per quantum, checking the result like eval_mm_valid does and
+ *    reporting the utilization and throughput of the mix as a whole
+ */
+static void run_mix_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles)
+{
+	stats_t stats;
+	mix_t mix;
+	double secs, util;
+	int i, q, valid, ops = 0;
+
+	memset(&mix, 0, sizeof(mix));
+	mix.ntraces = num_tracefiles;
+	if ((mix.traces = calloc(num_tracefiles, sizeof(trace_t *))) == NULL ||
+			(mix.next = calloc(num_tracefiles, sizeof(int))) == NULL)
+		unix_error("calloc failed in run_mix_tests");
+	for (i = 0; i < num_tracefiles; i++) {
+		mix.traces[i] = read_trace(&stats, tracedir, tracefiles[i]);
+		ops += mix.traces[i]->num_ops;
+	}
+
+	printf("\nResults for mm malloc, %d traces interleaved on one heap:\n",
+			num_tracefiles);
+	printf("%8s%7s%6s%8s%10s%9s\n", "quantum", "valid", "util", "ops", "secs", "Kops");
+	for (q = 0; q < nquanta; q++) {
+		mix.quantum = quanta[q];
+		valid = mix_run(&mix, mix_valid_op);
+		clear_ranges(&mix.ranges);
+		if (!valid) {
+			printf("%8d%7s\n", mix.quantum, "no");
+			continue;
+		}
+		mix_run(&mix, mix_util_op);
+		util = (double)mix.peak / mem_footprint();
+		secs = fsecs(eval_mix_speed, &mix);
+		printf("%8d%7s%5.0f%%%8d%10.6f%9.0f\n", mix.quantum, "yes",
+				100.0 * util, ops, secs, ops / secs / 1e3);
+	}
+
+	for (i = 0; i < num_tracefiles; i++)
+		free_trace(mix.traces[i]);
+	free(mix.traces);
+	free(mix.next);
+}
+
+/*
+ * parse_quanta - Read the comma separated -I list
+ */
+static void parse_quanta(const char *arg)
+{
+	char *copy, *tok;
+
+	nquanta = 0;
+	if ((copy = strdup(arg)) == NULL)
+		unix_error("strdup failed in parse_quanta");
+	for (tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if (nquanta == MAXQUANTA)
+			app_error("-I takes at most %d quanta\n", MAXQUANTA);
+		if ((quanta[nquanta++] = atoi(tok)) < 0)
+			app_error("-I needs quanta of at least zero\n");
+	}
+	free(copy);
+}
+
+/*
+ * mix_run - Reset the heap and replay the traces of mix round robin,
+ *    mix->quantum requests of one trace per turn (all of it if zero),
+ *    calling op for each request.  Returns 0 as soon as op fails.
+ */
+static int mix_run(mix_t *mix, mix_op_t op)
+{
+	trace_t *trace;
+	int i, t, end, done;
+
+	mem_reset_brk();
+	if (mm_init() < 0)
+		app_error("mm_init failed in mix_run");
+	for (t = 0; t < mix->ntraces; t++) {
+		reinit_trace(mix->traces[t]);
+		mix->next[t] = 0;
+	}
+	mix->total = mix->peak = 0;
+
+	for (done = 0; !done; ) {
+		done = 1;
+		for (t = 0; t < mix->ntraces; t++) {
+			trace = mix->traces[t];
+			end = trace->num_ops;
+			if (mix->quantum > 0 && mix->next[t] + mix->quantum < end)
+				end = mix->next[t] + mix->quantum;
+			for (i = mix->next[t]; i < end; i++)
+				if (!op(mix, trace, i))
+					return 0;
+			mix->next[t] = end;
+			done &= end == trace->num_ops;
+		}
+	}
+	return 1;
+}
+
+/*
+ * mix_valid_op - One request of the correctness pass, checked the way
+ *    eval_mm_valid checks it; the range list is shared by all traces
+ */
+static int mix_valid_op(mix_t *mix, trace_t *trace, int opnum)
+{
+	int index = trace->ops[opnum].index;
+	size_t size = trace->ops[opnum].size;
+	char *p;
+
+	switch (trace->ops[opnum].type) {
+
+		case ALLOC: /* mm_malloc */
+			if ((p = mm_malloc(size)) == NULL) {
+				malloc_error(trace, opnum, "mm_malloc failed.");
+				return 0;
+			}
+			if (add_range(&mix->ranges, p, size, trace, opnum, index) == 0)
+				return 0;
+			trace->blocks[index] = p;
+			trace->block_sizes[index] = size;
+			randomize_block(trace, index);
+			break;
+
+		case REALLOC: /* mm_realloc */
+			check_index(trace, opnum, index);
+			p = mm_realloc(trace->blocks[index], size);
+			if (p == NULL && size != 0) {
+				malloc_error(trace, opnum, "mm_realloc failed.");
+				return 0;
+			}
+			remove_range(&mix->ranges, trace->blocks[index]);
+			if (size > 0 &&
+					add_range(&mix->ranges, p, size, trace, opnum, index) == 0)
+				return 0;
+			trace->blocks[index] = p;
+			if (size < trace->block_sizes[index])
+				trace->block_sizes[index] = size;
+			check_index(trace, opnum, index);
+			trace->block_sizes[index] = size;
+			randomize_block(trace, index);
+			break;
+
+		case FREE: /* mm_free */
+			check_index(trace, opnum, index);
+			if (index == -1) {
+				p = 0;
+			} else {
+				p = trace->blocks[index];
+				remove_range(&mix->ranges, p);
+			}
+			mm_free(p);
+			break;
+	}
+	return 1;
+}
+
+/*
+ * mix_util_op - One request of the utilization pass: track the live
+ *    payload of all traces together and its high-water mark
+ */
+static int mix_util_op(mix_t *mix, trace_t *trace, int opnum)
+{
+	int index = trace->ops[opnum].index;
+	size_t size = trace->ops[opnum].size;
+	char *p;
+
+	switch (trace->ops[opnum].type) {
+
+		case ALLOC: /* mm_malloc */
+			if ((p = mm_malloc(size)) == NULL)
+				app_error("mm_malloc failed in mix_util_op");
+			trace->blocks[index] = p;
+			trace->block_sizes[index] = size;
+			mix->total += size;
+			break;
+
+		case REALLOC: /* mm_realloc */
+			if ((p = mm_realloc(trace->blocks[index], size)) == NULL && size != 0)
+				app_error("mm_realloc failed in mix_util_op");
+			mix->total += size - trace->block_sizes[index];
+			trace->blocks[index] = p;
+			trace->block_sizes[index] = size;
+			break;
+
+		case FREE: /* mm_free */
+			if (index >= 0) {
+				mm_free(trace->blocks[index]);
+				mix->total -= trace->block_sizes[index];
+			}
+			break;
+	}
+	mix->peak = mix->total > mix->peak ? mix->total : mix->peak;
+	return 1;
+}
+
+/*
+ * mix_speed_op - One request of the timed pass
+ */
+static int mix_speed_op(mix_t *mix, trace_t *trace, int opnum)
+{
+	int index = trace->ops[opnum].index;
+	char *p;
+
+	switch (trace->ops[opnum].type) {
+
+		case ALLOC: /* mm_malloc */
+			if ((p = mm_malloc(trace->ops[opnum].size)) == NULL)
+				app_error("mm_malloc error in mix_speed_op");
+			trace->blocks[index] = p;
+			break;
+
+		case REALLOC: /* mm_realloc */
+			p = mm_realloc(trace->blocks[index], trace->ops[opnum].size);
+			if (p == NULL && trace->ops[opnum].size != 0)
+				app_error("mm_realloc error in mix_speed_op");
+			trace->blocks[index] = p;
+			break;
+
+		case FREE: /* mm_free */
+			mm_free(index < 0 ? NULL : trace->blocks[index]);
+			break;
+	}
+	return 1;
+}
+
+/*
+ * eval_mix_speed - The fcyc-timed interleaved replay
+ */
+static void eval_mix_speed(void *ptr)
+{
+	mix_run((mix_t *)ptr, mix_speed_op);
+}
+
+/*****************************************************************
+ * Checkpoints: -k replays the first K requests of a trace and saves
+ * everything the rest of the replay depends on, namely the heap
+ * bytes, mm's globals (mm_save) and the trace's block table, and -r
+ * restores that, over and over, to time only the requests after K.
+ * The heap is restored to the address it was saved from, which
+ * memlib maps it at in every run, so the pointers in all three stay
+ * valid.  Blocks mapped outside the heap are not saved: a checkpoint
+ * can only be taken while there are none.
+ ****************************************************************/
+
+/*
+ * save_checkpoint - Replay the first op requests of tracefile and save
+ *    the result in file
+ */
+static void save_checkpoint(const char *tracedir, const char *tracefile,
+		int op, const char *file)
+{
+	stats_t stats;
+	trace_t *trace;
+	ckpt_t ckpt;
+	long mm_size;
+	size_t mapped;
+	long maps, unmaps;
+	void *mm_state;
+	FILE *fp;
+
+	trace = read_trace(&stats, tracedir, tracefile);
+	if (op > trace->num_ops)
+		app_error("-k: %s has only %d requests\n", trace->filename,
+				trace->num_ops);
+	reinit_trace(trace);
+	mem_reset_brk();
+	if (mm_init() < 0)
+		app_error("mm_init failed in save_checkpoint\n");
+	if (range_replay(trace, 0, op) < 0)
+		app_error("out of memory in save_checkpoint\n");
+
+	mem_map_stats(&maps, &unmaps, &mapped);
+	if (mapped > 0 || (mm_size = mm_save(NULL, 0)) < 0)
+		app_error("mm cannot be saved after request %d of %s (mapped blocks, "
+				"or an mm without mm_save)\n", op, trace->filename);
+	if ((mm_state = malloc(mm_size)) == NULL)
+		unix_error("malloc failed in save_checkpoint");
+	mm_save(mm_state, mm_size);
+
+	memset(&ckpt, 0, sizeof(ckpt));
+	ckpt.magic = CKPT_MAGIC;
+	ckpt.version = CKPT_VERSION;
+	strcpy(ckpt.trace, trace->filename);
+	ckpt.op = op;
+	ckpt.num_ids = trace->num_ids;
+	ckpt.heap_lo = mem_heap_lo();
+	ckpt.heap_size = mem_heapsize();
+	ckpt.mm_size = mm_size;
+
+	if ((fp = fopen(file, "w")) == NULL)
+		unix_error("Could not open %s in save_checkpoint", file);
+	if (fwrite(&ckpt, sizeof(ckpt), 1, fp) != 1 ||
+			fwrite(mm_state, mm_size, 1, fp) != 1 ||
+			fwrite(mem_heap_lo(), ckpt.heap_size, 1, fp) != 1 ||
+			fwrite(trace->blocks, sizeof(char *), trace->num_ids, fp) !=
+				(size_t)trace->num_ids ||
+			fwrite(trace->block_sizes, sizeof(size_t), trace->num_ids, fp) !=
+				(size_t)trace->num_ids ||
+			fclose(fp) != 0)
+		unix_error("Could not write %s in save_checkpoint", file);
+	printf("Saved %s after request %d of %s: %.1f KB of heap\n", file, op,
+			trace->filename, ckpt.heap_size / 1024.0);
+	free(mm_state);
+	free_trace(trace);
+}
+
+/*
+ * run_restore_tests - Time the requests of a checkpointed trace from
+ *    the checkpoint to request end, net of the time the restore takes
+ */
+static void run_restore_tests(const char *file, int end)
+{
+	stats_t stats;
+	struct stat st;
+	restore_t r;
+	double secs, restore_secs;
+	int fd;
+
+	/* The file is mapped privately: every restore copies from the page cache */
+	if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+		unix_error("Could not open %s in run_restore_tests", file);
+	r.ckpt = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (r.ckpt == MAP_FAILED)
+		unix_error("Could not map %s in run_restore_tests", file);
+	close(fd);
+	if ((size_t)st.st_size < sizeof(ckpt_t) || r.ckpt->magic != CKPT_MAGIC ||
+			r.ckpt->version != CKPT_VERSION)
+		app_error("%s is not an mdriver checkpoint\n", file);
+
+	r.trace = read_trace(&stats, "", r.ckpt->trace);
+	if (r.trace->num_ids != r.ckpt->num_ids || (size_t)st.st_size !=
+			sizeof(ckpt_t) + r.ckpt->mm_size + r.ckpt->heap_size +
+			r.ckpt->num_ids * (sizeof(char *) + sizeof(size_t)))
+		app_error("%s does not match %s\n", file, r.ckpt->trace);
+	r.end = end > 0 && end < r.trace->num_ops ? end : r.trace->num_ops;
+	if (r.end < r.ckpt->op)
+		app_error("-r: request %d comes before the checkpoint at %d\n",
+				r.end, r.ckpt->op);
+
+	/* Check that the checkpoint restores, and that the replay runs */
+	restore_checkpoint(&r);
+	if (range_replay(r.trace, r.ckpt->op, r.end) < 0)
+		app_error("out of memory replaying from %s\n", file);
+
+	restore_secs = fsecs(eval_restore, &r);
+	secs = fsecs(eval_restore_speed, &r) - restore_secs;
+	if (secs <= 0)
+		secs = restore_secs / 1e6;
+	printf("\nRequests %d-%d of %s, from checkpoint %s:\n", r.ckpt->op + 1,
+			r.end, r.trace->filename, file);
+	printf("%10s%10s%12s%14s\n", "ops", "Kops", "secs", "restore secs");
+	printf("%10d%10.0f%12.6f%14.6f\n", r.end - r.ckpt->op,
+			(r.end - r.ckpt->op) / 1e3 / secs, secs, restore_secs);
+
+	free_trace(r.trace);
+	munmap((void *)r.ckpt, st.st_size);
+}
+
+/*
+ * restore_checkpoint - Put the heap, mm and the block table back as
+ *    they were when r->ckpt was saved
+ */
+static void restore_checkpoint(restore_t *r)
+{
+	const ckpt_t *ckpt = r->ckpt;
+	const char *mm_state = (const char *)(ckpt + 1);
+	const char *heap = mm_state + ckpt->mm_size;
+	const char *blocks = heap + ckpt->heap_size;
+	size_t ids = ckpt->num_ids;
+
+	mem_reset_brk();
+	if (mem_heap_lo() != ckpt->heap_lo)
+		app_error("The heap is at %p, not at %p where it was saved\n",
+				mem_heap_lo(), ckpt->heap_lo);
+	if (mem_sbrk(ckpt->heap_size) == (void *)-1)
+		app_error("mem_sbrk failed in restore_checkpoint\n");
+	memcpy(mem_heap_lo(), heap, ckpt->heap_size);
+	if (mm_restore(mm_state, ckpt->mm_size) < 0)
+		app_error("mm_restore failed in restore_checkpoint\n");
+	memcpy(r->trace->blocks, blocks, ids * sizeof(char *));
+	memcpy(r->trace->block_sizes, blocks + ids * sizeof(char *),
+			ids * sizeof(size_t));
+}
+
+/*
+ * eval_restore, eval_restore_speed - The fcyc-timed restore, alone and
+ *    followed by the replay
+ */
+static void eval_restore(void *ptr)
+{
+	restore_checkpoint((restore_t *)ptr);
+}
+
+static void eval_restore_speed(void *ptr)
+{
+	restore_t *r = ptr;
+
+	restore_checkpoint(r);
+	if (range_replay(r->trace, r->ckpt->op, r->end) < 0)
+		app_error("out of memory in eval_restore_speed\n");
+}
+
+/*
+ * range_replay - Replay requests lo to hi - 1 of trace; return -1 if
+ *    the heap runs out
+ */
+static int range_replay(trace_t *trace, int lo, int hi)
+{
+	int i, index;
+	size_t size;
+	char *p;
+
+	for (i = lo; i < hi; i++) {
+		index = trace->ops[i].index;
+		size = trace->ops[i].size;
+		switch (trace->ops[i].type) {
+
+			case ALLOC: /* mm_malloc */
+				if ((p = mm_malloc(size)) == NULL)
+					return -1;
+				trace->blocks[index] = p;
+				trace->block_sizes[index] = size;
+				break;
+
+			case REALLOC: /* mm_realloc */
+				if ((p = mm_realloc(trace->blocks[index], size)) == NULL && size != 0)
+					return -1;
+				trace->blocks[index] = p;
+				trace->block_sizes[index] = size;
+				break;
+
+			case FREE: /* mm_free */
+				if (index >= 0)
+					mm_free(trace->blocks[index]);
+				break;
+		}
+	}
+	return 0;
+}
+
+/*****************************************************************
+ * Cache simulation (-M): with the driver and mm built with
+ * -DCACHESIM, replay each trace from an empty cache and TLB, once
+ * counting only the accesses of mm (its metadata and the data it
+ * copies) and once with the client writing every payload it gets, and
+ * report the simulated misses per request.  The counts are the same
+ * on every run and every machine.
+ ****************************************************************/
+
+/*
+ * run_sim_tests - Print the simulated misses of every trace
+ */
+static void run_sim_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles)
+{
+	stats_t stats;
+	trace_t *trace;
+	mm_sim_stats_t meta, all, total[2];
+	double ops = 0;
+	int i;
+
+	memset(total, 0, sizeof(total));
+	printf("\nSimulated misses per request, %dKB %d-way L1 and %d-entry TLB:\n",
+			(SIM_SETS * SIM_WAYS << SIM_LINE_SHIFT) / 1024, SIM_WAYS, SIM_TLB);
+	printf("%28s%30s\n", "metadata only", "with payload touches");
+	printf("%10s%10s%10s%10s%10s%10s  %s\n", "lines", "L1 miss", "TLB miss",
+			"lines", "L1 miss", "TLB miss", "trace");
+	for (i = 0; i < num_tracefiles; i++) {
+		trace = read_trace(&stats, tracedir, tracefiles[i]);
+		if (sim_replay(trace, 0, &meta) < 0 || sim_replay(trace, 1, &all) < 0) {
+			printf("%60s  %s\n", "out of memory", trace->filename);
+			free_trace(trace);
+			continue;
+		}
+		printf("%10.2f%10.3f%10.3f%10.2f%10.3f%10.3f  %s\n",
+				(double)meta.refs / trace->num_ops,
+				(double)meta.misses / trace->num_ops,
+				(double)meta.tlb_misses / trace->num_ops,
+				(double)all.refs / trace->num_ops,
+				(double)all.misses / trace->num_ops,
+				(double)all.tlb_misses / trace->num_ops, trace->filename);
+		total[0].refs += meta.refs;
+		total[0].misses += meta.misses;
+		total[0].tlb_misses += meta.tlb_misses;
+		total[1].refs += all.refs;
+		total[1].misses += all.misses;
+		total[1].tlb_misses += all.tlb_misses;
+		ops += trace->num_ops;
+		free_trace(trace);
+	}
+	if (ops > 0)
+		printf("%10.2f%10.3f%10.3f%10.2f%10.3f%10.3f  %s\n",
+				total[0].refs / ops, total[0].misses / ops,
+				total[0].tlb_misses / ops, total[1].refs / ops,
+				total[1].misses / ops, total[1].tlb_misses / ops, "all");
+}
+
+/*
+ * sim_replay - Replay trace on a fresh heap and cache, touching every
+ *    payload allocated if touch is set, and return the counts in sim;
+ *    -1 if the heap ran out
+ */
+static int sim_replay(trace_t *trace, int touch, mm_sim_stats_t *sim)
+{
+	int i, index;
+	size_t size;
+	char *p = NULL;
+
+	reinit_trace(trace);
+	mem_reset_brk();
+	if (mm_init() < 0)
+		app_error("mm_init failed in sim_replay\n");
+	mm_sim_reset();
+	for (i = 0; i < trace->num_ops; i++) {
+		index = trace->ops[i].index;
+		size = trace->ops[i].size;
+		switch (trace->ops[i].type) {
+
+			case ALLOC: /* mm_malloc */
+				if ((p = mm_malloc(size)) == NULL)
+					return -1;
+				trace->blocks[index] = p;
+				trace->block_sizes[index] = size;
+				break;
+
+			case REALLOC: /* mm_realloc */
+				if ((p = mm_realloc(trace->blocks[index], size)) == NULL && size != 0)
+					return -1;
+				trace->blocks[index] = p;
+				trace->block_sizes[index] = size;
+				break;
+
+			case FREE: /* mm_free */
+				if (index >= 0)
+					mm_free(trace->blocks[index]);
+				continue;
+		}
+		if (touch && size > 0)
+			mm_sim_touch(p, size);
+	}
+	mm_sim_stats(sim);
+	return 0;
+}
+
+/*****************************************************************
+ * Timeline (-L): replay each trace once, stopping every n requests
+ * to record the live payload, the heap and mapping sizes, the free
+ * blocks as mm_census reports them and the cycles spent in mm since
+ * the last row, then split the rows into phases.  The rows are CSV
+ * on stdout; the phases follow as comment lines starting with '#'.
+ ****************************************************************/
+
+/*
+ * run_timeline_tests - Print the timeline of every trace
+ */
+static void run_timeline_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles)
+{
+	static const char *kinds[] = { "shrink", "steady", "grow" };
+	stats_t stats;
+	trace_t *trace;
+	row_t *rows;
+	double cycles;
+	size_t foot;
+	int i, r, nrows, nphases, first, net, ops;
+
+	printf("trace,op,live,heap,mapped,free_blocks,largest_free,cycles,phase\n");
+	for (i = 0; i < num_tracefiles; i++) {
+		trace = read_trace(&stats, tracedir, tracefiles[i]);
+		nrows = (trace->num_ops + timeline_every - 1) / timeline_every;
+		if ((rows = calloc(nrows, sizeof(row_t))) == NULL)
+			unix_error("calloc failed in run_timeline_tests");
+
+		mem_reset_brk();
+		if (mm_init() < 0)
+			app_error("mm_init failed in run_timeline_tests\n");
+		if (timeline_replay(trace, rows) < 0) {
+			printf("# %s: out of memory\n", trace->filename);
+			free(rows);
+			free_trace(trace);
+			continue;
+		}
+		nphases = timeline_phases(rows, nrows);
+
+		for (r = 0, cycles = 0; r < nrows; r++) {
+			cycles += rows[r].cycles;
+			printf("%s,%d,%lu,%lu,%lu,%ld,%ld,%.0f,%d\n", trace->filename,
+					rows[r].op, (unsigned long)rows[r].live,
+					(unsigned long)rows[r].heap, (unsigned long)rows[r].mapped,
+					rows[r].free_blocks, rows[r].largest_free, cycles,
+					rows[r].phase);
+		}
+
+		printf("# %s: %d phase%s\n", trace->filename, nphases,
+				nphases > 1 ? "s" : "");
+		for (first = 0; first < nrows; first = r) {
+			cycles = net = 0;
+			for (r = first; r < nrows && rows[r].phase == rows[first].phase; r++) {
+				cycles += rows[r].cycles;
+				net += rows[r].net;
+			}
+			ops = rows[r - 1].op - (first ? rows[first - 1].op : 0);
+			foot = rows[r - 1].heap + rows[r - 1].mapped;
+			printf("#   phase %d: requests %d-%d, %s, %.0f cycles/op, "
+					"%.0f%% of the footprint free at the end\n",
+					rows[first].phase, rows[r - 1].op - ops + 1, rows[r - 1].op,
+					kinds[timeline_kind(net, ops) + 1], cycles / ops,
+					foot > rows[r - 1].live ?
+					100.0 * (foot - rows[r - 1].live) / foot : 0);
+		}
+		free(rows);
+		free_trace(trace);
+	}
+}
+
+/*
+ * timeline_replay - Replay trace, filling in a row every timeline_every
+ *    requests and after the last; returns -1 if the heap ran out.  Only
+ *    the mm calls of a window are timed, not the census.
+ */
+static int timeline_replay(trace_t *trace, row_t *rows)
+{
+	mm_census_t census;
+	size_t size, live = 0;
+	int i, index, net = 0;
+	double cycles = 0;
+	row_t *row = rows;
+	char *p;
+
+	reinit_trace(trace);
+	for (i = 0; i < trace->num_ops; i++) {
+		index = trace->ops[i].index;
+		size = trace->ops[i].size;
+		start_counter();
+		switch (trace->ops[i].type) {
+
+			case ALLOC: /* mm_malloc */
+				if ((p = mm_malloc(size)) == NULL)
+					return -1;
+				cycles += get_counter();
+				trace->blocks[index] = p;
+				trace->block_sizes[index] = size;
+				live += size;
+				net++;
+				break;
+
+			case REALLOC: /* mm_realloc */
+				if ((p = mm_realloc(trace->blocks[index], size)) == NULL && size != 0)
+					return -1;
+				cycles += get_counter();
+				live += size - trace->block_sizes[index];
+				trace->blocks[index] = p;
+				trace->block_sizes[index] = size;
+				break;
+
+			case FREE: /* mm_free */
+				if (index >= 0) {
+					mm_free(trace->blocks[index]);
+					live -= trace->block_sizes[index];
+				}
+				cycles += get_counter();
+				net--;
+				break;
+		}
+
+		if ((i + 1) % timeline_every == 0 || i + 1 == trace->num_ops) {
+			row->op = i + 1;
+			row->live = live;
+			row->heap = mem_heapsize();
+			row->mapped = mem_footprint() - row->heap;
+			if (mm_census(&census) == 0) {
+				row->free_blocks = census.free_blocks;
+				row->largest_free = census.largest_free;
+			} else
+				row->free_blocks = row->largest_free = -1;
+			row->cycles = cycles;
+			row->net = net;
+			row++;
+			cycles = net = 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * timeline_phases - Number the phases of a timeline and return how many
+ *    there are.  A row is either growing the heap's live payload,
+ *    shrinking it or steady, by the share of its requests that are
+ *    allocations net of frees.  A new phase starts at a row when it and
+ *    the PHASE_RUN - 1 rows after it (or all the rows left) differ from
+ *    the phase so far: in kind, or by a factor of PHASE_COST in cycles
+ *    per request.  Requiring a run of rows keeps a single slow row (an
+ *    interrupt, a heap extension) from starting a phase of its own.
+ */
+static int timeline_phases(row_t *rows, int nrows)
+{
+	int r, k, ops, differs, phase = 0, phase_kind = 0, phase_ops = 0;
+	double cost, phase_cost, phase_cycles = 0;
+
+	for (r = 0; r < nrows; r++) {
+		differs = 1;
+		for (k = r; r > 0 && differs && k < nrows && k < r + PHASE_RUN; k++) {
+			ops = rows[k].op - rows[k - 1].op;
+			cost = rows[k].cycles / ops;
+			phase_cost = phase_cycles / phase_ops;
+			differs = timeline_kind(rows[k].net, ops) != phase_kind ||
+				cost > PHASE_COST * phase_cost || cost * PHASE_COST < phase_cost;
+		}
+
+		ops = rows[r].op - (r ? rows[r - 1].op : 0);
+		if (differs) {
+			phase++;
+			phase_kind = timeline_kind(rows[r].net, ops);
+			phase_cycles = phase_ops = 0;
+		}
+		phase_cycles += rows[r].cycles;
+		phase_ops += ops;
+		rows[r].phase = phase;
+	}
+	return phase;
+}
+
+/*
+ * timeline_kind - Whether ops requests, of which net more allocated
+ *    than freed, grow the live payload (1), shrink it (-1) or neither
+ */
+static int timeline_kind(int net, int ops)
+{
+	return (net > PHASE_MIX * ops) - (net < -PHASE_MIX * ops);
+}
+
+/*****************************************************************
+ * Baselines: -b saves each trace's utilization, heap size and
+ * BASE_SAMPLES replay times in a text file, and -C compares a run
+ * against such a file.  A sample is timed as in run_tests, by
+ * time_replay: wall-clock secs per replay, over enough replays to
+ * last BASE_MINSECS, with the heap reset and mm_init before each
+ * left out.  The K-best minimum that run_tests reports throws away
+ * the spread that tells a real slowdown from noise, so the comparison
+ * looks at all the samples instead: a trace has regressed if a
+ * Mann-Whitney rank test says its replays are slower at level
+ * BASE_ALPHA and the median slowed by more than BASE_SHIFT.
+ * Utilization is deterministic and is compared exactly.
+ *
+ * Two runs on one machine can differ by tens of percent for reasons
+ * that have nothing to do with mm (clock frequency, other tenants),
+ * which samples taken within one run cannot show.  So the run also
+ * times the null allocator replaying every trace, and before testing,
+ * the samples of this run are scaled by the ratio of the total null
+ * replay times of the two runs.
+ *
+ * File format: a header line
+ *     # mdriver-baseline <variant> <alignment> <samples>
+ * then one line per trace
+ *     <trace> <valid> <util> <ops> <heap> <null> <n> <secs 1> ... <secs n>
+ ****************************************************************/
+
+/*
+ * sample_tests - Time BASE_SAMPLES samples of the replay of each valid
+ *    trace, and as many of the null replay, with time_replay.  A single
+ *    replay of the short traces takes microseconds, well within the
+ *    jitter of the clock, so a sample repeats it until the timed
+ *    replays add up to BASE_MINSECS and records the mean.  The traces
+ *    are sampled round robin, so that the samples of every trace
+ *    spread over the whole run.
+ */
+static void sample_tests(int num_tracefiles, const char *tracedir,
+		char **tracefiles, stats_t *mm_stats)
+{
+	stats_t stats;
+	trace_t *trace;
+	speed_t *params;
+	double *null_samples;
+	int i, j, *reps;
+
+	params = calloc(num_tracefiles, sizeof(speed_t));
+	reps = calloc(num_tracefiles, sizeof(int));
+	null_samples = calloc(num_tracefiles * BASE_SAMPLES, sizeof(double));
+	if (params == NULL || reps == NULL || null_samples == NULL)
+		unix_error("calloc failed in sample_tests");
+
+	for (i = 0; i < num_tracefiles; i++) {
+		if (!mm_stats[i].valid)
+			continue;
+		trace = read_trace(&stats, tracedir, tracefiles[i]);
+		params[i].trace = trace;
+		params[i].dops = decode_trace(trace);
+		for (reps[i] = 1;
+				time_replay(&params[i], 0, reps[i]) * reps[i] < BASE_MINSECS;
+				reps[i] *= 2)
+			;
+	}
+
+	for (j = 0; j < BASE_SAMPLES; j++)
+		for (i = 0; i < num_tracefiles; i++) {
+			if (params[i].trace == NULL)
+				continue;
+			mm_stats[i].samples[j] = time_replay(&params[i], 0, reps[i]);
+			mm_stats[i].nsamples = j + 1;
+			null_samples[i * BASE_SAMPLES + j] = time_replay(&params[i], 1, reps[i]);
+		}
+
+	for (i = 0; i < num_tracefiles; i++)
+		if (params[i].trace != NULL) {
+			mm_stats[i].null_secs = median(&null_samples[i * BASE_SAMPLES],
+					BASE_SAMPLES);
+			free(params[i].dops);
+			free_trace(params[i].trace);
+		}
+	free(params);
+	free(reps);
+	free(null_samples);
+}
+
+/*
+ * save_baseline - Write the results of this run to file
+ */
+static void save_baseline(const char *file, const char *variant,
+		int n, stats_t *stats)
+{
+	FILE *fp;
+	int i, j;
+
+	if ((fp = fopen(file, "w")) == NULL)
+		unix_error("Could not open %s in save_baseline", file);
+	fprintf(fp, "# mdriver-baseline %s %d %d\n", variant, ALIGNMENT, BASE_SAMPLES);
+	for (i = 0; i < n; i++) {
+		fprintf(fp, "%s %d %.6f %.0f %.0f %.9f %d", stats[i].filename,
+				stats[i].valid, stats[i].util, stats[i].ops,
+				stats[i].heap, stats[i].null_secs, stats[i].nsamples);
+		for (j = 0; j < stats[i].nsamples; j++)
+			fprintf(fp, " %.9f", stats[i].samples[j]);
+		fprintf(fp, "\n");
+	}
+	if (fclose(fp) != 0)
+		unix_error("Could not write %s in save_baseline", file);
+	printf("Saved baseline %s\n", file);
+}
+
+/*
+ * compare_baseline - Compare this run with the baseline in file, trace
+ *    by trace; return the number of traces that regressed
+ */
+static int compare_baseline(const char *file, const char *variant,
+		int n, stats_t *stats)
+{
+	FILE *fp;
+	char name[MAXLINE], base_variant[MAXLINE];
+	stats_t entry, *base;
+	int i, j, align, nbase, regressed = 0;
+	double p, shift, now_med, base_med, null_now = 0, null_base = 0, scale;
+	double scaled[BASE_SAMPLES];
+	const char *verdict;
+
+	if ((base = calloc(n, sizeof(stats_t))) == NULL)
+		unix_error("calloc failed in compare_baseline");
+	for (i = 0; i < n; i++)
+		base[i].valid = -1;  /* not in the baseline */
+
+	if ((fp = fopen(file, "r")) == NULL)
+		unix_error("Could not open %s in compare_baseline", file);
+	if (fscanf(fp, "# mdriver-baseline %1023s %d %d", base_variant,
+				&align, &nbase) != 3)
+		app_error("%s is not an mdriver baseline\n", file);
+	while (fscanf(fp, "%1023s %d %lf %lf %lf %lf %d", name, &entry.valid,
+				&entry.util, &entry.ops, &entry.heap, &entry.null_secs,
+				&entry.nsamples) == 7) {
+		if (entry.nsamples < 0 || entry.nsamples > BASE_SAMPLES)
+			app_error("%s: bad sample count for %s\n", file, name);
+		for (j = 0; j < entry.nsamples; j++)
+			if (fscanf(fp, "%lf", &entry.samples[j]) != 1)
+				app_error("%s: short sample list for %s\n", file, name);
+		for (i = 0; i < n; i++)
+			if (strcmp(stats[i].filename, name) == 0)
+				base[i] = entry;
+	}
+	fclose(fp);
+
+	/* How much faster the machine ran the null replays this time */
+	for (i = 0; i < n; i++)
+		if (stats[i].nsamples > 0 && base[i].valid > 0 && base[i].nsamples > 0) {
+			null_now += stats[i].null_secs;
+			null_base += base[i].null_secs;
+		}
+	scale = null_now > 0 && null_base > 0 ? null_base / null_now : 1;
+
+	printf("\nCompared with baseline %s (%s, %d-byte alignment) in %s,\n",
+			file, base_variant, align, variant);
+	printf("times scaled by %.3f for the speed of the machine:\n", scale);
+	printf("%7s%7s%9s%9s%8s%9s  %-8s %s\n", "util", "base", "Kops",
+			"base", "shift", "p", "verdict", "trace");
+	for (i = 0; i < n; i++) {
+		if (base[i].valid < 0)
+			continue;
+		if (!stats[i].valid) {
+			printf("%7s%7s%9s%9s%8s%9s  %-8s %s\n", "-", "-", "-", "-",
+					"-", "-", base[i].valid ? "INVALID" : "invalid",
+					stats[i].filename);
+			regressed += base[i].valid;
+			continue;
+		}
+		if (!base[i].valid || base[i].nsamples == 0 || stats[i].nsamples == 0) {
+			printf("%6.1f%%%7s%9s%9s%8s%9s  %-8s %s\n", stats[i].util * 100,
+					"-", "-", "-", "-", "-", "new", stats[i].filename);
+			continue;
+		}
+
+		for (j = 0; j < stats[i].nsamples; j++)
+			scaled[j] = stats[i].samples[j] * scale;
+		now_med = median(scaled, stats[i].nsamples);
+		base_med = median(base[i].samples, base[i].nsamples);
+		shift = now_med / base_med - 1;
+		p = mann_whitney(scaled, stats[i].nsamples,
+				base[i].samples, base[i].nsamples);
+		if (stats[i].util < base[i].util - BASE_UTIL)
+			verdict = "UTIL";
+		else if (p < BASE_ALPHA && shift > BASE_SHIFT)
+			verdict = "SLOWER";
+		else if (p < BASE_ALPHA && shift < -BASE_SHIFT)
+			verdict = "faster";
+		else
+			verdict = "same";
+		if (verdict[0] == 'U' || verdict[0] == 'S')
+			regressed++;
+		printf("%6.1f%%%6.1f%%%9.0f%9.0f%+7.1f%%%9.4f  %-8s %s\n",
+				stats[i].util * 100, base[i].util * 100,
+				stats[i].ops / 1e3 / now_med, base[i].ops / 1e3 / base_med,
+				shift * 100, p, verdict, stats[i].filename);
+	}
+	free(base);
+
+	if (regressed > 0)
+		printf("%d trace%s regressed\n", regressed, regressed > 1 ? "s" : "");
+	else
+		printf("No regressions\n");
+	return regressed;
+}
+
+/*
+ * mann_whitney - Two-sided p-value of the Mann-Whitney U test that
+ *    samples x and y come from the same distribution, from the normal
+ *    approximation with tie and continuity corrections (fine from
+ *    about eight samples a side)
+ */
+static double mann_whitney(const double *x, int nx, const double *y, int ny)
+{
+	struct { double v; int in_x; } all[2 * BASE_SAMPLES], t;
+	int n = nx + ny, i, j, k;
+	double rank_x = 0, ties = 0, u, mean, sd;
+
+	for (i = 0; i < nx; i++)
+		all[i].v = x[i], all[i].in_x = 1;
+	for (i = 0; i < ny; i++)
+		all[nx + i].v = y[i], all[nx + i].in_x = 0;
+	for (i = 1; i < n; i++)  /* insertion sort, n is small */
+		for (j = i; j > 0 && all[j - 1].v > all[j].v; j--)
+			t = all[j], all[j] = all[j - 1], all[j - 1] = t;
+
+	/* Equal values share the mean of their ranks */
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && all[j].v == all[i].v; j++)
+			;
+		for (k = i; k < j; k++)
+			if (all[k].in_x)
+				rank_x += (i + j + 1) / 2.0;
+		ties += (double)(j - i) * (j - i) * (j - i) - (j - i);
+	}
+
+	u = rank_x - nx * (nx + 1) / 2.0;
+	mean = nx * ny / 2.0;
+	sd = sqrt(nx * ny / 12.0 * ((n + 1) - ties / ((double)n * (n - 1))));
+	if (sd == 0)
+		return 1;
+	return erfc(fmax(fabs(u - mean) - 0.5, 0) / sd / sqrt(2));
+}
+
+static double median(const double *x, int n)
+{
+	double sorted[BASE_SAMPLES];
+
+	memcpy(sorted, x, n * sizeof(double));
+	qsort(sorted, n, sizeof(double), cmp_double);
+	return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
+
+
+/*
+ * printresults - prints a performance summary for some malloc package
+ */
+static void printresults(int n, stats_t *stats)
+{
+	int i;
+	/* weighted sums all */
+	double sumsecs = 0;
+	double sumops  = 0;
+	double sumutil = 0;
+	int sumweight = 0;
+
+	/* Print the individual results for each trace */
+	printf("  %6s%6s %5s%8s%9s  %s\n",
+			"valid", "util", "ops", "secs", "Kops", "trace");
+	for (i=0; i < n; i++) {
+		if (stats[i].valid && stats[i].unresolved) {
+			printf("%2s%4s %5.0f%%%8.0f%10s%6s %s\n",
+					stats[i].weight != 0 ? "*" : "",
+					"yes",
+					stats[i].util*100.0,
+					stats[i].ops,
+					"-",
+					"-",
+					stats[i].filename);
+			sumweight += stats[i].weight;
+			sumutil += stats[i].util * stats[i].weight;
+		}
+		else if (stats[i].valid) {
 			printf("%2s%4s %5.0f%%%8.0f%10.6f%6.0f %s\n",
 					stats[i].weight != 0 ? "*" : "",
 					"yes",
@@ -1310,7 +3237,9 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
  */
 static void usage(void)
 {
-	fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+	fprintf(stderr, "Usage: mdriver [-hlVdDMS] [-f <file>] [-T <list>] [-R <n>] [-B <list>]\n");
+	fprintf(stderr, "               [-I <list>] [-L <n>] [-b <file>] [-C <file>]\n");
+	fprintf(stderr, "               [-k <K>:<file>] [-r <file>[:<M>]]\n");
 	fprintf(stderr, "Options\n");
 	fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
 	fprintf(stderr, "\t-D         Equivalent to -d2.\n");
@@ -1321,5 +3250,25 @@ static void usage(void)
 	fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
 	fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
 	fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
+	fprintf(stderr, "\t-T <list>  Replay traces in n threads through mm_mt, per cache mode,\n");
+	fprintf(stderr, "\t           for each n in <list> (e.g. 1,2,4 or \"cores\").\n");
+	fprintf(stderr, "\t-R <n>     Latency of the first <n> requests of each trace from a\n");
+	fprintf(stderr, "\t           cold heap, with and without mm_reserve.\n");
+	fprintf(stderr, "\t-B <list>  Latency percentiles and utilization for each find_fit\n");
+	fprintf(stderr, "\t           search budget in <list> (e.g. 0,4,16,64; 0 is unbounded).\n");
+	fprintf(stderr, "\t-I <list>  Replay all traces round robin on one heap, <q> requests\n");
+	fprintf(stderr, "\t           per turn, for each <q> in <list> (0 runs them back to back).\n");
+	fprintf(stderr, "\t-S         Publish live statistics in shared memory (see mmtop).\n");
+	fprintf(stderr, "\t-k <K>:<file>  Replay the first <K> requests of the trace of -f and save\n");
+	fprintf(stderr, "\t           the heap, mm and the block table in checkpoint <file>.\n");
+	fprintf(stderr, "\t-r <file>[:<M>]  Restore checkpoint <file> and time the requests after it,\n");
+	fprintf(stderr, "\t           up to request <M> (default the last).\n");
+	fprintf(stderr, "\t-M         Count simulated cache and TLB misses per request, with\n");
+	fprintf(stderr, "\t           and without payload touches (mdriver-sim and the like).\n");
+	fprintf(stderr, "\t-L <n>     Print a CSV timeline of each trace, a row every <n> requests,\n");
+	fprintf(stderr, "\t           and the phases found in it.\n");
+	fprintf(stderr, "\t-b <file>  Save the results, with %d timed samples per trace, as a baseline.\n", BASE_SAMPLES);
+	fprintf(stderr, "\t-C <file>  Compare the results against baseline <file>; exit status 2\n");
+	fprintf(stderr, "\t           if any trace has significantly regressed.\n");
 	fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
 }
@@ -14,17 +14,61 @@
 #include "memlib.h"
 #include "config.h"
 
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23       /* Linux 5.14 */
+#endif
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000 /* Linux 4.17 */
+#endif
+
+/* Where the heap is mapped if that is free, so that every run puts it
+   at the same address and a heap saved by one run (mdriver -k) holds
+   valid pointers in the next */
+#define HEAP_ADDR ((void *)0x200000000000UL)
+
+/* A mapping made by mem_map, outside the heap */
+typedef struct region {
+    char *lo;
+    size_t len;
+    struct region *next;
+} region_t;
+
 /* private variables */
-static char heap[MAX_HEAP];
-static char *mem_brk = heap; /* points to last byte of heap */
-static char *mem_max_addr = heap + MAX_HEAP;  /* largest legal heap address */ 
+static char *heap;           /* MAX_HEAP bytes of demand-paged memory */
+static char *mem_brk;        /* points to last byte of heap */
+static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t heap_limit = MAX_HEAP; /* bytes mem_sbrk may grow the heap to */
+static region_t *regions;    /* live mappings */
+static size_t mapped;        /* bytes in live mappings */
+static size_t footprint_hwm; /* most heap plus mapped bytes at any time */
+static long nmaps, nunmaps;  /* mem_map and mem_unmap calls */
+
+static void update_footprint(void);
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model.  The heap is mapped
+ *    rather than static so that its pages can be handed back to the
+ *    kernel (mem_cold_reset) and faulted in again, as a real process
+ *    heap is at startup, and at HEAP_ADDR unless something is there.
  */
 void mem_init(void)
 {
+  if (heap == NULL) {
+    heap = mmap(HEAP_ADDR, MAX_HEAP, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE,
+                -1, 0);
+    if (heap == MAP_FAILED)
+      heap = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (heap == MAP_FAILED) {
+      fprintf(stderr, "ERROR: mem_init failed to map the heap: %s\n",
+              strerror(errno));
+      exit(1);
+    }
+  }
+  mem_max_addr = heap + heap_limit;
   mem_brk = heap;                  /* heap is empty initially */
+  mem_unmap_all();
 }
 
 /* 
@@ -32,7 +76,10 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-  /*    free(mem_start_brk); */
+  mem_unmap_all();
+  if (heap != NULL)
+    munmap(heap, MAX_HEAP);
+  heap = mem_brk = mem_max_addr = NULL;
 }
 
 /*
@@ -41,6 +88,38 @@ void mem_deinit(void)
 void mem_reset_brk()
 {
     mem_brk = heap;
+    mem_unmap_all();
+}
+
+/*
+ * mem_cold_reset - make an empty heap whose pages all fault on first
+ *    touch again, like the heap of a freshly started process
+ */
+void mem_cold_reset(void)
+{
+    madvise(heap, MAX_HEAP, MADV_DONTNEED);
+    mem_brk = heap;
+    mem_unmap_all();
+}
+
+/*
+ * mem_prefault - fault in the pages of [lo, lo+len) now, so that the
+ *    first writes to them do not take a page fault.  Uses
+ *    MADV_POPULATE_WRITE where the kernel has it and writes one byte
+ *    per page otherwise; the contents are unchanged either way.
+ */
+void mem_prefault(void *lo, size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    char *p = (char *)((unsigned long)lo & ~(pagesize - 1));
+    char *hi = (char *)lo + len;
+
+    if (len == 0)
+	return;
+    if (madvise(p, hi - p, MADV_POPULATE_WRITE) == 0)
+	return;
+    for (; p < hi; p += pagesize)
+	*(volatile char *)p = *(volatile char *)p;
 }
 
 /* 
@@ -58,9 +137,114 @@ void *mem_sbrk(int incr)
 	return (void *)-1;
     }
     mem_brk += incr;
+    update_footprint();
     return (void *)old_brk;
 }
 
+/*
+ * mem_map - model of mmap for allocations kept out of the heap: map
+ *    len bytes (a multiple of the page size) of fresh zeroed memory.
+ *    Returns NULL on failure.
+ */
+void *mem_map(size_t len)
+{
+    region_t *r;
+    char *lo;
+
+    lo = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lo == MAP_FAILED)
+	return NULL;
+    if ((r = malloc(sizeof(region_t))) == NULL) {
+	munmap(lo, len);
+	return NULL;
+    }
+    r->lo = lo;
+    r->len = len;
+    r->next = regions;
+    regions = r;
+    mapped += len;
+    nmaps++;
+    update_footprint();
+    return lo;
+}
+
+/*
+ * mem_unmap - release the mapping at lo made by mem_map
+ */
+void mem_unmap(void *lo)
+{
+    region_t *r, **prevp;
+
+    for (prevp = &regions; (r = *prevp) != NULL; prevp = &r->next)
+	if (r->lo == lo) {
+	    *prevp = r->next;
+	    munmap(r->lo, r->len);
+	    mapped -= r->len;
+	    nunmaps++;
+	    free(r);
+	    return;
+	}
+    fprintf(stderr, "ERROR: mem_unmap of %p, which is not mapped\n", lo);
+}
+
+/*
+ * mem_unmap_all - release every mapping and restart the footprint
+ *    high-water mark and the call counts
+ */
+void mem_unmap_all(void)
+{
+    region_t *r;
+
+    while ((r = regions) != NULL) {
+	regions = r->next;
+	munmap(r->lo, r->len);
+	free(r);
+    }
+    mapped = 0;
+    nmaps = nunmaps = 0;
+    footprint_hwm = mem_heapsize();
+}
+
+/*
+ * mem_is_mapped - true if [lo, hi] lies within one mapping
+ */
+int mem_is_mapped(const void *lo, const void *hi)
+{
+    region_t *r;
+
+    for (r = regions; r != NULL; r = r->next)
+	if ((char *)lo >= r->lo && (char *)hi < r->lo + r->len)
+	    return 1;
+    return 0;
+}
+
+/*
+ * mem_footprint - the most memory the heap and the mappings together
+ *    have used since the last reset (brk never shrinks, so this is the
+ *    heap size when nothing is mapped)
+ */
+size_t mem_footprint()
+{
+    return footprint_hwm;
+}
+
+/*
+ * mem_map_stats - mapping counts since the last reset
+ */
+void mem_map_stats(long *maps, long *unmaps, size_t *bytes)
+{
+    *maps = nmaps;
+    *unmaps = nunmaps;
+    *bytes = mapped;
+}
+
+static void update_footprint(void)
+{
+    if (mem_heapsize() + mapped > footprint_hwm)
+	footprint_hwm = mem_heapsize() + mapped;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -85,6 +269,28 @@ size_t mem_heapsize()
     return (size_t)((void *)mem_brk - (void *)heap);
 }
 
+/*
+ * mem_set_limit - let mem_sbrk grow the heap to at most bytes (at most
+ *    MAX_HEAP, which is what is reserved).  Returns -1 if it is larger.
+ */
+int mem_set_limit(size_t bytes)
+{
+    if (bytes > MAX_HEAP)
+	return -1;
+    heap_limit = bytes;
+    if (heap != NULL)
+	mem_max_addr = heap + heap_limit;
+    return 0;
+}
+
+/*
+ * mem_limit - the most bytes mem_sbrk may grow the heap to
+ */
+size_t mem_limit(void)
+{
+    return heap_limit;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
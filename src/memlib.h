@@ -4,8 +4,20 @@ void mem_init(void);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
+void mem_cold_reset(void);
+void mem_prefault(void *lo, size_t len);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+int mem_set_limit(size_t bytes);
+size_t mem_limit(void);
 size_t mem_pagesize(void);
 
+/* Mappings outside the heap, for large blocks */
+void *mem_map(size_t len);
+void mem_unmap(void *lo);
+void mem_unmap_all(void);
+int mem_is_mapped(const void *lo, const void *hi);
+size_t mem_footprint(void);
+void mem_map_stats(long *maps, long *unmaps, size_t *bytes);
+
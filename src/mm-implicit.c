@@ -2,6 +2,18 @@
  * mm-implicit.c -  Simple allocator based on implicit free lists, 
  *                  first fit placement, and boundary tag coalescing. 
  *                  (64-bit version)
+ *
+ * Under SUMMARY_INDEX the search does not walk every block.  The heap
+ * is cut into segments of SEG_SIZE bytes, and for each segment a side
+ * table keeps its first block (the first block pointer inside it) and
+ * a bound on the largest free block starting in it; groups of GROUP
+ * segments keep a bound over theirs.  find_fit skips every group and
+ * segment whose bound is below the request and walks only the blocks
+ * of the others.  Bounds are raised wherever a free block appears
+ * (free, coalesce, the remainder of a split) and left alone when one
+ * is allocated; the search lowers them to the true maximum of any
+ * segment or group it scanned in full without a fit.  Blocks carry no
+ * more than their boundary tags.
  */
 #include <stdio.h>
 #include <string.h>
@@ -9,12 +21,20 @@
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
+#include "mm_cachesim.h"
 
 /*
  * If NEXT_FIT defined use next fit search, else use first fit search 
  */
 //#define NEXT_FIT
 
+/* Find fits through the segment summaries instead of block by block */
+#define SUMMARY_INDEX
+
+/* If you want the heap checked after every free, define DEBUG */
+// #define DEBUG
+
 /* $begin mallocmacros */
 /* Basic constants and macros */
 #define WSIZE       4       /* word size (bytes) */  
@@ -22,15 +42,35 @@
 #define CHUNKSIZE  (1<<12)  /* initial heap size (bytes) */
 #define OVERHEAD    8       /* overhead of header and footer (bytes) */
 
+/* double word (8) alignment, or 16 (build with -DALIGNMENT=16) for the
+   x86-64 ABI; blocks are multiples of it and the first block pointer
+   (heap start + 16) already sits on a 16-byte boundary */
+#ifndef ALIGNMENT
+#define ALIGNMENT   8
+#endif
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
+#define MINBLOCK    ALIGN(DSIZE + OVERHEAD)  /* smallest block (bytes) */
+
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
 
+/* Summary index: segments and groups of segments */
+#define SEG_SHIFT   10                      /* 1KB segments */
+#define SEG_SIZE    (1 << SEG_SHIFT)
+#define NSEGS       (MAX_HEAP >> SEG_SHIFT) /* enough for the largest heap */
+#define GROUP_SHIFT 6                       /* 64 segments per group */
+#define GROUP       (1 << GROUP_SHIFT)
+#define NGROUPS     ((NSEGS + GROUP - 1) >> GROUP_SHIFT)
+
+/* Segment holding address p */
+#define SEG(p)      ((size_t)((char *)(p) - heap_lo) >> SEG_SHIFT)
+
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 
 /* Read and write a word at address p */
 /* NB: this code calls a 32-bit quantity a word */
-#define GET(p)       (*(unsigned int *)(p))
-#define PUT(p, val)  (*(unsigned int *)(p) = (val))  
+#define GET(p)       (*SIM((unsigned int *)(p), WSIZE))
+#define PUT(p, val)  (*SIM((unsigned int *)(p), WSIZE) = (val))
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
@@ -50,6 +90,13 @@ static char *heap_listp = 0;  /* pointer to first block */
 #ifdef NEXT_FIT
 static char *rover;       /* next fit rover */
 #endif
+#ifdef SUMMARY_INDEX
+static char *heap_lo;                /* start of the heap */
+static char *seg_first[NSEGS];       /* first block in a segment, or NULL */
+static unsigned seg_max[NSEGS];      /* >= largest free block starting in it */
+static unsigned group_max[NGROUPS];  /* >= the seg_max of its segments */
+static size_t seg_used = NSEGS;      /* segments the heap has reached */
+#endif
 
 /* function prototypes for internal helper routines */
 static void *extend_heap(size_t words);
@@ -58,6 +105,13 @@ static void *find_fit(size_t asize);
 static void *coalesce(void *bp);
 static void printblock(void *bp); 
 static void checkblock(void *bp);
+#ifdef SUMMARY_INDEX
+static void *index_find(size_t asize, char *lo, char *hi);
+static void index_start(void *bp);
+static void index_drop(void *bp, void *merged);
+static void index_free(void *bp);
+static void index_check(void);
+#endif
 
 /* 
  * mm_init - Initialize the memory manager 
@@ -66,7 +120,7 @@ static void checkblock(void *bp);
 int mm_init(void) 
 {
   /* create the initial empty heap */
-  if ((heap_listp = mem_sbrk(4*WSIZE)) == NULL)
+  if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1)
     return -1;
   PUT(heap_listp, 0);                        /* alignment padding */
   PUT(heap_listp+WSIZE, PACK(OVERHEAD, 1));  /* prologue header */ 
@@ -74,6 +128,15 @@ int mm_init(void)
   PUT(heap_listp+WSIZE+DSIZE, PACK(0, 1));   /* epilogue header */
   heap_listp += DSIZE;
 
+#ifdef SUMMARY_INDEX
+  heap_lo = mem_heap_lo();
+  memset(seg_first, 0, seg_used * sizeof(seg_first[0]));
+  memset(seg_max, 0, seg_used * sizeof(seg_max[0]));
+  memset(group_max, 0, sizeof(group_max));
+  seg_used = SEG(mem_heap_hi()) + 1;
+  index_start(heap_listp);                   /* the prologue */
+#endif
+
 #ifdef NEXT_FIT
   rover = heap_listp;
 #endif
@@ -104,9 +167,9 @@ void *mm_malloc(size_t size)
 
   /* Adjust block size to include overhead and alignment reqs. */
   if (size <= DSIZE)
-    asize = DSIZE + OVERHEAD;
+    asize = MINBLOCK;
   else
-    asize = DSIZE * ((size + (OVERHEAD) + (DSIZE-1)) / DSIZE);
+    asize = ALIGN(size + OVERHEAD);
 
   /* Search the free list for a fit */
   if ((bp = find_fit(asize)) != NULL) {
@@ -141,7 +204,9 @@ void mm_free(void *bp)
   PUT(HDRP(bp), PACK(size, 0));
   PUT(FTRP(bp), PACK(size, 0));
   coalesce(bp);
+#ifdef DEBUG
   mm_checkheap(0);
+#endif
 }
 
 /* $end mmfree */
@@ -173,9 +238,9 @@ void *mm_realloc(void *ptr, size_t size)
   }
 
   /* Copy the old data. */
-  oldsize = GET_SIZE(HDRP(ptr));
+  oldsize = GET_SIZE(HDRP(ptr)) - OVERHEAD;
   if(size < oldsize) oldsize = size;
-  memcpy(newptr, ptr, oldsize);
+  memcpy(SIM(newptr, oldsize), SIM(ptr, oldsize), oldsize);
 
   /* Free the old block. */
   mm_free(ptr);
@@ -207,6 +272,9 @@ void mm_checkheap(int verbose)
     printblock(bp);
   if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
     printf("Bad epilogue header\n");
+#ifdef SUMMARY_INDEX
+  index_check();
+#endif
 }
 
 /* The remaining routines are internal helper routines */
@@ -221,8 +289,8 @@ static void *extend_heap(size_t words)
   size_t size;
   void *return_ptr;
 
-  /* Allocate an even number of words to maintain alignment */
-  size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+  /* Allocate whole ALIGNMENT units to maintain alignment */
+  size = ALIGN(words * WSIZE);
   if ((long)(bp = mem_sbrk(size)) < 0) 
     return NULL;
 
@@ -230,10 +298,16 @@ static void *extend_heap(size_t words)
   PUT(HDRP(bp), PACK(size, 0));         /* free block header */
   PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
   PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+#ifdef SUMMARY_INDEX
+  index_start(bp);                      /* where the epilogue was */
+  seg_used = SEG(mem_heap_hi()) + 1;
+#endif
 
   /* Coalesce if the previous block was free */
   return_ptr = coalesce(bp);
+#ifdef DEBUG
   mm_checkheap(0);
+#endif
   return return_ptr;
 }
 /* $end mmextendheap */
@@ -249,12 +323,16 @@ static void place(void *bp, size_t asize)
 {
   size_t csize = GET_SIZE(HDRP(bp));   
 
-  if ((csize - asize) >= (DSIZE + OVERHEAD)) { 
+  if ((csize - asize) >= MINBLOCK) { 
     PUT(HDRP(bp), PACK(asize, 1));
     PUT(FTRP(bp), PACK(asize, 1));
     bp = NEXT_BLKP(bp);
     PUT(HDRP(bp), PACK(csize-asize, 0));
     PUT(FTRP(bp), PACK(csize-asize, 0));
+#ifdef SUMMARY_INDEX
+    index_start(bp);
+    index_free(bp);
+#endif
   }
   else { 
     PUT(HDRP(bp), PACK(csize, 1));
@@ -272,6 +350,16 @@ static void *find_fit(size_t asize)
   /* next fit search */
   char *oldrover = rover;
 
+#ifdef SUMMARY_INDEX
+  char *bp;
+
+  if ((bp = index_find(asize, rover, (char *)mem_heap_hi() + 1)) == NULL)
+    bp = index_find(asize, heap_listp, oldrover);
+  if (bp != NULL)
+    rover = bp;
+  return bp;
+#endif
+
   /* search from the rover to the end of list */
   for ( ; GET_SIZE(HDRP(rover)) > 0; rover = NEXT_BLKP(rover))
     if (!GET_ALLOC(HDRP(rover)) && (asize <= GET_SIZE(HDRP(rover))))
@@ -283,6 +371,9 @@ static void *find_fit(size_t asize)
       return rover;
 
   return NULL;  /* no fit found */
+#elif defined(SUMMARY_INDEX)
+  /* first fit search, skipping what the index rules out */
+  return index_find(asize, heap_listp, (char *)mem_heap_hi() + 1);
 #else 
   /* first fit search */
   void *bp;
@@ -304,8 +395,14 @@ static void *coalesce(void *bp)
   size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
   size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
   size_t size = GET_SIZE(HDRP(bp));
+#ifdef SUMMARY_INDEX
+  char *freed = bp, *next = NEXT_BLKP(bp);
+#endif
 
   if (prev_alloc && next_alloc) {            /* Case 1 */
+#ifdef SUMMARY_INDEX
+    index_free(bp);
+#endif
     return bp;
   }
 
@@ -330,6 +427,15 @@ static void *coalesce(void *bp)
     bp = PREV_BLKP(bp);
   }
 
+#ifdef SUMMARY_INDEX
+  /* The blocks merged into bp are no longer blocks of their own */
+  if (!next_alloc)
+    index_drop(next, bp);
+  if (!prev_alloc)
+    index_drop(freed, bp);
+  index_free(bp);
+#endif
+
 #ifdef NEXT_FIT
   /* Make sure the rover isn't pointing into the free block */
   /* that we just coalesced */
@@ -362,12 +468,131 @@ static void printblock(void *bp)
 
 static void checkblock(void *bp) 
 {
-  if ((size_t)bp % 8)
-    printf("Error: %p is not doubleword aligned\n", bp);
+  if (bp != heap_listp && (size_t)bp % ALIGNMENT)   /* prologue: 8 only */
+    printf("Error: %p is not %d-byte aligned\n", bp, ALIGNMENT);
   if (GET(HDRP(bp)) != GET(FTRP(bp)))
     printf("Error: header does not match footer\n");
 }
 
+#ifdef SUMMARY_INDEX
+/*
+ * index_find - First free block of at least asize bytes with its block
+ *     pointer in [lo, hi), where lo is a block pointer.  Groups and
+ *     segments whose bound rules them out are skipped; the bound of a
+ *     segment or group that was scanned in full without a fit is
+ *     lowered to what the scan saw.
+ */
+static void *index_find(size_t asize, char *lo, char *hi)
+{
+  size_t s, g, first = SEG(lo), last = SEG(hi - 1);
+  unsigned seen, gseen;
+  char *bp;
+  int whole;                    /* scanning all of the current group */
+
+  for (g = first >> GROUP_SHIFT; g <= last >> GROUP_SHIFT; g++) {
+    if (SIDE(group_max[g]) < asize)
+      continue;
+    whole = (g << GROUP_SHIFT) >= first && ((g + 1) << GROUP_SHIFT) - 1 <= last;
+    gseen = 0;
+    for (s = g << GROUP_SHIFT; s < (g + 1) << GROUP_SHIFT && s < NSEGS; s++) {
+      if (s < first || s > last || SIDE(seg_max[s]) < asize) {
+        gseen = MAX(gseen, seg_max[s]);
+        continue;
+      }
+      seen = 0;
+      for (bp = s == first ? lo : SIDE(seg_first[s]);
+           bp != NULL && bp < hi && GET_SIZE(HDRP(bp)) > 0 && SEG(bp) == s;
+           bp = NEXT_BLKP(bp)) {
+        if (GET_ALLOC(HDRP(bp)))
+          continue;
+        if (asize <= GET_SIZE(HDRP(bp)))
+          return bp;
+        seen = MAX(seen, GET_SIZE(HDRP(bp)));
+      }
+      /* Only a scan of the whole segment gives its true maximum */
+      if ((s != first || lo == seg_first[s]) && s != last)
+        SIDE(seg_max[s]) = seen;
+      else
+        whole = 0;
+      gseen = MAX(gseen, seg_max[s]);
+    }
+    if (whole)
+      SIDE(group_max[g]) = gseen;
+  }
+  return NULL;
+}
+
+/*
+ * index_start - bp has become a block pointer: it may be the first of
+ *     its segment
+ */
+static void index_start(void *bp)
+{
+  size_t s = SEG(bp);
+
+  if (SIDE(seg_first[s]) == NULL || seg_first[s] > (char *)bp)
+    seg_first[s] = bp;
+}
+
+/*
+ * index_drop - Block pointer bp has been merged into the block merged:
+ *     if it was the first of its segment, the first is now the block
+ *     after merged, if that is in the segment
+ */
+static void index_drop(void *bp, void *merged)
+{
+  size_t s = SEG(bp);
+  char *next;
+
+  if (SIDE(seg_first[s]) != bp)
+    return;
+  next = NEXT_BLKP(merged);
+  seg_first[s] = SEG(next) == s && GET_SIZE(HDRP(next)) > 0 ? next : NULL;
+}
+
+/*
+ * index_free - bp is a free block: raise the bounds of its segment and
+ *     group to its size
+ */
+static void index_free(void *bp)
+{
+  size_t s = SEG(bp);
+  unsigned size = GET_SIZE(HDRP(bp));
+
+  if (SIDE(seg_max[s]) < size)
+    seg_max[s] = size;
+  if (SIDE(group_max[s >> GROUP_SHIFT]) < size)
+    group_max[s >> GROUP_SHIFT] = size;
+}
+
+/*
+ * index_check - Compare the index with a walk of the heap
+ */
+static void index_check(void)
+{
+  size_t s;
+  char *bp;
+
+  for (s = 0; s < NSEGS; s++) {
+    if (seg_max[s] > group_max[s >> GROUP_SHIFT])
+      printf("Error: segment %lu bound above its group's\n", (unsigned long)s);
+    if (seg_first[s] != NULL && (SEG(seg_first[s]) != s ||
+        (seg_first[s] != heap_listp && SEG(PREV_BLKP(seg_first[s])) == s)))
+      printf("Error: %p is not the first block of segment %lu\n",
+             seg_first[s], (unsigned long)s);
+  }
+  for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+    s = SEG(bp);
+    if (seg_first[s] == NULL || seg_first[s] > bp)
+      printf("Error: segment %lu misses its first block %p\n",
+             (unsigned long)s, bp);
+    if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) > seg_max[s])
+      printf("Error: free block %p above the bound of segment %lu\n",
+             bp, (unsigned long)s);
+  }
+}
+#endif
+
 void *mm_calloc (size_t nmemb, size_t size)
 {
   void *ptr;
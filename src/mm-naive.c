@@ -28,11 +28,14 @@
 #endif
 
 
-/* single word (4) or double word (8) alignment */
+/* double word (8) alignment, or 16 (build with -DALIGNMENT=16) for the
+ * x86-64 ABI; the size word then takes a whole 16 bytes */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
@@ -0,0 +1,597 @@
+/*
+ * mm-page.c - Page heap allocator with a radix-tree page map (BiBoP).
+ *
+ * The heap is divided into spans: runs of whole pages.  A span either
+ * is free, holds one large block (more than SMALL_MAX bytes, rounded up
+ * to pages), or is cut into objects of a single size class ("big bag of
+ * pages").  Objects carry no header at all: a radix-tree page map takes
+ * any heap address to the span_t describing its page, and the span
+ * knows the class, so mm_free and mm_realloc find the size there.
+ *
+ * Free objects of a small span sit on the span's own free list; the
+ * span's untouched tail is handed out by a bump pointer first, so a new
+ * span costs nothing per object.  Spans with free objects are kept on
+ * one list per class.  A span whose last object is freed goes back to
+ * the page heap, where it coalesces with free neighbours at page
+ * granularity (the page map of a free span records its first and last
+ * page) and is filed by its length.  Page requests split a free span
+ * or grow the heap, extending a free span at the end of the heap when
+ * there is one.
+ *
+ * Span descriptors and the page map leaves live in metadata pages taken
+ * from the heap too, so they count against utilization.  The page map
+ * is relative to the start of the heap: a static root of PM_ROOT
+ * pointers, each to a leaf of PM_LEAF entries carved from a metadata
+ * page when the heap first reaches it.
+ *
+ * Every class size is a multiple of 16 and spans start on page
+ * boundaries, so payloads are 16-byte aligned whatever ALIGNMENT is.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* $begin pagemacros */
+#define PAGE_SHIFT  12
+#define PAGE        (1 << PAGE_SHIFT)  /* page size (bytes) */
+#define SMALL_MAX   2048               /* largest size class (bytes) */
+#define NCLASS      24                 /* number of size classes */
+#define MAX_SPAN    8                  /* most pages in a small span */
+#define FREE_LISTS  64                 /* free spans of 1..63 pages, and more */
+
+#define PM_LEAF_BITS 6                 /* pages per page map leaf: 64 */
+#define PM_LEAF     (1 << PM_LEAF_BITS)
+#define PM_ROOT     4096               /* leaves: maps 1GB of heap */
+
+#define SPAN_FREE   (-1)               /* cls of a free span */
+#define SPAN_LARGE  (-2)               /* cls of a span with one large block */
+
+#define MIN(x, y) ((x) < (y)? (x) : (y))
+
+/* Page number of address p within the heap */
+#define PAGENO(p)   ((size_t)((char *)(p) - (char *)mem_heap_lo()) >> PAGE_SHIFT)
+/* $end pagemacros */
+
+typedef struct span {
+  char *start;                  /* first page */
+  size_t npages;
+  int cls;                      /* size class, SPAN_FREE or SPAN_LARGE */
+  unsigned nfree;               /* free objects (small spans) */
+  void *freelist;               /* freed objects (small spans) */
+  char *bump;                   /* never handed out from here on */
+  struct span *next, *prev;     /* class list, or free span list */
+} span_t;
+
+/* Global variables */
+static span_t **pagemap[PM_ROOT];   /* page map root */
+static span_t *classes[NCLASS];     /* spans with free objects, per class */
+static span_t *free_spans[FREE_LISTS]; /* free spans by length */
+static span_t *span_pool;           /* unused span descriptors */
+static char *meta_next, *meta_end;  /* rest of the current metadata page */
+static int initialized = 0;
+
+/* Class sizes: 16 apart up to 128, then four per power of two */
+static const unsigned class_size[NCLASS] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  160, 192, 224, 256, 320, 384, 448, 512,
+  640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+static unsigned char class_pages[NCLASS];  /* span length per class */
+
+/* function prototypes for internal helper routines */
+static int size_class(size_t size);
+static void *meta_alloc(size_t size);
+static span_t *span_new(char *start, size_t npages);
+static void span_delete(span_t *s);
+static span_t *span_of(const void *p);
+static int map_span(span_t *s, int all);
+static void list_push(span_t **list, span_t *s);
+static void list_remove(span_t **list, span_t *s);
+static span_t **free_list(size_t npages);
+static span_t *alloc_pages(size_t npages);
+static void free_pages(span_t *s);
+static int grow_span(span_t *s, size_t npages);
+static void *small_alloc(int cls);
+
+/*
+ * mm_init - Initialize the memory manager
+ */
+int mm_init(void)
+{
+  int c;
+  size_t n;
+
+  memset(pagemap, 0, sizeof(pagemap));
+  memset(classes, 0, sizeof(classes));
+  memset(free_spans, 0, sizeof(free_spans));
+  span_pool = NULL;
+  meta_next = meta_end = NULL;
+
+  /* Pick the shortest span that wastes at most an eighth of itself */
+  for (c = 0; c < NCLASS; c++) {
+    for (n = 1; n < MAX_SPAN; n++)
+      if ((n * PAGE) % class_size[c] <= (n * PAGE) / 8)
+        break;
+    class_pages[c] = n;
+  }
+
+  /* The heap must start on a page boundary */
+  if ((size_t)mem_heap_lo() % PAGE != 0 || mem_heapsize() != 0)
+    return -1;
+  initialized = 1;
+  return 0;
+}
+
+/*
+ * malloc - Allocate a block with at least size bytes of payload
+ */
+void *mm_malloc(size_t size)
+{
+  span_t *s;
+  int cls;
+
+  if (!initialized && mm_init() < 0)
+    return NULL;
+
+  /* Ignore spurious requests */
+  if (size <= 0)
+    return NULL;
+
+  if ((cls = size_class(size)) >= 0)
+    return small_alloc(cls);
+
+  if ((s = alloc_pages((size + PAGE - 1) >> PAGE_SHIFT)) == NULL)
+    return NULL;
+  s->cls = SPAN_LARGE;
+  return s->start;
+}
+
+/*
+ * free - Free a block: its span is found through the page map
+ */
+void mm_free(void *ptr)
+{
+  span_t *s;
+
+  if (ptr == NULL)
+    return;
+  s = span_of(ptr);
+
+  if (s->cls == SPAN_LARGE) {
+    free_pages(s);
+    return;
+  }
+
+  *(void **)ptr = s->freelist;
+  s->freelist = ptr;
+  if (s->nfree++ == 0)                /* was full */
+    list_push(&classes[s->cls], s);
+  if (s->nfree == s->npages * PAGE / class_size[s->cls]) {
+    list_remove(&classes[s->cls], s);
+    free_pages(s);
+  }
+}
+
+/*
+ * realloc - Keep the block if its class or pages still fit, grow a
+ *     large block in place when the pages after it are free, and move
+ *     it otherwise
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+  size_t oldsize;
+  void *newptr;
+  span_t *s;
+
+  /* If size == 0 then this is just free, and we return NULL. */
+  if (size == 0) {
+    mm_free(ptr);
+    return NULL;
+  }
+
+  /* If oldptr is NULL, then this is just malloc. */
+  if (ptr == NULL)
+    return mm_malloc(size);
+
+  s = span_of(ptr);
+  if (s->cls == SPAN_LARGE) {
+    oldsize = s->npages * PAGE;
+    if (size > SMALL_MAX && size <= oldsize)
+      return ptr;
+    if (size > oldsize && grow_span(s, (size + PAGE - 1) >> PAGE_SHIFT) == 0)
+      return ptr;
+  } else {
+    oldsize = class_size[s->cls];
+    if (size <= oldsize && size_class(size) == s->cls)
+      return ptr;
+  }
+
+  if ((newptr = mm_malloc(size)) == NULL)
+    return NULL;
+  memcpy(newptr, ptr, MIN(size, oldsize));
+  mm_free(ptr);
+  return newptr;
+}
+
+/*
+ * calloc - Allocate the block and set it to zero
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+  void *ptr;
+
+  if ((ptr = mm_malloc(nmemb * size)) != NULL)
+    memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+/*
+ * checkheap - Walk the heap span by span and check the page map, the
+ *     class lists and the free span lists against the spans
+ */
+void mm_checkheap(int verbose)
+{
+  char *p = mem_heap_lo(), *hi = (char *)mem_heap_hi() + 1;
+  span_t *s;
+  size_t i;
+  int c;
+
+  while (p < hi) {
+    if ((s = span_of(p)) == NULL || s->start != p) {
+      if (verbose)
+        printf("%p: metadata page\n", p);
+      p += PAGE;
+      continue;
+    }
+    if (verbose)
+      printf("%p: span of %lu pages, class %d, %u free\n", p,
+             (unsigned long)s->npages, s->cls, s->nfree);
+    if (s->cls != SPAN_FREE)
+      for (i = 0; i < s->npages; i++)
+        if (span_of(p + i * PAGE) != s)
+          printf("Error: page %lu of span %p not mapped\n", (unsigned long)i, p);
+    if (s->cls == SPAN_FREE && span_of(p + (s->npages - 1) * PAGE) != s)
+      printf("Error: last page of free span %p not mapped\n", p);
+    p += s->npages * PAGE;
+  }
+
+  for (c = 0; c < NCLASS; c++)
+    for (s = classes[c]; s != NULL; s = s->next)
+      if (s->cls != c || s->nfree == 0)
+        printf("Error: span %p on class list %d\n", s->start, c);
+  for (c = 0; c < FREE_LISTS; c++)
+    for (s = free_spans[c]; s != NULL; s = s->next)
+      if (s->cls != SPAN_FREE || free_list(s->npages) != &free_spans[c])
+        printf("Error: span %p on free list %d\n", s->start, c);
+}
+
+/* The remaining routines are internal helper routines */
+
+/*
+ * size_class - Class of a request, or -1 if it needs its own pages
+ */
+static int size_class(size_t size)
+{
+  int c;
+
+  if (size > SMALL_MAX)
+    return -1;
+  if (size <= 128)
+    return (size + 15) / 16 - 1;
+  for (c = 8; class_size[c] < size; c++)
+    ;
+  return c;
+}
+
+/*
+ * small_alloc - Take an object from a span of class cls, starting a
+ *     new span when every span of the class is full
+ */
+static void *small_alloc(int cls)
+{
+  span_t *s = classes[cls];
+  void *p;
+
+  if (s == NULL) {
+    if ((s = alloc_pages(class_pages[cls])) == NULL)
+      return NULL;
+    s->cls = cls;
+    s->nfree = s->npages * PAGE / class_size[cls];
+    s->freelist = NULL;
+    s->bump = s->start;
+    list_push(&classes[cls], s);
+  }
+
+  if ((p = s->freelist) != NULL)
+    s->freelist = *(void **)p;
+  else {
+    p = s->bump;
+    s->bump += class_size[cls];
+  }
+  if (--s->nfree == 0)
+    list_remove(&classes[cls], s);
+  return p;
+}
+
+/*
+ * meta_alloc - Carve size bytes of metadata from a metadata page
+ */
+static void *meta_alloc(size_t size)
+{
+  char *p;
+
+  if (meta_next == NULL || meta_next + size > meta_end) {
+    if ((p = mem_sbrk(PAGE)) == (void *)-1)
+      return NULL;
+    meta_next = p;
+    meta_end = p + PAGE;
+  }
+  p = meta_next;
+  meta_next += size;
+  return p;
+}
+
+/*
+ * span_new - A descriptor for npages pages at start, not yet mapped
+ */
+static span_t *span_new(char *start, size_t npages)
+{
+  span_t *s;
+
+  if ((s = span_pool) != NULL)
+    span_pool = s->next;
+  else if ((s = meta_alloc(sizeof(span_t))) == NULL)
+    return NULL;
+  memset(s, 0, sizeof(*s));
+  s->start = start;
+  s->npages = npages;
+  s->cls = SPAN_FREE;
+  return s;
+}
+
+/*
+ * span_delete - Recycle the descriptor of a span merged into another
+ */
+static void span_delete(span_t *s)
+{
+  s->next = span_pool;
+  span_pool = s;
+}
+
+/*
+ * span_of - Page map lookup: the span holding address p
+ */
+static span_t *span_of(const void *p)
+{
+  size_t page = PAGENO(p);
+  span_t **leaf = pagemap[page >> PM_LEAF_BITS];
+
+  return leaf == NULL ? NULL : leaf[page & (PM_LEAF - 1)];
+}
+
+/*
+ * map_span - Point the page map at s for all of its pages, or (free
+ *     spans) for the first and last only.  The leaves come first, so
+ *     if one cannot be had the map is left as it was and -1 returned.
+ *     Pages whose leaves exist are mapped without fail: the first and
+ *     last of a span that was mapped before, or of spans that were.
+ */
+static int map_span(span_t *s, int all)
+{
+  size_t page = PAGENO(s->start), i;
+  span_t **leaf;
+
+  for (i = page >> PM_LEAF_BITS; i <= (page + s->npages - 1) >> PM_LEAF_BITS; i++) {
+    if (!all && i > page >> PM_LEAF_BITS &&
+        i < (page + s->npages - 1) >> PM_LEAF_BITS)
+      continue;
+    if (pagemap[i] == NULL) {
+      if ((leaf = meta_alloc(PM_LEAF * sizeof(span_t *))) == NULL)
+        return -1;
+      memset(leaf, 0, PM_LEAF * sizeof(span_t *));
+      pagemap[i] = leaf;
+    }
+  }
+
+  for (i = 0; i < s->npages; i++) {
+    if (!all && i == 1 && s->npages > 2)
+      i = s->npages - 1;
+    pagemap[(page + i) >> PM_LEAF_BITS][(page + i) & (PM_LEAF - 1)] = s;
+  }
+  return 0;
+}
+
+/*
+ * list_push, list_remove - Doubly linked span lists
+ */
+static void list_push(span_t **list, span_t *s)
+{
+  s->prev = NULL;
+  s->next = *list;
+  if (*list != NULL)
+    (*list)->prev = s;
+  *list = s;
+}
+
+static void list_remove(span_t **list, span_t *s)
+{
+  if (s->prev != NULL)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if (s->next != NULL)
+    s->next->prev = s->prev;
+}
+
+/*
+ * free_list - The free span list for spans of npages pages
+ */
+static span_t **free_list(size_t npages)
+{
+  return &free_spans[MIN(npages, FREE_LISTS) - 1];
+}
+
+/*
+ * alloc_pages - A span of npages pages, mapped in full: the front of
+ *     the best fitting free span, or new pages at the end of the heap.
+ *     NULL if the heap cannot grow, for the pages or for the metadata
+ *     that maps them; a free span taken apart is put back as it was,
+ *     while pages the heap grew by are lost.
+ */
+static span_t *alloc_pages(size_t npages)
+{
+  span_t *s = NULL, *t, *rest = NULL;
+  size_t n, old;
+  char *p;
+
+  /* Exact lengths first, then best fit among the longest spans */
+  for (n = npages; n < FREE_LISTS && (s = free_spans[n - 1]) == NULL; n++)
+    ;
+  if (s == NULL)
+    for (t = free_spans[FREE_LISTS - 1]; t != NULL; t = t->next)
+      if (t->npages >= npages && (s == NULL || t->npages < s->npages))
+        s = t;
+
+  if (s != NULL) {
+    list_remove(free_list(s->npages), s);
+    if (s->npages > npages) {
+      if ((rest = span_new(s->start + npages * PAGE, s->npages - npages)) == NULL ||
+          map_span(rest, 0) < 0) {
+        if (rest != NULL)
+          span_delete(rest);
+        list_push(free_list(s->npages), s);
+        return NULL;
+      }
+      s->npages = npages;
+    }
+    s->cls = SPAN_LARGE;
+    if (map_span(s, 1) < 0) {
+      if (rest != NULL) {
+        s->npages += rest->npages;
+        span_delete(rest);
+      }
+      s->cls = SPAN_FREE;
+      map_span(s, 0);
+      list_push(free_list(s->npages), s);
+      return NULL;
+    }
+    if (rest != NULL)
+      list_push(free_list(rest->npages), rest);
+    return s;
+  }
+
+  /* A free span at the end of the heap only needs the difference */
+  t = mem_heapsize() > 0 ? span_of((char *)mem_heap_hi() - PAGE + 1) : NULL;
+  if (t != NULL && t->cls == SPAN_FREE &&
+      t->start + t->npages * PAGE == (char *)mem_heap_hi() + 1) {
+    if (mem_sbrk((npages - t->npages) * PAGE) == (void *)-1)
+      return NULL;
+    list_remove(free_list(t->npages), t);
+    s = t;
+    old = s->npages;
+    s->npages = npages;
+    s->cls = SPAN_LARGE;
+    if (map_span(s, 1) < 0) {
+      s->npages = old;
+      s->cls = SPAN_FREE;
+      list_push(free_list(s->npages), s);
+      return NULL;
+    }
+    return s;
+  }
+
+  /* Descriptor first, so its metadata page does not split the heap */
+  if ((s = span_new(NULL, npages)) == NULL)
+    return NULL;
+  if ((p = mem_sbrk(npages * PAGE)) == (void *)-1) {
+    span_delete(s);
+    return NULL;
+  }
+  s->start = p;
+  s->cls = SPAN_LARGE;
+  if (map_span(s, 1) < 0) {
+    span_delete(s);
+    return NULL;
+  }
+  return s;
+}
+
+/*
+ * free_pages - Return span s to the page heap, merged with the free
+ *     spans on either side
+ */
+static void free_pages(span_t *s)
+{
+  char *lo = mem_heap_lo(), *hi = (char *)mem_heap_hi() + 1;
+  span_t *t;
+
+  s->cls = SPAN_FREE;
+  if (s->start > lo && (t = span_of(s->start - 1)) != NULL &&
+      t->cls == SPAN_FREE) {
+    list_remove(free_list(t->npages), t);
+    t->npages += s->npages;
+    span_delete(s);
+    s = t;
+  }
+  if (s->start + s->npages * PAGE < hi &&
+      (t = span_of(s->start + s->npages * PAGE)) != NULL &&
+      t->cls == SPAN_FREE) {
+    list_remove(free_list(t->npages), t);
+    s->npages += t->npages;
+    span_delete(t);
+  }
+  map_span(s, 0);                   /* its first and last page were mapped */
+  list_push(free_list(s->npages), s);
+}
+
+/*
+ * grow_span - Extend large span s to npages pages in place, taking
+ *     the front of a free span right after it or growing the heap when
+ *     s ends it.  Returns -1, leaving s as it was, if neither is
+ *     possible or the new pages cannot be mapped.
+ */
+static int grow_span(span_t *s, size_t npages)
+{
+  char *end = s->start + s->npages * PAGE, *hi = (char *)mem_heap_hi() + 1;
+  size_t more = npages - s->npages, old = s->npages;
+  span_t *t = NULL, *rest = NULL;
+
+  if (end == hi) {
+    if (mem_sbrk(more * PAGE) == (void *)-1)
+      return -1;
+  } else {
+    if ((t = span_of(end)) == NULL || t->cls != SPAN_FREE || t->npages < more)
+      return -1;
+    list_remove(free_list(t->npages), t);
+    if (t->npages > more &&
+        ((rest = span_new(end + more * PAGE, t->npages - more)) == NULL ||
+         map_span(rest, 0) < 0)) {
+      if (rest != NULL)
+        span_delete(rest);
+      list_push(free_list(t->npages), t);
+      return -1;
+    }
+  }
+
+  s->npages = npages;
+  if (map_span(s, 1) < 0) {
+    /* Pages the heap grew by are lost; a free span t is put back */
+    s->npages = old;
+    if (t != NULL) {
+      if (rest != NULL)
+        span_delete(rest);
+      map_span(t, 0);
+      list_push(free_list(t->npages), t);
+    }
+    return -1;
+  }
+  if (t != NULL) {
+    if (rest != NULL)
+      list_push(free_list(rest->npages), rest);
+    span_delete(t);
+  }
+  return 0;
+}
@@ -11,6 +11,9 @@
 #include <limits.h>
 
 #include "mm.h"
+#include "mm_shm.h"
+#include "mm_bulk.h"
+#include "mm_cachesim.h"
 #include "memlib.h"
 
 /* If you want debugging output, use the following macro.  When you hand
@@ -23,15 +26,52 @@
 # define dbg_printf(...)
 #endif
 
-/* Define search strategy */
+/* Define search strategy (the default of the fit.policy tunable) */
 #define FIRST_FIT
 // #define BEST_FIT
 
-/* single word (4) or double word (8) alignment */
+/* Define placement strategy: blocks smaller than PLACE_SPLIT bytes are
+ * carved from the high end of the free block they are placed in (or
+ * moved to the high end when realloc grows them in place), larger ones
+ * from the low end, so small and large blocks do not interleave.  It
+ * relies on the frontier: with a free block at the end of the heap on
+ * the list, small blocks carved from its top strand the space below
+ * them (fs falls from 93% to 69%), so it must not be turned on without
+ * it */
+#define HIGH_PLACE
+#define PLACE_SPLIT 128
+#define SLABSIZE    512   /* frontier bytes a small block starts a slab with */
+
+/* Keep statistics for mm_shm; they reach the shared block (if any) only
+ * on slow paths and every MM_SHM_PERIOD requests.  Blocks are counted
+ * in place as they come and go (a few adds, in place, bump, mm_free,
+ * mm_realloc and the free list), so publishing never walks the heap */
+#define SHM_STATS
+#ifdef SHM_STATS
+# define STAT(stmt) stmt
+#else
+# define STAT(stmt)
+#endif
+
+/* Support mm_defrag_hint and mm_defrag, which tell sparse regions of
+ * the heap from dense ones by the live bytes of every 1<<REGION_SHIFT
+ * bytes.  These are counted by walking the heap when one of the two is
+ * called, so the requests themselves pay nothing for them */
+#define DEFRAG_HINT
+
+/* double word (8) alignment, or 16 (build with -DALIGNMENT=16) for the
+ * x86-64 ABI, where long double, SSE types and max_align_t need it.
+ * Blocks are multiples of ALIGNMENT with 4-byte boundary tags either
+ * way: block pointers are ALIGNMENT-aligned, so a header takes the last
+ * word of the granule before its block and a footer the word before
+ * the next header.  16-byte mode therefore costs only the rounding of
+ * block sizes, not a padded 8-byte header and footer. */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
 
 /* Use macros and global values from the textbook */
 #define WSIZE       4       /* Word size (bytes) */
@@ -39,18 +79,41 @@
 #define QSIZE       16      /* Quad word size (bytes) */
 #define CHUNKSIZE  (1<<11)  /* Extend heap by this amount (bytes) */
 #define OVERHEAD    8       /* overhead of header and footer (bytes) */
+#define MINBLOCK   ALIGN(QSIZE + OVERHEAD) /* free list links and tags */
+#define PROLOGUE   ALIGN(OVERHEAD)  /* puts the first block on an
+                                       ALIGNMENT boundary */
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))
 
+/* Values of the fit.policy tunable */
+#define FIT_FIRST   0
+#define FIT_BEST    1
+#define CONF_ENV    "MM_CONF"   /* environment string of tunables */
+
+/* Large blocks get a mapping of their own (memlib's mem_map) instead of
+ * heap space, and freed mappings are kept in a small cache for reuse */
+#define MAP_THRESHOLD (1<<17)   /* requests this large are mapped (bytes) */
+#define MAP_SLOTS     16        /* mappings the cache holds at most */
+#define MAP_DECAY     64        /* large requests a cached mapping survives */
+#define MAPPED        0x2       /* header bit of mapped blocks */
+#define MAP_HDR       ALIGNMENT /* mapping bytes in front of the payload */
+
+/* Occupancy regions for mm_defrag_hint */
+#define REGION_SHIFT  14        /* 16KB regions */
+#define REGIONS       4096      /* regions tracked: the first 64MB of heap */
+#define REGION_SPARSE 50        /* a region less full than this (%) is sparse */
+#define DEFRAG_SEARCH 256       /* free blocks a defrag hint looks at */
+#define REGION(p)     ((size_t)((char *)(p) - (char *)mem_heap_lo()) >> REGION_SHIFT)
+
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 
 /* Read and write a word at address p */
-#define GET(p)            (*(unsigned int *)(p))
-#define PUT(p, val)       (*(unsigned int *)(p) = (val))
-#define GET_8(p)          (*(unsigned long *)(p))
-#define PUT_8(p, val)     (*(unsigned long *)(p) = (unsigned long)(val))
-#define GET_8add(p)       ((char **)(p))
+#define GET(p)            (*SIM((unsigned int *)(p), WSIZE))
+#define PUT(p, val)       (*SIM((unsigned int *)(p), WSIZE) = (val))
+#define GET_8(p)          (*SIM((unsigned long *)(p), DSIZE))
+#define PUT_8(p, val)     (*SIM((unsigned long *)(p), DSIZE) = (unsigned long)(val))
+#define GET_8add(p)       (SIM((char **)(p), DSIZE))
 #define PUT_8add(p, val)  ((char **)(p) = (unsigned long)(val))
 
 /* Read the size and allocated fields from address p */
@@ -59,6 +122,9 @@
 #define GET_SIZE_8(p)   (GET_8(p) & ~0x7)
 #define GET_ALLOC_8(p)  (GET_8(p) & 0x1)
 
+/* Is bp a mapped block? */
+#define IS_MAPPED(bp)   (GET(HDRP(bp)) & MAPPED)
+
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
@@ -75,13 +141,100 @@
 static char *heap_listp = NULL;  /* pointer to first block (Only has a
                                     symbolic meaning for this program) */
 static char *root = NULL;        /* pointer to first free block */
+static char *frontier = NULL;    /* bump region: the free block at the end
+                                    of the heap, which is not on the list
+                                    (the epilogue's block pointer when it
+                                    is empty) */
+static char *heap_end = NULL;    /* end of the heap, where the frontier ends */
+static unsigned fit_budget = 0;  /* max free blocks find_fit visits (0 = no
+                                    limit); past it the heap is extended */
+
+/* Runtime tunables (mm_ctl, MM_CONF), defaulting to the macros above.
+ * The request paths read them as plain globals, like fit_budget; only
+ * mm_ctl validates them, and MM_CONF is read once, by the first mm_init */
+#ifdef BEST_FIT
+static int fit_policy = FIT_BEST;
+#else
+static int fit_policy = FIT_FIRST;
+#endif
+static size_t chunk_size = CHUNKSIZE;       /* least heap extension (bytes) */
+static size_t split_min = MINBLOCK;         /* least remainder split off */
+static size_t map_threshold = MAP_THRESHOLD;
+#ifdef HIGH_PLACE
+static size_t place_split = PLACE_SPLIT;
+#endif
+static int check_verbose = 0;   /* mm_checkheap(check_verbose-1) after every
+                                   heap extension (0 = never) */
+static int conf_read = 0;       /* MM_CONF has been applied */
+
+/* Cache of freed mappings: each is reused by a request of the same
+ * size class (at most a quarter smaller than the mapping), and unmapped
+ * once MAP_DECAY large requests have passed without one */
+static struct {
+  char *lo;                      /* start of the mapping */
+  size_t len;                    /* its (size class) length */
+  unsigned long stamp;           /* map_clock when it was cached */
+} map_cache[MAP_SLOTS];
+static int map_ncached = 0;
+static size_t map_cached_bytes = 0;
+static size_t map_cache_max = 1<<25; /* bytes the cache may hold (0 = off) */
+static unsigned long map_clock = 0;  /* counts large requests */
+
+#ifdef DEFRAG_HINT
+static unsigned region_live[REGIONS]; /* live bytes per region, as of the
+                                         last call of occupancy */
+#endif
+
+#ifdef SHM_STATS
+static mm_heap_stats_t stats;        /* published by stats_publish; the
+                                        request counts are kept only while
+                                        publishing, and free_* and
+                                        largest_free leave out the
+                                        frontier (stats_heap adds it) */
+static unsigned long stats_ops = 0;  /* requests since mm_init */
+static int stats_stale = 0;          /* a block of largest_free left the
+                                        list, so it may be less */
+#endif
+
+/* The globals mm_save keeps: those that describe the heap */
+typedef struct {
+  char *heap_listp, *root, *frontier, *heap_end;
+#ifdef SHM_STATS
+  mm_heap_stats_t stats;
+#endif
+} mm_state_t;
 
 /* Helper functions */
 static void *extend_heap(size_t words);
 static void *find_fit(size_t asize);
-static void place(void *bp, size_t asize);
+static void *place(void *bp, size_t asize);
+static inline void mm_insert(void *bp);
 static void *coalesce(void *bp);
 static inline void mm_unlink(void *bp);
+static inline size_t frontier_size(void);
+static void set_frontier(char *bp);
+static void *bump(size_t asize);
+static void *carve(size_t size);
+static void *map_alloc(size_t size);
+static void map_free(void *bp);
+static size_t map_round(size_t size);
+static void map_evict(int i);
+static void map_decay(void);
+#ifdef DEFRAG_HINT
+static void occupancy(void);
+static void occupy(void *bp, size_t size, int n);
+static void *place_at(void *bp, size_t asize);
+static void *dense_fit(void *ptr);
+#endif
+#ifdef SHM_STATS
+static inline void stats_op(long *counter);
+static inline void stats_live(size_t size, int n);
+static inline void stats_free(size_t size, int n);
+static void stats_slow(double start);
+static void stats_heap(mm_heap_stats_t *s);
+static void stats_publish(void);
+#endif
+static void conf_apply(const char *conf);
 void mm_checkheap(int verbose);
 static void printblock(void *bp);
 static void checkblock(void *bp);
@@ -96,37 +249,243 @@ static void checkblock(void *bp);
  */
 int mm_init(void) {
   char *heap_start;
+
+  if (!conf_read) {
+    conf_read = 1;
+    conf_apply(getenv(CONF_ENV));
+  }
+
+  /* Mappings cached by a previous run, unless memlib already dropped them */
+  while (map_ncached > 0) {
+    if (mem_is_mapped(map_cache[0].lo, map_cache[0].lo))
+      mem_unmap(map_cache[0].lo);
+    map_cache[0] = map_cache[--map_ncached];
+  }
+  map_cached_bytes = 0;
+  STAT(memset(&stats, 0, sizeof(stats)));
+  STAT(stats_ops = 0);
+  STAT(stats_stale = 0);
+
   /* Create the initial empty heap */
-  if ((heap_listp = mem_sbrk(4*DSIZE)) == (void *)-1)
+  if ((heap_listp = mem_sbrk(4*DSIZE + PROLOGUE)) == (void *)-1)
     return -1;
 
-  /* No alignment padding needed */
-  root = heap_listp;                                /* Starting Node Address */
-  PUT_8(heap_listp, 0);                             /* NEXT(root) = NULL */
-  PUT_8(heap_listp+DSIZE, 0);                       /* PREV(root) = NULL */
-  PUT(heap_listp+WSIZE*4, 0);                       /* alignment padding */
-  PUT(heap_listp+WSIZE*5, PACK(OVERHEAD, 1));       /* prologue header */
-  PUT(heap_listp+WSIZE*6, PACK(OVERHEAD, 1));       /* prologue footer */
-  PUT(heap_listp+WSIZE*7, PACK(0, 1));              /* epilogue header */
-  heap_listp += WSIZE*6;                            /* Reallocate heap_listp */
-
-  /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-  if ( (heap_start = extend_heap(CHUNKSIZE/WSIZE)) == NULL)
+  /* The list sentinel gets a zero-size header: find_fit stops there,
+   * at the tail of the list, without reading outside the heap */
+  PUT(heap_listp, 0);                               /* alignment padding */
+  PUT(heap_listp+WSIZE, PACK(0, 1));                /* sentinel header */
+  root = heap_listp+DSIZE;                          /* Starting Node Address */
+  PUT_8(root, 0);                                   /* NEXT(root) = NULL */
+  PUT_8(root+DSIZE, 0);                             /* PREV(root) = NULL */
+  PUT(heap_listp+WSIZE*6, 0);                       /* alignment padding */
+  PUT(heap_listp+WSIZE*7, PACK(PROLOGUE, 1));       /* prologue header */
+  PUT(heap_listp+WSIZE*6+PROLOGUE, PACK(PROLOGUE, 1)); /* prologue footer */
+  PUT(heap_listp+WSIZE*7+PROLOGUE, PACK(0, 1));     /* epilogue header */
+  heap_listp += WSIZE*8;                            /* Reallocate heap_listp */
+  frontier = heap_end = NEXT_BLKP(heap_listp);      /* empty, at the epilogue */
+
+  /* Extend the empty heap with a free block of chunk_size bytes */
+  if ( (heap_start = extend_heap(chunk_size/WSIZE)) == NULL)
     return -1;
 
 #ifdef DEBUG
-  assert(root == heap_start);
+  assert(frontier == heap_start);
 #endif
 
   return 0;
 }
 
+/*
+ * mm_reserve - Grow the heap up front so that a free block of at least
+ *     bytes sits at its end, and with MM_RESERVE_PREFAULT fault in every
+ *     heap page now, so that neither extend_heap nor first-touch page
+ *     faults land on the requests that follow.  A free block already at
+ *     the end of the heap counts towards the reservation.
+ *     Return -1 on error, 0 on success.
+ */
+int mm_reserve(size_t bytes, int flags) {
+  size_t asize, have = 0;
+  char *ftr;
+
+  if (heap_listp == NULL && mm_init() < 0)
+    return -1;
+
+  asize = ALIGN(bytes + OVERHEAD);
+  ftr = (char *)mem_heap_hi() + 1 - DSIZE;   /* footer of the last block */
+  if (!GET_ALLOC(ftr))
+    have = GET_SIZE(ftr);
+  if (asize > have && extend_heap((asize - have)/WSIZE) == NULL)
+    return -1;
+
+  if (flags & MM_RESERVE_PREFAULT)
+    mem_prefault(mem_heap_lo(), mem_heapsize());
+  return 0;
+}
+
+/*
+ * mm_set_search_budget - Bound the latency of mm_malloc: find_fit gives
+ *     up after visiting nodes free blocks (0 removes the bound) and the
+ *     request is served by extending the heap instead, trading space
+ *     for a worst case that no longer grows with the free list.  The
+ *     budget stays in effect across mm_init.
+ */
+void mm_set_search_budget(unsigned nodes) {
+  fit_budget = nodes;
+}
+
+/*
+ * mm_set_map_cache - Let the cache of freed mappings hold up to bytes
+ *     (0 turns it off, so every large free unmaps at once)
+ */
+void mm_set_map_cache(size_t bytes) {
+  map_cache_max = bytes;
+  while (map_ncached > 0 && map_cached_bytes > map_cache_max)
+    map_evict(0);
+}
+
+/* The names mm_ctl knows, in the order of ctl_names */
+enum {
+  CTL_FIT_POLICY, CTL_FIT_BUDGET, CTL_HEAP_CHUNK, CTL_HEAP_MAX,
+  CTL_SPLIT_MIN, CTL_PLACE_SPLIT, CTL_MAP_THRESHOLD, CTL_MAP_CACHE,
+  CTL_DEBUG_VERBOSE,
+  CTL_MALLOCS, CTL_FREES, CTL_REALLOCS, CTL_LIVE_BYTES, CTL_HEAP_BYTES,
+  CTL_MAPPED_BYTES, CTL_SBRK_CALLS, CTL_FREE_BLOCKS, CTL_FREE_BYTES,
+  CTL_LARGEST_FREE, CTL_COUNT
+};
+static const char *ctl_names[CTL_COUNT] = {
+  "fit.policy", "fit.budget", "heap.chunk", "heap.max",
+  "split.min", "place.split", "map.threshold", "map.cache",
+  "debug.verbose",
+  "stats.mallocs", "stats.frees", "stats.reallocs", "stats.live_bytes",
+  "stats.heap_bytes", "stats.mapped_bytes", "stats.sbrk_calls",
+  "stats.free_blocks", "stats.free_bytes", "stats.largest_free"
+};
+
+/*
+ * mm_ctl - Read the tunable or statistic name into *oldval and, if
+ *     newval is not NULL, set the tunable to *newval.  Either pointer
+ *     may be NULL.  Returns -1, changing nothing, if name is unknown,
+ *     read-only (stats.*) and newval is given, or not kept by this
+ *     build (or, for the request counts, while nothing is published
+ *     through mm_shm), or if *newval is out of range.
+ */
+int mm_ctl(const char *name, size_t *oldval, const size_t *newval) {
+  size_t val = 0, set = newval != NULL ? *newval : 0;
+  mm_census_t census;
+  long maps, unmaps;
+  int i;
+
+  for (i = 0; i < CTL_COUNT && strcmp(name, ctl_names[i]) != 0; i++)
+    ;
+  switch (i) {
+  case CTL_FIT_POLICY:    val = fit_policy; break;
+  case CTL_FIT_BUDGET:    val = fit_budget; break;
+  case CTL_HEAP_CHUNK:    val = chunk_size; break;
+  case CTL_HEAP_MAX:      val = mem_limit(); break;
+  case CTL_SPLIT_MIN:     val = split_min; break;
+#ifdef HIGH_PLACE
+  case CTL_PLACE_SPLIT:   val = place_split; break;
+#endif
+  case CTL_MAP_THRESHOLD: val = map_threshold; break;
+  case CTL_MAP_CACHE:     val = map_cache_max; break;
+  case CTL_DEBUG_VERBOSE: val = check_verbose; break;
+#ifdef SHM_STATS
+  case CTL_MALLOCS:
+  case CTL_FREES:
+  case CTL_REALLOCS:
+    if (mm_shm == NULL)
+      return -1;  /* only counted while publishing */
+    val = i == CTL_MALLOCS ? stats.mallocs :
+          i == CTL_FREES ? stats.frees : stats.reallocs;
+    break;
+  case CTL_LIVE_BYTES:    val = stats.live_bytes; break;
+  case CTL_SBRK_CALLS:    val = stats.sbrk_calls; break;
+#endif
+  case CTL_HEAP_BYTES:    val = heap_listp != NULL ? mem_heapsize() : 0; break;
+  case CTL_MAPPED_BYTES:  mem_map_stats(&maps, &unmaps, &val); break;
+  case CTL_FREE_BLOCKS:
+  case CTL_FREE_BYTES:
+  case CTL_LARGEST_FREE:
+    mm_census(&census);
+    val = i == CTL_FREE_BLOCKS ? census.free_blocks :
+          i == CTL_FREE_BYTES ? census.free_bytes : census.largest_free;
+    break;
+  default:
+    return -1;  /* unknown, or not in this build */
+  }
+
+  if (newval != NULL) {
+    switch (i) {
+    case CTL_FIT_POLICY:
+      if (set != FIT_FIRST && set != FIT_BEST)
+        return -1;
+      fit_policy = (int)set;
+      break;
+    case CTL_FIT_BUDGET:
+      if (set > UINT_MAX)
+        return -1;
+      fit_budget = (unsigned)set;
+      break;
+    case CTL_HEAP_CHUNK:
+    case CTL_SPLIT_MIN:
+      /* Whole blocks: the remainder of a split must hold the links */
+      if (set < MINBLOCK || set != ALIGN(set) || set > mem_limit())
+        return -1;
+      *(i == CTL_HEAP_CHUNK ? &chunk_size : &split_min) = set;
+      break;
+    case CTL_HEAP_MAX:
+      if (set < mem_heapsize() || mem_set_limit(set) != 0)
+        return -1;
+      break;
+#ifdef HIGH_PLACE
+    case CTL_PLACE_SPLIT:
+      /* A block size: 0 places every block low, and blocks from
+         map_threshold up are never placed in the heap */
+      if (set != ALIGN(set) || set >= map_threshold)
+        return -1;
+      place_split = set;
+      break;
+#endif
+    case CTL_MAP_THRESHOLD:
+      if (set < mem_pagesize())
+        return -1;
+#ifdef HIGH_PLACE
+      if (set <= place_split)
+        return -1;
+#endif
+      map_threshold = set;
+      break;
+    case CTL_MAP_CACHE:
+      mm_set_map_cache(set);
+      break;
+    case CTL_DEBUG_VERBOSE:
+      if (set > 2)
+        return -1;
+      check_verbose = (int)set;
+      break;
+    default:
+      return -1;  /* statistics are read-only */
+    }
+  }
+  if (oldval != NULL)
+    *oldval = val;
+  return 0;
+}
+
+/*
+ * mm_ctl_name - The i'th name mm_ctl knows, or NULL past the last
+ */
+const char *mm_ctl_name(int i) {
+  return i >= 0 && i < CTL_COUNT ? ctl_names[i] : NULL;
+}
+
 /*
  * malloc - Allocate a block with at least size bytes of payload
  */
 void *mm_malloc(size_t size) {
   size_t asize;                              /* adjusted block size */
   size_t extendsize;                         /* amount to extend heap if no fit */
+  size_t carvesize;                          /* amount to take from the frontier */
   char *bp;
   if (heap_listp == NULL)
     mm_init();
@@ -134,20 +493,22 @@ void *mm_malloc(size_t size) {
   /* Ignore spurious requests */
   if (size <= 0)
     return NULL;
+  STAT(stats_op(&stats.mallocs));
+
+  if (size >= map_threshold)
+    return map_alloc(size);
 
   /* Adjust block size to include overhead and alignment reqs.
    *  Overhead is header and footer, 8 bytes
    *  Payload must be 16 bytes */
   if (size <= QSIZE)
-    asize = QSIZE + OVERHEAD;
-  else if (size <= 449 && size >= 448)  /* Special optimization for binary-bal */
-    asize = 512;
+    asize = MINBLOCK;
   else
-    asize = DSIZE * ((size + (OVERHEAD) + (DSIZE-1)) / DSIZE); /* Conform to alignment requirement */
+    asize = ALIGN(size + OVERHEAD);     /* Conform to alignment requirement */
 
   /* Search the free list for a fit */
   if ((bp = find_fit(asize)) != NULL) {
-    place(bp, asize);
+    bp = place(bp, asize);
 
 #ifdef DEBUG
   assert(in_heap(bp) == 1);
@@ -157,11 +518,24 @@ void *mm_malloc(size_t size) {
     return bp;
   }
 
-  /* No fit found. Get more memory and place the block */
-  extendsize = MAX(asize, CHUNKSIZE);
-  if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
-    return NULL;
-  place(bp, asize);
+  /* No fit found.  Bump the frontier, growing the heap if it is short.
+   * Under HIGH_PLACE a small block instead gets a slab carved from the
+   * frontier onto the list, and the small blocks that follow fill it
+   * from the top, apart from the large ones bumped after it. */
+  carvesize = asize;
+#ifdef HIGH_PLACE
+  if (asize < place_split)
+    carvesize = MAX(asize, SLABSIZE);
+#endif
+  if (frontier_size() < carvesize) {
+    extendsize = MAX(carvesize - frontier_size(), chunk_size);
+    if (extend_heap(extendsize/WSIZE) == NULL)
+      return NULL;
+  }
+  if (carvesize > asize)
+    bp = place(carve(carvesize), asize);
+  else
+    bp = bump(asize);
 
 #ifdef DEBUG
   assert(in_heap(bp) == 1);
@@ -176,10 +550,16 @@ void *mm_malloc(size_t size) {
  */
 void mm_free(void *ptr) {
   if (!ptr) return;                   /* Skip invalid input */
+  STAT(stats_op(&stats.frees));
+  if (IS_MAPPED(ptr)) {
+    map_free(ptr);
+    return;
+  }
 
   size_t size = GET_SIZE(HDRP(ptr));
   if (heap_listp == NULL)
     mm_init();
+  STAT(stats_live(size, -1));
 
   /* alloc = 0 for footers and headers */
   PUT(HDRP(ptr), PACK(size, 0));
@@ -203,23 +583,75 @@ void *mm_realloc(void *oldptr, size_t size) {
   /* If oldptr is NULL, then this is just malloc. */
   if (oldptr == NULL)
     return mm_malloc(size);
+  STAT(stats_op(&stats.reallocs));
+
+  /* Mapped blocks stay put while they are large and fit, otherwise move */
+  if (IS_MAPPED(oldptr)) {
+    oldsize = GET_SIZE(HDRP(oldptr)) - MAP_HDR;
+    if (size >= map_threshold && size <= oldsize)
+      return oldptr;
+    if ((newptr = mm_malloc(size)) == NULL)
+      return NULL;
+    oldsize = size < oldsize ? size : oldsize;
+    mm_bulk_copy(SIM(newptr, oldsize), SIM(oldptr, oldsize), oldsize);
+    map_free(oldptr);
+    return newptr;
+  }
 
   /* Compute minimum size required */
-  rsize = size <= QSIZE ? QSIZE : ALIGN(size);
+  rsize = (size <= QSIZE ? MINBLOCK : ALIGN(size + OVERHEAD)) - OVERHEAD;
   oldsize = GET_SIZE(HDRP(oldptr)) - OVERHEAD;
 
   /* Case 1: Nothing remaining */
   if (rsize <= oldsize)
     return oldptr;
 
-  /* Case 2: Need more space, and Next is free */
+  /* Case 2: Need more space, and Next is the frontier: bump it over,
+   * growing the heap if it is short */
+  if (NEXT_BLKP(oldptr) == frontier) {
+    if (frontier_size() < rsize - oldsize &&
+        extend_heap(MAX(rsize - oldsize - frontier_size(), chunk_size)/WSIZE) == NULL)
+      return NULL;
+
+    asize = rsize + OVERHEAD;
+    STAT(stats_live(oldsize + OVERHEAD, -1));
+    STAT(stats_live(asize, 1));
+    PUT(FTRP(oldptr), 0);                // Delete footer
+    PUT(HDRP(oldptr), PACK(asize, 1));   // New header
+    PUT(FTRP(oldptr), PACK(asize, 1));   // New footer
+    set_frontier(NEXT_BLKP(oldptr));
+
+    return oldptr;
+  }
+
+  /* Case 3: Need more space, and Next is free */
   nextsize = GET_SIZE(HDRP(NEXT_BLKP(oldptr)));
   if ( !GET_ALLOC(HDRP(NEXT_BLKP(oldptr))) &&  nextsize >= rsize-oldsize) {
 
     nextptr = NEXT_BLKP(oldptr);
     mm_unlink(nextptr);
+    STAT(stats_live(oldsize + OVERHEAD, -1));
+
+#ifdef HIGH_PLACE
+    /* A block that stays small moves to the top of the space, as place
+     * would put it, and what is left below is freed (joining a free
+     * block before it) */
+    asize = rsize + OVERHEAD;
+    if (asize < place_split && nextsize >= rsize - oldsize + split_min) {
+      nextsize += oldsize + OVERHEAD;           /* the whole space */
+      newptr = (char *)oldptr + nextsize - asize;
+      memmove(SIM((char *)newptr, oldsize), SIM((char *)oldptr, oldsize), oldsize);
+      PUT(HDRP(newptr), PACK(asize, 1));
+      PUT(FTRP(newptr), PACK(asize, 1));
+      STAT(stats_live(asize, 1));
+      PUT(HDRP(oldptr), PACK(nextsize - asize, 0));
+      PUT(FTRP(oldptr), PACK(nextsize - asize, 0));
+      coalesce(oldptr);
+      return newptr;
+    }
+#endif
 
-    if (nextsize >= rsize - oldsize + QSIZE + OVERHEAD) {
+    if (nextsize >= rsize - oldsize + split_min) {
       /* Remaining space can form a block */
       asize = rsize + OVERHEAD;
 
@@ -230,34 +662,31 @@ void *mm_realloc(void *oldptr, size_t size) {
       nextptr = NEXT_BLKP(oldptr);  // Get new next block
       PUT(HDRP(nextptr), PACK(nextsize-rsize+oldsize, 0));
       PUT(FTRP(nextptr), PACK(nextsize-rsize+oldsize, 0));
-
-      NEXT(nextptr) = root;
-      PREV(nextptr) = NULL;
-      PREV(root) = nextptr;
-      root = nextptr;
+      mm_insert(nextptr);
 
     } else {
       /* Remaining space cannot form a block */
-      asize = oldsize + nextsize;
+      asize = oldsize + OVERHEAD + nextsize;
       /* update block infomation */
       PUT(FTRP(oldptr), 0);
       PUT(HDRP(oldptr), PACK(asize, 1));
       PUT(FTRP(oldptr), PACK(asize, 1));
     }
+    STAT(stats_live(asize, 1));
 
     return oldptr;
   }
 
-  /* Case 3: Need more space, but Next is full */
+  /* Case 4: Need more space, but Next is full */
   newptr = mm_malloc(size);
 
   /* If realloc() fails the original block is left untouched  */
   if (!newptr)
     return 0;
 
-  /* Copy the old data. */
+  /* Copy the old data, streaming it if there is a lot (mm_bulk) */
   if (size < oldsize) oldsize = size;
-  memcpy(newptr, oldptr, oldsize);
+  mm_bulk_copy(SIM(newptr, oldsize), SIM(oldptr, oldsize), oldsize);
 
   /* Free the old block. */
   mm_free(oldptr);
@@ -281,7 +710,8 @@ void *mm_calloc(size_t nmemb, size_t size) {
     mm_init();
 
   ptr = mm_malloc(nmemb*size);
-  bzero(ptr, nmemb*size);
+  if (ptr != NULL)
+    mm_bulk_zero(SIM(ptr, nmemb*size), nmemb*size);
 
 #ifdef DEBUG
   assert(in_heap(ptr) == 1);
@@ -291,97 +721,327 @@ void *mm_calloc(size_t nmemb, size_t size) {
   return ptr;
 }
 
+/*
+ * mm_defrag_hint - Would moving ptr put it in a denser part of the heap?
+ *     True when the region ptr starts in is sparse (under REGION_SPARSE
+ *     percent live) and dense_fit finds a free block for it in a region
+ *     with more live bytes (or as many, further down the heap, so that
+ *     evenly sparse regions drain towards the bottom).  Mapped blocks
+ *     stay where they are.  Every call walks the heap to count the
+ *     live bytes, so to move many objects call mm_defrag, which walks
+ *     it once.
+ */
+int mm_defrag_hint(void *ptr) {
+#ifdef DEFRAG_HINT
+  if (ptr == NULL || heap_listp == NULL || IS_MAPPED(ptr))
+    return 0;
+  occupancy();
+  return dense_fit(ptr) != NULL;
+#else
+  return 0;
+#endif
+}
+
+/*
+ * mm_defrag - Move every object of objs[0..n) that mm_defrag_hint picks
+ *     into the free block it found, copying its whole payload.  fixup
+ *     (if not NULL) is called with the old and the new address before
+ *     the old block is freed, so the client can mend its pointers to
+ *     it; objs[i] is updated here.  Returns the number of objects moved.
+ */
+size_t mm_defrag(void **objs, size_t n, mm_fixup_t fixup, void *arg) {
+  size_t moved = 0;
+#ifdef DEFRAG_HINT
+  size_t i, size;
+  char *bp;
+
+  if (heap_listp == NULL)
+    return 0;
+  occupancy();
+  for (i = 0; i < n; i++) {
+    if (objs[i] == NULL || IS_MAPPED(objs[i]) || (bp = dense_fit(objs[i])) == NULL)
+      continue;
+    size = GET_SIZE(HDRP(objs[i]));
+    bp = place(bp, size);
+    occupy(bp, GET_SIZE(HDRP(bp)), 1);
+    occupy(objs[i], size, -1);
+    memcpy(SIM(bp, size - OVERHEAD), SIM(objs[i], size - OVERHEAD), size - OVERHEAD);
+    if (fixup != NULL)
+      fixup(objs[i], bp, arg);
+    mm_free(objs[i]);
+    objs[i] = bp;
+    moved++;
+  }
+#endif
+  return moved;
+}
+
+/*
+ * mm_census - Count the free blocks and find the largest by walking
+ *     the free list up to its sentinel; the frontier counts as one
+ *     more.  Mapped blocks are not part of the heap and are left out.
+ */
+int mm_census(mm_census_t *census) {
+  char *bp;
+  size_t size;
+
+  memset(census, 0, sizeof(*census));
+  if (heap_listp == NULL)
+    return 0;
+  for (bp = root; (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT(bp)) {
+    census->free_blocks++;
+    census->free_bytes += size;
+    census->largest_free = MAX(census->largest_free, size);
+  }
+  if ((size = frontier_size()) > 0) {
+    census->free_blocks++;
+    census->free_bytes += size;
+    census->largest_free = MAX(census->largest_free, size);
+  }
+  return 0;
+}
+
+/*
+ * mm_save - Save the globals that describe the heap.  Mappings live
+ *     outside the heap and are not saved with it, so there must be
+ *     none, not even cached ones.
+ */
+long mm_save(void *buf, size_t len) {
+  mm_state_t *state = buf;
+
+  if (map_ncached > 0)
+    return -1;
+  if (len < sizeof(mm_state_t))
+    return sizeof(mm_state_t);
+  state->heap_listp = heap_listp;
+  state->root = root;
+  state->frontier = frontier;
+  state->heap_end = heap_end;
+  STAT(state->stats = stats);
+  return sizeof(mm_state_t);
+}
+
+/*
+ * mm_restore - Put back globals saved by mm_save, the heap they
+ *     describe being already in place
+ */
+int mm_restore(const void *buf, size_t len) {
+  const mm_state_t *state = buf;
+
+  if (len != sizeof(mm_state_t) || state->heap_listp <= (char *)mem_heap_lo() ||
+      state->heap_end != (char *)mem_heap_hi() + 1)
+    return -1;
+  while (map_ncached > 0) {
+    if (mem_is_mapped(map_cache[0].lo, map_cache[0].lo))
+      mem_unmap(map_cache[0].lo);
+    map_cache[0] = map_cache[--map_ncached];
+  }
+  map_cached_bytes = 0;
+  heap_listp = state->heap_listp;
+  root = state->root;
+  frontier = state->frontier;
+  heap_end = state->heap_end;
+  STAT(stats = state->stats);
+  STAT(stats_stale = 1);
+  return 0;
+}
+
 /* $begin helper functions */
 
 /*
- * extend_heap - Extend heap with free block and return its block pointer (from textbook)
+ * extend_heap - Extend heap by a free block, which joins the frontier,
+ *     and return the frontier (from textbook)
  */
 static void *extend_heap(size_t words)
 {
   char *bp;
   size_t size;
-  void *return_ptr;
+#ifdef SHM_STATS
+  double start = mm_shm != NULL ? mm_shm_now() : 0;
+#endif
 
-  /* Allocate an even number of words to maintain alignment */
-  size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+  /* Allocate whole ALIGNMENT units to maintain alignment */
+  size = ALIGN(words * WSIZE);
   if ((long)(bp = mem_sbrk(size)) < 0)
     return NULL;
+  STAT(stats.sbrk_calls++);
+  STAT(stats_slow(start));
 
-  /* Initialize free block header/footer and the epilogue header */
-  PUT(HDRP(bp), PACK(size, 0));           /* free block header */
-  PUT(FTRP(bp), PACK(size, 0));           /* free block footer */
-  PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));   /* new epilogue header */
-
-  /* Coalesce if the previous block was free */
-  return_ptr = coalesce(bp);
+  /* The new epilogue header, and the frontier (at the old epilogue if
+   * it was empty) now reaches it */
+  heap_end = bp + size;
+  PUT(heap_end - WSIZE, PACK(0, 1));
+  set_frontier(frontier);
 
 #ifdef DEBUG
   mm_checkheap(0);
 #endif
+  if (check_verbose > 0)
+    mm_checkheap(check_verbose - 1);
 
-  return return_ptr;
+  return frontier;
 }
 
 /*
- * find_fit - Find a fit for a block with asize bytes
+ * find_fit - Find a fit for a block with asize bytes, looking at no
+ *     more than fit_budget free blocks unless fit_budget is 0.  The
+ *     walk stops at the zero-size sentinel, which is not counted.
  */
 static void *find_fit(size_t asize)
 {
-#ifdef FIRST_FIT
-  /* first fit search */
-  void *bp;
-
-  for (bp = root; bp != NULL; bp = NEXT(bp))
-    if ( asize <= GET_SIZE(HDRP(bp)) )
-      return bp;
-
-  return NULL; /* no fit */
-#endif
-
-#ifdef BEST_FIT
-  /* best fit search */
   void *bp, *min_bp=NULL;
   unsigned min_d = UINT_MAX;
+  unsigned left = fit_budget;
+
+  if (fit_policy == FIT_FIRST) {
+    /* first fit search */
+    for (bp = root; GET_SIZE(HDRP(bp)) > 0; bp = NEXT(bp)) {
+      if ( asize <= GET_SIZE(HDRP(bp)) )
+        return bp;
+      if (fit_budget && --left == 0)
+        break;
+    }
+    return NULL; /* no fit */
+  }
 
-  for (bp = root; bp != NULL; bp = NEXT(bp))
-    if ( asize <= GET_SIZE(HDRP(bp)) && GET_SIZE(HDRP(bp)) < min_d )
+  /* best fit search: once the budget is spent, settle for the best fit
+   * seen so far */
+  for (bp = root; GET_SIZE(HDRP(bp)) > 0; bp = NEXT(bp)) {
+    if ( asize <= GET_SIZE(HDRP(bp)) && GET_SIZE(HDRP(bp)) < min_d ) {
       min_bp = bp;
+      if ((min_d = GET_SIZE(HDRP(bp))) == asize)
+        break;                      /* exact: nothing fits better */
+    }
+    if (fit_budget && --left == 0)
+      break;
+  }
   return min_bp;
-#endif
-
 }
 
 /*
- * place - Place block of asize bytes at start of free block bp
- *         and split if remainder would be at least minimum block size
+ * place - Place block of asize bytes in free block bp and split if
+ *         remainder would be at least minimum block size.  Return the
+ *         placed block, which starts at bp unless HIGH_PLACE carved it
+ *         from the high end.
  */
-static void place(void *bp, size_t asize)
+static void *place(void *bp, size_t asize)
 {
   size_t csize = GET_SIZE(HDRP(bp));
 
-  if ((csize - asize) >= (QSIZE + OVERHEAD)) {
+  if ((csize - asize) >= split_min) {
+#ifdef HIGH_PLACE
+    /* Small block: take the top of bp, which stays free (and where it
+     * is in the list) below it */
+    if (asize < place_split) {
+      STAT(stats_free(csize, -1));
+      STAT(stats_free(csize-asize, 1));
+      PUT(HDRP(bp), PACK(csize-asize, 0));
+      PUT(FTRP(bp), PACK(csize-asize, 0));
+
+      bp = NEXT_BLKP(bp);
+      PUT(HDRP(bp), PACK(asize, 1));
+      PUT(FTRP(bp), PACK(asize, 1));
+      STAT(stats_live(asize, 1));
+      return bp;
+    }
+#endif
     /* Allocate Memory */
+    mm_unlink(bp);
     PUT(HDRP(bp), PACK(asize, 1));
     PUT(FTRP(bp), PACK(asize, 1));
-    mm_unlink(bp);
-
-    bp = NEXT_BLKP(bp);
-    PUT(HDRP(bp), PACK(csize-asize, 0));
-    PUT(FTRP(bp), PACK(csize-asize, 0));
 
     /* Push remaining into linkedlist */
-    NEXT(bp) = root;
-    PREV(bp) = NULL;
-    PREV(root) = bp;
-    root = bp;
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(csize-asize, 0));
+    PUT(FTRP(NEXT_BLKP(bp)), PACK(csize-asize, 0));
+    mm_insert(NEXT_BLKP(bp));
   }
   else {
+    mm_unlink(bp);
     PUT(HDRP(bp), PACK(csize, 1));
     PUT(FTRP(bp), PACK(csize, 1));
-    mm_unlink(bp);
   }
+  STAT(stats_live(GET_SIZE(HDRP(bp)), 1));
+  return bp;
 }
 
+#ifdef DEFRAG_HINT
+/*
+ * place_at - Where place(bp, asize) would put the block
+ */
+static void *place_at(void *bp, size_t asize)
+{
+#ifdef HIGH_PLACE
+  size_t csize = GET_SIZE(HDRP(bp));
+
+  if (csize - asize >= split_min && asize < place_split)
+    return (char *)bp + csize - asize;
+#endif
+  return bp;
+}
+
+/*
+ * dense_fit - A free block, among the first DEFRAG_SEARCH of the list,
+ *     that would take block ptr into the densest region better than its
+ *     own (see mm_defrag_hint), or NULL if ptr sits in a dense region
+ *     or none is better
+ */
+static void *dense_fit(void *ptr)
+{
+  size_t asize = GET_SIZE(HDRP(ptr)), src = REGION(HDRP(ptr)), r;
+  unsigned left = DEFRAG_SEARCH, best_live, live;
+  void *bp, *best = NULL;
+
+  if (src >= REGIONS ||
+      SIDE(region_live[src]) >= ((1 << REGION_SHIFT) / 100) * REGION_SPARSE)
+    return NULL;
+
+  best_live = SIDE(region_live[src]);
+  for (bp = root; bp != NULL && left-- > 0; bp = NEXT(bp)) {
+    if (GET_SIZE(HDRP(bp)) < asize)
+      continue;
+    r = REGION(HDRP(place_at(bp, asize)));
+    if (r == src || r >= REGIONS)
+      continue;
+    live = SIDE(region_live[r]);
+    if (live > best_live || (live == best_live && best == NULL && r < src)) {
+      best = bp;
+      best_live = live;
+    }
+  }
+  return best;
+}
+
+/*
+ * occupancy - Count the live bytes of every region afresh
+ */
+static void occupancy(void)
+{
+  char *bp;
+
+  memset(SIM(&region_live[0], sizeof(region_live)), 0, sizeof(region_live));
+  for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    if (GET_ALLOC(HDRP(bp)))
+      occupy(bp, GET_SIZE(HDRP(bp)), 1);
+}
+
+/*
+ * occupy - Count n (+1 or -1) times the size bytes of the block at bp
+ *     in the regions they cover
+ */
+static void occupy(void *bp, size_t size, int n)
+{
+  char *lo = HDRP(bp), *hi = lo + size, *end;
+  size_t r = REGION(lo);
+
+  for (; lo < hi && r < REGIONS; lo = end, r++) {
+    end = (char *)mem_heap_lo() + ((r + 1) << REGION_SHIFT);
+    if (end > hi)
+      end = hi;
+    SIDE(region_live[r]) += n * (int)(end - lo);
+  }
+}
+#endif
+
 /*
  * coalesce - boundary tag coalescing. Return ptr to coalesced block
  */
@@ -392,6 +1052,17 @@ static void *coalesce(void *bp)
   size_t size = GET_SIZE(HDRP(bp));
   void *thisHead = NULL;                       /* Keep a copy of pointer of this block */
 
+  /* A block before the frontier joins it (with a free block before it),
+   * so the last block before the frontier is always allocated */
+  if (NEXT_BLKP(bp) == frontier) {
+    if (!prev_alloc) {
+      bp = PREV_BLKP(bp);
+      mm_unlink(bp);
+    }
+    set_frontier(bp);
+    return bp;
+  }
+
   if (prev_alloc && next_alloc) {
     /* Case 1:
      *  Front and End is not empty
@@ -429,22 +1100,138 @@ static void *coalesce(void *bp)
   }
 
   /* block to doubly free linklist */
-  NEXT(thisHead) = root;
+  mm_insert(thisHead);
 
 #ifdef DEBUG
-  assert(root != NULL);
+  assert(in_heap(thisHead) == 1);
+  assert(aligned(thisHead) == 1);
+#endif
+
+  return thisHead;
+}
+
+/*
+ * map_alloc - Serve a large request from a cached mapping of its size
+ *     class, or from a new one.  The block pointer sits MAP_HDR into the
+ *     mapping, behind a header holding the mapping length and MAPPED.
+ */
+static void *map_alloc(size_t size)
+{
+  size_t len = map_round(size + MAP_HDR);
+  char *lo = NULL;
+  int i, fit = -1;
+#ifdef SHM_STATS
+  double start = mm_shm != NULL ? mm_shm_now() : 0;
+#endif
+
+  if (len > UINT_MAX - 7)          /* would not fit in a header */
+    return NULL;
+
+  /* Smallest cached mapping of the class */
+  map_clock++;
+  for (i = 0; i < map_ncached; i++)
+    if (map_cache[i].len >= len && map_cache[i].len - len <= len / 4 &&
+        (fit < 0 || map_cache[i].len < map_cache[fit].len))
+      fit = i;
+  if (fit >= 0) {
+    lo = map_cache[fit].lo;
+    len = map_cache[fit].len;
+    map_cached_bytes -= len;
+    map_cache[fit] = map_cache[--map_ncached];
+    STAT(stats.map_hits++);
+  }
+  map_decay();
+
+  if (lo == NULL && (lo = mem_map(len)) == NULL)
+    return NULL;
+  PUT(HDRP(lo + MAP_HDR), PACK(len, MAPPED|1));
+  STAT(stats_live(len, 1));
+  STAT(stats_slow(start));
+  return lo + MAP_HDR;
+}
+
+/*
+ * map_free - Keep the mapping of bp in the cache, making room by
+ *     evicting the oldest ones, or unmap it if the cache is too small
+ */
+static void map_free(void *bp)
+{
+  char *lo = (char *)bp - MAP_HDR;
+  size_t len = GET_SIZE(HDRP(bp));
+  int i, old;
+#ifdef SHM_STATS
+  double start = mm_shm != NULL ? mm_shm_now() : 0;
 #endif
 
-  PREV(thisHead) = NULL;
-  PREV(root) = thisHead;
-  root = thisHead;
+  STAT(stats_live(len, -1));
+  map_clock++;
+  map_decay();
+  if (len > map_cache_max) {
+    mem_unmap(lo);
+    STAT(stats_slow(start));
+    return;
+  }
+  while (map_ncached == MAP_SLOTS || map_cached_bytes + len > map_cache_max) {
+    for (old = 0, i = 1; i < map_ncached; i++)
+      if (map_cache[i].stamp < map_cache[old].stamp)
+        old = i;
+    map_evict(old);
+  }
+  map_cache[map_ncached].lo = lo;
+  map_cache[map_ncached].len = len;
+  map_cache[map_ncached].stamp = map_clock;
+  map_ncached++;
+  map_cached_bytes += len;
+  STAT(stats_slow(start));
+}
+
+/*
+ * map_round - Mapping length for size bytes: whole pages
+ */
+static size_t map_round(size_t size)
+{
+  size_t page = mem_pagesize();
+
+  return (size + page - 1) & ~(page - 1);
+}
+
+/*
+ * map_evict - Unmap cached mapping i
+ */
+static void map_evict(int i)
+{
+  mem_unmap(map_cache[i].lo);
+  map_cached_bytes -= map_cache[i].len;
+  map_cache[i] = map_cache[--map_ncached];
+}
+
+/*
+ * map_decay - Unmap the cached mappings nobody reused for MAP_DECAY
+ *     large requests
+ */
+static void map_decay(void)
+{
+  int i;
 
+  for (i = map_ncached - 1; i >= 0; i--)
+    if (map_clock - map_cache[i].stamp > MAP_DECAY)
+      map_evict(i);
+}
+
+/*
+ * mm_insert - push a free block on the front of the linklist
+ */
+static inline void mm_insert(void *bp)
+{
 #ifdef DEBUG
-  assert(in_heap(thisHead) == 1);
-  assert(aligned(thisHead) == 1);
+  assert(root != NULL);
 #endif
 
-  return thisHead;
+  NEXT(bp) = root;
+  PREV(bp) = NULL;
+  PREV(root) = bp;
+  root = bp;
+  STAT(stats_free(GET_SIZE(HDRP(bp)), 1));
 }
 
 /*
@@ -459,6 +1246,193 @@ static inline void mm_unlink(void *bp)
 
   if ( NEXT(bp) )
     PREV(NEXT(bp)) = PREV(bp);
+  STAT(stats_free(GET_SIZE(HDRP(bp)), -1));
+}
+
+/*
+ * frontier_size - Bytes left in the bump region
+ */
+static inline size_t frontier_size(void)
+{
+  return heap_end - frontier;
+}
+
+/*
+ * set_frontier - Make the bump region run from bp to the end of the
+ *     heap, and tag it as a free block so that heap walks and the
+ *     boundary tags of its neighbour stay consistent
+ */
+static void set_frontier(char *bp)
+{
+  size_t size = heap_end - bp;
+
+  frontier = bp;
+  if (size > 0) {
+    PUT(HDRP(bp), PACK(size, 0));
+    PUT(FTRP(bp), PACK(size, 0));
+  }
+}
+
+/*
+ * bump - Allocate asize bytes from the front of the frontier, which
+ *     must hold them.  Whatever is left stays the frontier, however
+ *     small: it is not on the list, so it needs no room for links.
+ */
+static void *bump(size_t asize)
+{
+  char *bp = frontier;
+
+  PUT(HDRP(bp), PACK(asize, 1));
+  PUT(FTRP(bp), PACK(asize, 1));
+  set_frontier(bp + asize);
+  STAT(stats_live(asize, 1));
+  return bp;
+}
+
+/*
+ * carve - Move the first size bytes of the frontier, which must hold
+ *     them, onto the free list as a block of its own.  The caller
+ *     places an allocated block at its top right away, so the block
+ *     before the frontier stays allocated.
+ */
+static void *carve(size_t size)
+{
+  char *bp = frontier;
+
+  PUT(HDRP(bp), PACK(size, 0));
+  PUT(FTRP(bp), PACK(size, 0));
+  set_frontier(bp + size);
+  mm_insert(bp);
+  return bp;
+}
+
+#ifdef SHM_STATS
+/*
+ * stats_op - Count one request, and publish every MM_SHM_PERIOD.
+ *     Nothing is counted while there is no block to publish to.
+ */
+static inline void stats_op(long *counter)
+{
+  if (mm_shm == NULL)
+    return;
+  (*counter)++;
+  if (++stats_ops % MM_SHM_PERIOD == 0)
+    stats_publish();
+}
+
+/*
+ * stats_live - Count n (+1 or -1) allocated blocks of size bytes
+ */
+static inline void stats_live(size_t size, int n)
+{
+  stats.live_bytes += n * (long)size;
+  stats.live_blocks[mm_shm_class(size)] += n;
+}
+
+/*
+ * stats_free - Count n (+1 or -1) free blocks of size bytes on the
+ *     list.  largest_free only grows here; when a block of its size
+ *     leaves, stats_heap finds it again from the list.
+ */
+static inline void stats_free(size_t size, int n)
+{
+  stats.free_bytes += n * (long)size;
+  stats.free_blocks[mm_shm_class(size)] += n;
+  if (n > 0 && size >= stats.largest_free) {
+    stats.largest_free = size;
+    stats_stale = 0;
+  } else if (n < 0 && size == stats.largest_free)
+    stats_stale = 1;
+}
+
+/*
+ * stats_slow - Record the latency of a slow path that began at start,
+ *     and publish
+ */
+static void stats_slow(double start)
+{
+  if (mm_shm == NULL)
+    return;
+  stats.slow_ns[mm_shm_bucket((mm_shm_now() - start) * 1e9)]++;
+  stats_publish();
+}
+
+/*
+ * stats_heap - The counters, with the heap and mapping sizes and the
+ *     frontier counted as a free block.  Only when the largest free
+ *     block has left the list is the list walked for the new one.
+ */
+static void stats_heap(mm_heap_stats_t *s)
+{
+  char *bp;
+  size_t size;
+
+  if (stats_stale && heap_listp != NULL) {
+    stats.largest_free = 0;
+    for (bp = root; (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT(bp))
+      stats.largest_free = MAX(stats.largest_free, size);
+    stats_stale = 0;
+  }
+  *s = stats;
+  s->heap_bytes = mem_heapsize();
+  mem_map_stats(&s->map_calls, &s->unmap_calls, &s->mapped_bytes);
+  if (heap_listp != NULL && (size = frontier_size()) > 0) {
+    s->free_bytes += size;
+    s->free_blocks[mm_shm_class(size)]++;
+    s->largest_free = MAX(s->largest_free, size);
+  }
+}
+
+/*
+ * stats_publish - Copy the counters into the shared block
+ */
+static void stats_publish(void)
+{
+  mm_heap_stats_t s;
+
+  stats_heap(&s);
+  mm_shm_begin();
+  mm_shm->heap = s;
+  mm_shm_end();
+}
+#endif
+
+/*
+ * conf_apply - Set the tunables named in conf, a string such as
+ *     "fit.policy=best,heap.chunk=4k".  Values are numbers (with an
+ *     optional k, m or g), or first and best for fit.policy.  Entries
+ *     mm_ctl refuses are reported and skipped.
+ */
+static void conf_apply(const char *conf)
+{
+  char *copy, *tok, *save, *eq, *end;
+  size_t val;
+
+  if (conf == NULL || (copy = strdup(conf)) == NULL)
+    return;
+  for (tok = strtok_r(copy, ",", &save); tok != NULL;
+       tok = strtok_r(NULL, ",", &save)) {
+    if ((eq = strchr(tok, '=')) == NULL) {
+      fprintf(stderr, "mm: ignoring %s in %s\n", tok, CONF_ENV);
+      continue;
+    }
+    *eq++ = '\0';
+    if (strcmp(eq, "first") == 0)
+      val = FIT_FIRST, end = eq + 5;
+    else if (strcmp(eq, "best") == 0)
+      val = FIT_BEST, end = eq + 4;
+    else {
+      val = strtoul(eq, &end, 0);
+      switch (*end) {
+      case 'g': case 'G': val <<= 10;  /* fall through */
+      case 'm': case 'M': val <<= 10;  /* fall through */
+      case 'k': case 'K': val <<= 10; end++;
+      }
+    }
+    if (end == eq || *end != '\0' || mm_ctl(tok, NULL, &val) != 0)
+      fprintf(stderr, "mm: ignoring %s=%s in %s\n", tok, eq, CONF_ENV);
+  }
+  free(copy);
 }
 
 /* $end helper functions */
@@ -478,7 +1452,7 @@ static inline void mm_unlink(void *bp)
    if (verbose)
      printf("Heap (%p):\n", heap_listp);
 
-   if ((GET_SIZE(HDRP(heap_listp)) != OVERHEAD) || !GET_ALLOC(HDRP(heap_listp)))
+   if ((GET_SIZE(HDRP(heap_listp)) != PROLOGUE) || !GET_ALLOC(HDRP(heap_listp)))
      printf("Bad prologue header %d\n", GET_SIZE(HDRP(heap_listp)) );
    checkblock(heap_listp);
 
@@ -492,6 +1466,19 @@ static inline void mm_unlink(void *bp)
      printblock(bp);
    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
      printf("Bad epilogue header\n");
+
+   /* The frontier runs to the epilogue, behind an allocated block, and
+    * is not on the free list */
+   if (frontier != bp && (GET_ALLOC(HDRP(frontier)) ||
+                          NEXT_BLKP(frontier) != bp))
+     printf("Error: frontier %p is not the free block ending the heap\n",
+            frontier);
+   for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+     if (!GET_ALLOC(HDRP(bp)) && NEXT_BLKP(bp) == frontier && bp != frontier)
+       printf("Error: free block %p before the frontier\n", bp);
+   for (bp = root; bp != NULL; bp = NEXT(bp))
+     if (bp == frontier)
+       printf("Error: frontier on the free list\n");
  }
 
 #ifdef DEBUG
@@ -532,8 +1519,8 @@ static void printblock(void *bp)
 
 static void checkblock(void *bp)
 {
-  if ((size_t)bp % 8)
-    printf("Error: %p is not doubleword aligned\n", bp);
+  if ((size_t)bp % ALIGNMENT)
+    printf("Error: %p is not %d-byte aligned\n", bp, ALIGNMENT);
   if (GET(HDRP(bp)) != GET(FTRP(bp)))
     printf("Error: header does not match footer\n");
 }
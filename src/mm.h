@@ -6,6 +6,47 @@ extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
 extern int mm_init(void);
 
+/* Flags for mm_reserve */
+#define MM_RESERVE_PREFAULT 0x1  /* fault in the heap pages now */
+#define MM_RESERVE_CARVE    0x2  /* also fill the size class lists (mm_mt) */
+extern int mm_reserve(size_t bytes, int flags);
+
+/* Cap on free blocks searched per allocation (0 = no cap) */
+extern void mm_set_search_budget(unsigned nodes);
+
+/* Bytes of freed large mappings kept for reuse (0 = unmap at once) */
+extern void mm_set_map_cache(size_t bytes);
+
+/* Runtime tunables and statistics by name ("fit.policy", "heap.chunk",
+   "stats.live_bytes", ...): mm_ctl reads one into *oldval and, if newval
+   is not NULL, sets it, returning -1 if it cannot; mm_ctl_name lists
+   the names (NULL past the last).  mm_init also applies the string in
+   the MM_CONF environment variable, e.g. "fit.policy=best,heap.chunk=4k" */
+extern int mm_ctl(const char *name, size_t *oldval, const size_t *newval);
+extern const char *mm_ctl_name(int i);
+
+/* Cooperative defragmentation: mm_defrag_hint tells whether moving ptr
+   would put it in a denser part of the heap, and mm_defrag moves those
+   of objs[0..n) that would, telling fixup of each move */
+typedef void (*mm_fixup_t)(void *oldptr, void *newptr, void *arg);
+extern int mm_defrag_hint(void *ptr);
+extern size_t mm_defrag(void **objs, size_t n, mm_fixup_t fixup, void *arg);
+
+/* The free space of the heap, for the driver's timeline */
+typedef struct {
+  size_t free_blocks;   /* free blocks in the heap */
+  size_t free_bytes;    /* bytes in them */
+  size_t largest_free;  /* bytes in the largest of them */
+} mm_census_t;
+extern int mm_census(mm_census_t *census);  /* -1 if mm cannot tell */
+
+/* Checkpoints: mm_save copies mm's globals (the heap itself is the
+   caller's to save) into buf if len bytes hold them, and returns how
+   many bytes they take, or -1 if they cannot be saved; mm_restore puts
+   saved globals back over a heap restored to the same address */
+extern long mm_save(void *buf, size_t len);
+extern int mm_restore(const void *buf, size_t len);
+
 /* This is largely for debugging.  You can do what you want with the
    verbose flag; we don't care. */
 extern void mm_checkheap(int verbose);
@@ -0,0 +1,175 @@
+/*
+ * mm_bulk.c - non-temporal copy and zero kernels (see mm_bulk.h)
+ *
+ * Each kernel writes the unaligned head of the destination with memcpy
+ * or memset, streams whole vectors to the aligned middle, and finishes
+ * the tail the ordinary way.  Streaming stores are weakly ordered, so
+ * the kernels end with an sfence: the block is complete, as seen from
+ * any thread, when they return.
+ */
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+# include <immintrin.h>
+# define HAVE_NT_STORES
+#endif
+
+#include "mm_bulk.h"
+
+static size_t bulk_cutoff = MM_BULK_CUTOFF;
+
+/* The kernels the first call picked */
+static void (*copy_kernel)(char *dst, const char *src, size_t n);
+static void (*zero_kernel)(char *dst, size_t n);
+static const char *kernel_name;
+
+static void bulk_init(void);
+
+/*
+ * mm_bulk_copy - memcpy, streaming when n reaches the cutoff
+ */
+void mm_bulk_copy(void *dst, const void *src, size_t n)
+{
+  if (kernel_name == NULL)
+    bulk_init();
+  if (bulk_cutoff == 0 || n < bulk_cutoff || copy_kernel == NULL)
+    memcpy(dst, src, n);
+  else
+    copy_kernel(dst, src, n);
+}
+
+/*
+ * mm_bulk_zero - memset to 0, streaming when n reaches the cutoff
+ */
+void mm_bulk_zero(void *dst, size_t n)
+{
+  if (kernel_name == NULL)
+    bulk_init();
+  if (bulk_cutoff == 0 || n < bulk_cutoff || zero_kernel == NULL)
+    memset(dst, 0, n);
+  else
+    zero_kernel(dst, n);
+}
+
+void mm_bulk_set_cutoff(size_t bytes)
+{
+  bulk_cutoff = bytes;
+}
+
+const char *mm_bulk_kernel(void)
+{
+  if (kernel_name == NULL)
+    bulk_init();
+  return kernel_name;
+}
+
+/* $begin kernels */
+#ifdef HAVE_NT_STORES
+/*
+ * copy_sse2, zero_sse2 - 16-byte streaming stores (every x86-64 CPU)
+ */
+static void copy_sse2(char *dst, const char *src, size_t n)
+{
+  size_t head = -(size_t)dst & 15;
+
+  if (head > n)
+    head = n;
+  memcpy(dst, src, head);
+  dst += head, src += head, n -= head;
+  for (; n >= 64; dst += 64, src += 64, n -= 64) {
+    __m128i a = _mm_loadu_si128((const __m128i *)src);
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+    __m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+    _mm_stream_si128((__m128i *)dst, a);
+    _mm_stream_si128((__m128i *)(dst + 16), b);
+    _mm_stream_si128((__m128i *)(dst + 32), c);
+    _mm_stream_si128((__m128i *)(dst + 48), d);
+  }
+  _mm_sfence();
+  memcpy(dst, src, n);
+}
+
+static void zero_sse2(char *dst, size_t n)
+{
+  size_t head = -(size_t)dst & 15;
+  __m128i z = _mm_setzero_si128();
+
+  if (head > n)
+    head = n;
+  memset(dst, 0, head);
+  dst += head, n -= head;
+  for (; n >= 64; dst += 64, n -= 64) {
+    _mm_stream_si128((__m128i *)dst, z);
+    _mm_stream_si128((__m128i *)(dst + 16), z);
+    _mm_stream_si128((__m128i *)(dst + 32), z);
+    _mm_stream_si128((__m128i *)(dst + 48), z);
+  }
+  _mm_sfence();
+  memset(dst, 0, n);
+}
+
+/*
+ * copy_avx2, zero_avx2 - 32-byte streaming stores, compiled for AVX2
+ *     whatever the build targets and only called where the CPU has it
+ */
+__attribute__((target("avx2")))
+static void copy_avx2(char *dst, const char *src, size_t n)
+{
+  size_t head = -(size_t)dst & 31;
+
+  if (head > n)
+    head = n;
+  memcpy(dst, src, head);
+  dst += head, src += head, n -= head;
+  for (; n >= 64; dst += 64, src += 64, n -= 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)src);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+    _mm256_stream_si256((__m256i *)dst, a);
+    _mm256_stream_si256((__m256i *)(dst + 32), b);
+  }
+  _mm_sfence();
+  memcpy(dst, src, n);
+}
+
+__attribute__((target("avx2")))
+static void zero_avx2(char *dst, size_t n)
+{
+  size_t head = -(size_t)dst & 31;
+  __m256i z = _mm256_setzero_si256();
+
+  if (head > n)
+    head = n;
+  memset(dst, 0, head);
+  dst += head, n -= head;
+  for (; n >= 64; dst += 64, n -= 64) {
+    _mm256_stream_si256((__m256i *)dst, z);
+    _mm256_stream_si256((__m256i *)(dst + 32), z);
+  }
+  _mm_sfence();
+  memset(dst, 0, n);
+}
+#endif
+/* $end kernels */
+
+/*
+ * bulk_init - Pick the widest kernels the CPU runs.  Racing callers all
+ *     store the same choice, so no lock is needed.
+ */
+static void bulk_init(void)
+{
+#ifdef HAVE_NT_STORES
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    copy_kernel = copy_avx2;
+    zero_kernel = zero_avx2;
+    kernel_name = "avx2";
+    return;
+  }
+  copy_kernel = copy_sse2;
+  zero_kernel = zero_sse2;
+  kernel_name = "sse2";
+#else
+  kernel_name = "none";
+#endif
+}
@@ -0,0 +1,25 @@
+/*
+ * mm_bulk.h - copy and zero kernels for large blocks.
+ *
+ * mm_realloc moving a block and mm_calloc clearing one touch every
+ * byte of it, and for blocks of megabytes the ordinary memcpy and
+ * memset leave the cache full of lines the caller may not read for a
+ * long time, evicting whatever else was running.  At and above the
+ * cutoff these kernels write with non-temporal (streaming) stores,
+ * which go to memory without allocating cache lines; below it they are
+ * memcpy and memset.  The store width is picked once, at the first
+ * call, from what the CPU supports (AVX2, else SSE2); elsewhere, or
+ * with the cutoff at 0, nothing streams.
+ */
+#include <stddef.h>
+
+#define MM_BULK_CUTOFF (1<<20)  /* default cutoff (bytes) */
+
+extern void mm_bulk_copy(void *dst, const void *src, size_t n);
+extern void mm_bulk_zero(void *dst, size_t n);
+
+/* Stream copies and zeroing of bytes or more (0 = never stream) */
+extern void mm_bulk_set_cutoff(size_t bytes);
+
+/* Name of the streaming kernel in use: "avx2", "sse2" or "none" */
+extern const char *mm_bulk_kernel(void);
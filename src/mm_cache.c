@@ -0,0 +1,272 @@
+/*
+ * mm_cache.c - object caches over mm_malloc (see mm_cache.h)
+ *
+ * A slab is one mm_malloc block: a header, a stack of the indices of
+ * its free objects, and the object slots, each preceded by a word
+ * pointing back at the slab so mm_cache_free finds it.  The stack is
+ * kept outside the objects because free objects hold their
+ * constructed state.  Slots are constructed in order, the first time
+ * each is handed out, so a slab constructs only as many objects as
+ * were ever live in it at once, and reaping destructs exactly those.
+ *
+ * A cache keeps its slabs on three lists, by how many of their objects
+ * are in use: partial, full and empty.  Allocation takes from a partial
+ * slab first, so the empty ones stay empty and can be reaped.
+ */
+#include <stddef.h>
+
+#include "mm.h"
+#include "mm_cache.h"
+
+#define SLAB_MIN     4096    /* a slab holds at least this many bytes ... */
+#define SLAB_OBJS    8       /* ... and at least this many objects ... */
+#define SLAB_MAXOBJS 0xffff  /* ... and at most this many */
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define ROUNDUP(n, a) (((size_t)(n) + (a) - 1) & ~((size_t)(a) - 1))
+
+typedef struct slab {
+  struct mm_cache *cache;
+  struct slab *prev, *next;     /* on the cache's list for its use */
+  char *objs;                   /* slot 0 */
+  unsigned nused;               /* objects handed out */
+  unsigned nbuilt;              /* slots [0, nbuilt) are constructed */
+  unsigned nfree;               /* entries on the stack */
+  unsigned short stack[];       /* constructed free objects */
+} slab_t;
+
+struct mm_cache {
+  size_t size;
+  size_t align;
+  size_t stride;                /* bytes from one object to the next */
+  unsigned nobjs;               /* objects per slab */
+  mm_cache_fn_t ctor, dtor;
+  slab_t *partial, *full, *empty;
+  mm_cache_stats_t stats;
+  struct mm_cache *next;        /* on the list of all caches */
+};
+
+/* The slab a slot belongs to */
+#define SLAB_OF(obj) (*(slab_t **)((char *)(obj) - sizeof(slab_t *)))
+
+static mm_cache_t *caches;      /* every cache, for mm_cache_reap */
+
+static slab_t **slab_list(mm_cache_t *cache, unsigned nused);
+static void slab_link(slab_t **list, slab_t *slab);
+static void slab_unlink(slab_t **list, slab_t *slab);
+static slab_t *slab_grow(mm_cache_t *cache);
+static size_t slab_reap(mm_cache_t *cache);
+
+/*
+ * mm_cache_init - Forget every cache, which lived in the heap that
+ *     mm_init has just started over
+ */
+void mm_cache_init(void)
+{
+  caches = NULL;
+}
+
+/*
+ * mm_cache_create - Make a cache of objects of size bytes
+ */
+mm_cache_t *mm_cache_create(size_t size, size_t align,
+                            mm_cache_fn_t ctor, mm_cache_fn_t dtor)
+{
+  mm_cache_t *cache;
+  size_t hdr, nobjs;
+
+  if (size == 0 || (align & (align - 1)) != 0)
+    return NULL;
+  align = MAX(align, sizeof(slab_t *));
+  if ((cache = mm_malloc(sizeof(mm_cache_t))) == NULL)
+    return NULL;
+
+  /* Each slot is the back pointer, padded so the object is aligned,
+     then the object padded to the alignment */
+  hdr = ROUNDUP(sizeof(slab_t *), align);
+  cache->size = size;
+  cache->align = align;
+  cache->stride = hdr + ROUNDUP(size, align);
+  nobjs = MAX(SLAB_MIN / cache->stride, SLAB_OBJS);
+  cache->nobjs = nobjs > SLAB_MAXOBJS ? SLAB_MAXOBJS : nobjs;
+  cache->ctor = ctor;
+  cache->dtor = dtor;
+  cache->partial = cache->full = cache->empty = NULL;
+
+  cache->stats = (mm_cache_stats_t){ 0 };
+  cache->stats.slab_bytes = sizeof(slab_t) +
+    cache->nobjs * sizeof(unsigned short) + align - 1 + hdr +
+    cache->nobjs * cache->stride;
+
+  cache->next = caches;
+  caches = cache;
+  return cache;
+}
+
+/*
+ * mm_cache_alloc - Hand out an object, constructing it only if its slot
+ *     never held one
+ */
+void *mm_cache_alloc(mm_cache_t *cache)
+{
+  slab_t *slab;
+  char *obj;
+
+  if ((slab = cache->partial) == NULL &&
+      (slab = cache->empty) == NULL &&
+      (slab = slab_grow(cache)) == NULL)
+    return NULL;
+  slab_unlink(slab_list(cache, slab->nused), slab);
+
+  if (slab->nfree > 0) {
+    obj = slab->objs + slab->stack[--slab->nfree] * cache->stride;
+    cache->stats.cached--;
+  }
+  else {
+    obj = slab->objs + slab->nbuilt++ * cache->stride;
+    SLAB_OF(obj) = slab;
+    if (cache->ctor != NULL)
+      cache->ctor(obj);
+    cache->stats.ctors++;
+  }
+  slab->nused++;
+  cache->stats.live++;
+
+  slab_link(slab_list(cache, slab->nused), slab);
+  return obj;
+}
+
+/*
+ * mm_cache_free - Take an object back, still constructed
+ */
+void mm_cache_free(mm_cache_t *cache, void *obj)
+{
+  slab_t *slab;
+
+  if (obj == NULL)
+    return;
+  slab = SLAB_OF(obj);
+  slab_unlink(slab_list(cache, slab->nused), slab);
+
+  slab->stack[slab->nfree++] = ((char *)obj - slab->objs) / cache->stride;
+  slab->nused--;
+  cache->stats.live--;
+  cache->stats.cached++;
+
+  slab_link(slab_list(cache, slab->nused), slab);
+}
+
+/*
+ * mm_cache_destroy - Destruct a cache's objects and free its slabs; the
+ *     client must have freed every object
+ */
+void mm_cache_destroy(mm_cache_t *cache)
+{
+  mm_cache_t **cp;
+
+  if (cache == NULL)
+    return;
+  slab_reap(cache);
+  for (cp = &caches; *cp != NULL; cp = &(*cp)->next)
+    if (*cp == cache) {
+      *cp = cache->next;
+      break;
+    }
+  mm_free(cache);
+}
+
+/*
+ * mm_cache_reap - Free the empty slabs of every cache
+ */
+size_t mm_cache_reap(void)
+{
+  mm_cache_t *cache;
+  size_t bytes = 0;
+
+  for (cache = caches; cache != NULL; cache = cache->next)
+    bytes += slab_reap(cache);
+  return bytes;
+}
+
+void mm_cache_stats(mm_cache_t *cache, mm_cache_stats_t *stats)
+{
+  *stats = cache->stats;
+}
+
+/*
+ * slab_list - The list of a cache's slabs with nused objects in use
+ */
+static slab_t **slab_list(mm_cache_t *cache, unsigned nused)
+{
+  if (nused == 0)
+    return &cache->empty;
+  if (nused == cache->nobjs)
+    return &cache->full;
+  return &cache->partial;
+}
+
+static void slab_link(slab_t **list, slab_t *slab)
+{
+  slab->prev = NULL;
+  slab->next = *list;
+  if (*list != NULL)
+    (*list)->prev = slab;
+  *list = slab;
+}
+
+static void slab_unlink(slab_t **list, slab_t *slab)
+{
+  if (slab->prev != NULL)
+    slab->prev->next = slab->next;
+  else
+    *list = slab->next;
+  if (slab->next != NULL)
+    slab->next->prev = slab->prev;
+}
+
+/*
+ * slab_grow - Add an empty slab to a cache.  If mm has no room for it,
+ *     reap the empty slabs of all caches and try once more.
+ */
+static slab_t *slab_grow(mm_cache_t *cache)
+{
+  slab_t *slab;
+
+  if ((slab = mm_malloc(cache->stats.slab_bytes)) == NULL) {
+    if (mm_cache_reap() == 0 ||
+        (slab = mm_malloc(cache->stats.slab_bytes)) == NULL)
+      return NULL;
+  }
+
+  slab->cache = cache;
+  slab->objs = (char *)ROUNDUP((char *)&slab->stack[cache->nobjs] +
+                               sizeof(slab_t *), cache->align);
+  slab->nused = slab->nbuilt = slab->nfree = 0;
+  slab_link(&cache->empty, slab);
+  cache->stats.slabs++;
+  return slab;
+}
+
+/*
+ * slab_reap - Destruct the objects of a cache's empty slabs and free
+ *     the slabs; returns the bytes freed
+ */
+static size_t slab_reap(mm_cache_t *cache)
+{
+  slab_t *slab;
+  size_t bytes = 0;
+  unsigned i;
+
+  while ((slab = cache->empty) != NULL) {
+    slab_unlink(&cache->empty, slab);
+    if (cache->dtor != NULL)
+      for (i = 0; i < slab->nbuilt; i++)
+        cache->dtor(slab->objs + i * cache->stride);
+    cache->stats.dtors += slab->nbuilt;
+    cache->stats.cached -= slab->nfree;
+    cache->stats.slabs--;
+    bytes += cache->stats.slab_bytes;
+    mm_free(slab);
+  }
+  return bytes;
+}
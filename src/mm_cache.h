@@ -0,0 +1,52 @@
+/*
+ * mm_cache.h - object caches that keep freed objects constructed.
+ *
+ * Objects that are expensive to set up (connection state, parse
+ * buffers with their tables) lose that setup on every mm_free and
+ * mm_malloc.  A cache made by mm_cache_create hands out objects of one
+ * size and alignment from slabs it gets from mm_malloc, and runs the
+ * constructor on an object only the first time its slot is handed out.
+ * mm_cache_free puts the object back as it is, so the next
+ * mm_cache_alloc returns it still constructed: the client must free
+ * objects in their constructed state.  The destructor runs only when
+ * the memory goes back to mm: when the slabs with no objects in use
+ * are reaped, which mm_cache_reap does for every cache, and which a
+ * cache also does itself before failing when mm_malloc has no room for
+ * a new slab, and when the cache is destroyed.
+ *
+ * Call mm_cache_init after every mm_init: the caches live in the heap,
+ * so they go with it.  Like the mm package, the caches are not thread
+ * safe.
+ */
+#include <stddef.h>
+
+typedef struct mm_cache mm_cache_t;
+typedef void (*mm_cache_fn_t)(void *obj);
+
+/* A cache's bookkeeping */
+typedef struct {
+  size_t slabs;         /* slabs held */
+  size_t slab_bytes;    /* bytes of each slab */
+  size_t live;          /* objects handed out */
+  size_t cached;        /* free objects kept constructed */
+  long ctors;           /* constructor calls */
+  long dtors;           /* destructor calls */
+} mm_cache_stats_t;
+
+extern void mm_cache_init(void);
+
+/* align is a power of two, 0 for the mm default; ctor and dtor may be
+   NULL.  Returns NULL if mm is out of memory. */
+extern mm_cache_t *mm_cache_create(size_t size, size_t align,
+                                   mm_cache_fn_t ctor, mm_cache_fn_t dtor);
+extern void *mm_cache_alloc(mm_cache_t *cache);
+extern void mm_cache_free(mm_cache_t *cache, void *obj);
+
+/* Destroy a cache with no objects in use */
+extern void mm_cache_destroy(mm_cache_t *cache);
+
+/* Give the slabs with no objects in use in any cache back to mm;
+   returns the bytes freed */
+extern size_t mm_cache_reap(void);
+
+extern void mm_cache_stats(mm_cache_t *cache, mm_cache_stats_t *stats);
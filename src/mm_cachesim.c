@@ -0,0 +1,63 @@
+/*
+ * mm_cachesim.c - cache and TLB simulator (see mm_cachesim.h)
+ *
+ * Each set of the cache, and the TLB, is an array of tags with the
+ * most recently used first; a hit moves its tag to the front and a
+ * miss shifts the others down, dropping the last.  Tags are stored
+ * plus one so that zero means empty.
+ */
+#include <string.h>
+
+#include "mm_cachesim.h"
+
+static unsigned long cache[SIM_SETS][SIM_WAYS];
+static unsigned long tlb[SIM_TLB];
+static mm_sim_stats_t counts;
+
+/*
+ * lookup - Look tag up in the LRU array set of n entries, making it
+ *     the most recent; returns whether it was there
+ */
+static int lookup(unsigned long *set, int n, unsigned long tag)
+{
+  int i;
+
+  for (i = 0; i < n - 1 && set[i] != tag; i++)
+    ;
+  if (set[i] == tag) {
+    memmove(set + 1, set, i * sizeof(set[0]));
+    set[0] = tag;
+    return 1;
+  }
+  memmove(set + 1, set, (n - 1) * sizeof(set[0]));
+  set[0] = tag;
+  return 0;
+}
+
+void *mm_sim_touch(const void *p, size_t n)
+{
+  unsigned long line = (unsigned long)p >> SIM_LINE_SHIFT;
+  unsigned long last = ((unsigned long)p + (n ? n - 1 : 0)) >> SIM_LINE_SHIFT;
+
+  for (; line <= last; line++) {
+    counts.refs++;
+    if (!lookup(cache[line % SIM_SETS], SIM_WAYS, line + 1))
+      counts.misses++;
+    if (!lookup(tlb, SIM_TLB,
+                (line >> (SIM_PAGE_SHIFT - SIM_LINE_SHIFT)) + 1))
+      counts.tlb_misses++;
+  }
+  return (void *)p;
+}
+
+void mm_sim_reset(void)
+{
+  memset(cache, 0, sizeof(cache));
+  memset(tlb, 0, sizeof(tlb));
+  memset(&counts, 0, sizeof(counts));
+}
+
+void mm_sim_stats(mm_sim_stats_t *stats)
+{
+  *stats = counts;
+}
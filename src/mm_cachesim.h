@@ -0,0 +1,45 @@
+/*
+ * mm_cachesim.h - a cache and TLB simulator for comparing heap layouts.
+ *
+ * Cycle counts move with the machine and the load on it, too much to
+ * see a layout change (a footer dropped, a side table, shorter links)
+ * that saves a few cache misses per request.  Built with -DCACHESIM,
+ * the allocators pass every metadata access through SIM, which feeds
+ * the simulator before the access is made, and the driver can add
+ * touches of the payloads.  The simulated cache is a set-associative
+ * L1 with LRU replacement, indexed by the low address bits within a
+ * page, and the TLB is fully associative with LRU: the counts depend
+ * only on where blocks sit relative to their pages, so the same trace
+ * gives the same counts from run to run.  Without CACHESIM, SIM(p, n)
+ * is just p.
+ */
+#include <stddef.h>
+
+#define SIM_LINE_SHIFT 6   /* 64-byte lines ... */
+#define SIM_SETS       64  /* ... in 64 sets ... */
+#define SIM_WAYS       8   /* ... of 8 ways: 32KB */
+#define SIM_PAGE_SHIFT 12  /* 4KB pages ... */
+#define SIM_TLB        64  /* ... with this many TLB entries */
+
+/* Accesses and misses since the last mm_sim_reset */
+typedef struct {
+  unsigned long refs;        /* cache lines accessed */
+  unsigned long misses;      /* ... that missed in the L1 */
+  unsigned long tlb_misses;  /* ... whose page missed in the TLB */
+} mm_sim_stats_t;
+
+/* Record an access to the n bytes at p and return p */
+extern void *mm_sim_touch(const void *p, size_t n);
+
+/* Empty the cache and the TLB and zero the counts */
+extern void mm_sim_reset(void);
+extern void mm_sim_stats(mm_sim_stats_t *stats);
+
+#ifdef CACHESIM
+# define SIM(p, n)  ((__typeof__(p))mm_sim_touch((p), (n)))
+#else
+# define SIM(p, n)  (p)
+#endif
+
+/* An lvalue x of a side table, accessed through the simulator */
+#define SIDE(x)     (*SIM(&(x), sizeof(x)))
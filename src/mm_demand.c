@@ -0,0 +1,64 @@
+/*
+ * mm_demand.c - demand history and request rounding (see mm_demand.h)
+ *
+ * Every class counts its freed blocks, the fits that reused one of its
+ * free blocks, and its requests and those of them that missed.
+ * Every DEMAND_WINDOW events the rounding table is rebuilt from the
+ * counts and the counts are halved, so old history fades out.  Between
+ * rebuilds mm_demand_round is a table lookup.
+ */
+#include <stddef.h>
+#include <string.h>
+
+#include "mm_demand.h"
+
+mm_demand_t mm_demand;
+
+/*
+ * mm_demand_reset - Forget every event, for a new heap
+ */
+void mm_demand_reset(void)
+{
+  memset(&mm_demand, 0, sizeof(mm_demand));
+}
+
+/*
+ * mm_demand_update - Round each class whose freed blocks mostly go
+ *     unused up to the nearest class within the slack whose requests
+ *     mostly miss, then halve the counts
+ */
+void mm_demand_update(void)
+{
+  mm_demand_class_t *counts = mm_demand.counts, *d;
+  unsigned short *round_to = mm_demand.round_to;
+  int c, t, last;
+
+  for (c = DEMAND_LOW / DEMAND_GRAIN; c < DEMAND_CLASSES; c++) {
+    d = &counts[c];
+    /* Once rounded, the class's blocks are freed and reused as blocks
+       of the target, so keep it while both are still requested */
+    if (round_to[c] != 0 && d->requests >= DEMAND_MIN &&
+        counts[round_to[c]].requests >= DEMAND_MIN)
+      continue;
+    round_to[c] = 0;
+    if (d->freed < DEMAND_MIN || 2 * d->reused >= d->freed)
+      continue;
+    last = c + c / DEMAND_SLACK;
+    if (last >= DEMAND_CLASSES)
+      last = DEMAND_CLASSES - 1;
+    for (t = c + 1; t <= last; t++)
+      if (counts[t].misses >= DEMAND_MIN &&
+          2 * counts[t].misses >= counts[t].requests) {
+        round_to[c] = t;
+        break;
+      }
+  }
+
+  for (c = 0; c < DEMAND_CLASSES; c++) {
+    counts[c].freed /= 2;
+    counts[c].reused /= 2;
+    counts[c].requests /= 2;
+    counts[c].misses /= 2;
+  }
+  mm_demand.events = 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * mm_demand.h - request rounding driven by the history of demand.
+ *
+ * An allocator that places a block of exactly the requested size
+ * leaves, when the block is freed between live neighbours, a hole that
+ * only requests of that size or less can use.  If the program's next
+ * requests are a little larger (448 bytes alternating with 64, the 448s
+ * freed, then 512s), every hole is wasted and the heap grows by the
+ * whole lot.  mm_demand keeps a decaying history, per block size
+ * class, of how many blocks were freed, how many free blocks of the
+ * class a fit reused, and how many requests missed: found no free
+ * block of about their size, only fresh memory or a block more than
+ * twice as large to split.  A class whose freed blocks are mostly never
+ * reused has its requests rounded up to the smallest class at most
+ * 1/DEMAND_SLACK larger whose requests mostly missed, so that the holes
+ * it leaves fit them.  Blocks under DEMAND_LOW bytes are left alone:
+ * the many small requests refill their holes anyway, and one class
+ * more on each costs more than it saves.
+ *
+ * Only requests after the ones that taught the history are rounded, so
+ * it pays off when the pattern comes back in the same heap
+ * (traces/binary-phases.rep: mm_work goes from 88% to 97%), not in a
+ * single pass like binary-bal.  mm.c does without it, since its high
+ * placement already keeps such holes out of the way.
+ *
+ * The history describes one heap: mm_init starts it over with
+ * mm_demand_reset.  The allocator notes every event with the block
+ * size in bytes (header and footer included) and asks mm_demand_round
+ * for the size to place.  Both are inline, and only the rebuild of the
+ * rounding table every DEMAND_WINDOW events is a call.
+ */
+#include <stddef.h>
+
+#define DEMAND_LOW    128    /* smaller blocks are not rounded ... */
+#define DEMAND_MAX    4096   /* ... nor larger ones (bytes) */
+#define DEMAND_GRAIN  8      /* class spacing (bytes) */
+#define DEMAND_SLACK  4      /* round up by at most 1/DEMAND_SLACK */
+#define DEMAND_MIN    32     /* events before a class's history counts */
+#define DEMAND_WINDOW 1024   /* events between updates; counts then halve */
+
+#define DEMAND_CLASSES (DEMAND_MAX / DEMAND_GRAIN)
+
+typedef struct {
+  unsigned freed;      /* blocks of the class freed */
+  unsigned reused;     /* free blocks of the class a fit took */
+  unsigned requests;   /* requests for blocks of the class */
+  unsigned misses;     /* of those, ones that found no free block
+                          of about their size (none, or only one more
+                          than twice as large to split) */
+} mm_demand_class_t;
+
+/* The whole history */
+typedef struct {
+  unsigned short round_to[DEMAND_CLASSES];  /* class to place instead
+                                               (0: none) */
+  unsigned events;                          /* since the last update */
+  mm_demand_class_t counts[DEMAND_CLASSES];
+} mm_demand_t;
+
+extern mm_demand_t mm_demand;
+
+/* Forget the history */
+extern void mm_demand_reset(void);
+
+/* Rebuild the rounding table and halve the counts; called every
+   DEMAND_WINDOW events */
+extern void mm_demand_update(void);
+
+/* The block size to place for a block of asize bytes */
+static inline size_t mm_demand_round(size_t asize)
+{
+  if (asize >= DEMAND_MAX || mm_demand.round_to[asize / DEMAND_GRAIN] == 0)
+    return asize;
+  return (size_t)mm_demand.round_to[asize / DEMAND_GRAIN] * DEMAND_GRAIN;
+}
+
+/* A request for a block of asize bytes was placed in a free block of
+   fitsize bytes, or found none (fitsize 0) */
+static inline void mm_demand_fit(size_t asize, size_t fitsize)
+{
+  if (asize < DEMAND_MAX) {
+    mm_demand.counts[asize / DEMAND_GRAIN].requests++;
+    if (fitsize == 0 || fitsize > 2 * asize)
+      mm_demand.counts[asize / DEMAND_GRAIN].misses++;
+  }
+  if (fitsize != 0 && fitsize < DEMAND_MAX)
+    mm_demand.counts[fitsize / DEMAND_GRAIN].reused++;
+  if (++mm_demand.events == DEMAND_WINDOW)
+    mm_demand_update();
+}
+
+/* A block of size bytes was freed */
+static inline void mm_demand_free(size_t size)
+{
+  if (size < DEMAND_MAX)
+    mm_demand.counts[size / DEMAND_GRAIN].freed++;
+  if (++mm_demand.events == DEMAND_WINDOW)
+    mm_demand_update();
+}
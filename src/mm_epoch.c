@@ -0,0 +1,303 @@
+/*
+ * mm_epoch.c - epoch-based reclamation over mm_mt (see mm_epoch.h)
+ *
+ * There is one global epoch.  A thread entering its outermost section
+ * publishes the epoch it saw, with the low bit set to say it is inside,
+ * and clears it when it leaves.  A retired node is stamped with the
+ * epoch of its retirement and kept on its thread's limbo list, which
+ * is in stamp order.  The epoch may move from e to e+1 only when every
+ * thread inside a section has published e, so once it reaches s+2 no
+ * thread can still be in a section that began before a node stamped s
+ * was unlinked, and the node is freed.  Every EPOCH_BATCH retirements
+ * a thread tries to move the epoch on and frees the head of its list
+ * that became safe.
+ *
+ * Each thread has a record, allocated from mm_mt on first use and
+ * linked on a list that only grows until mm_epoch_init; the record of
+ * an exited thread, with whatever it still had to free, is adopted by
+ * the next new thread.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_mt.h"
+#include "mm_epoch.h"
+
+#define EPOCH_LINE     64   /* cache line size (bytes) */
+#define EPOCH_LIMBO0   256  /* initial limbo capacity (nodes) */
+#define EPOCH_INSIDE   1UL  /* low bit of a published state */
+
+/* A retired node and the epoch it was retired in */
+typedef struct {
+  void *ptr;
+  unsigned long epoch;
+} limbo_t;
+
+typedef struct epoch_rec {
+  unsigned long state;          /* epoch << 1 | EPOCH_INSIDE, or 0 */
+  int owned;                    /* a live thread uses the record */
+  unsigned nest;                /* depth of nested sections */
+  struct epoch_rec *next;       /* on the list of all records */
+  void *raw;                    /* block returned by mm_mt_malloc */
+  limbo_t *limbo;               /* retired nodes, oldest first */
+  long npending, cap;
+  long retired, reclaimed, max_pending;
+} epoch_rec_t;
+
+/* The global epoch, alone on its cache line */
+static unsigned long global_epoch __attribute__((aligned(EPOCH_LINE)));
+static epoch_rec_t *records __attribute__((aligned(EPOCH_LINE)));
+
+static unsigned epoch_gen;      /* bumped by every mm_epoch_init */
+
+static pthread_key_t rec_key;
+static pthread_once_t rec_once = PTHREAD_ONCE_INIT;
+static __thread epoch_rec_t *trec;
+static __thread unsigned trec_gen;  /* generation trec belongs to */
+
+static epoch_rec_t *thread_rec(void);
+static void rec_release(void *arg);
+static void rec_key_init(void);
+static void rec_error(void);
+static void try_advance(void);
+static void collect(epoch_rec_t *r);
+
+/*
+ * mm_epoch_init - Forget every record, which lived in the heap that
+ *     mm_mt_init has just started over
+ */
+void mm_epoch_init(void)
+{
+  __atomic_store_n(&records, NULL, __ATOMIC_RELEASE);
+  __atomic_store_n(&global_epoch, 0, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&epoch_gen, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * mm_epoch_enter - Start a section; nodes read from here to the
+ *     matching mm_epoch_exit are not freed under the reader
+ */
+void mm_epoch_enter(void)
+{
+  epoch_rec_t *r = thread_rec();
+  unsigned long e;
+
+  if (r->nest++ > 0)
+    return;
+  e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&r->state, e << 1 | EPOCH_INSIDE, __ATOMIC_RELAXED);
+  /* The state must be visible before the section reads anything */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * mm_epoch_exit - End a section.  Leaving the outermost one with more
+ *     than EPOCH_HIGH nodes retired waits until some are freed.
+ */
+void mm_epoch_exit(void)
+{
+  epoch_rec_t *r = trec;
+
+  if (--r->nest > 0)
+    return;
+  __atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+  while (r->npending > EPOCH_HIGH) {
+    collect(r);
+    if (r->npending > EPOCH_HIGH)
+      sched_yield();
+  }
+}
+
+/*
+ * mm_free_deferred - Free ptr once no section can still be reading it
+ */
+void mm_free_deferred(void *ptr)
+{
+  epoch_rec_t *r = thread_rec();
+  limbo_t *limbo;
+
+  if (ptr == NULL)
+    return;
+  if (r->npending == r->cap) {
+    /* Out of room: grow rather than wait, the caller may be inside */
+    limbo = mm_mt_realloc(r->limbo, 2 * r->cap * sizeof(limbo_t));
+    if (limbo == NULL) {
+      /* Wait if we may; inside a section this would never end */
+      if (r->nest > 0)
+        return;  /* leak ptr rather than free it under a reader */
+      while (r->npending == r->cap) {
+        collect(r);
+        sched_yield();
+      }
+    } else {
+      r->limbo = limbo;
+      r->cap *= 2;
+    }
+  }
+
+  r->limbo[r->npending].ptr = ptr;
+  r->limbo[r->npending].epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  r->npending++;
+  r->retired++;
+  if (r->npending > r->max_pending)
+    r->max_pending = r->npending;
+  if (r->retired % EPOCH_BATCH == 0)
+    collect(r);
+}
+
+/*
+ * mm_epoch_barrier - Free all of the calling thread's retired nodes,
+ *     waiting for the other threads' sections as long as it takes
+ */
+void mm_epoch_barrier(void)
+{
+  epoch_rec_t *r = thread_rec();
+
+  while (r->npending > 0) {
+    collect(r);
+    if (r->npending > 0)
+      sched_yield();
+  }
+}
+
+/*
+ * mm_epoch_stats - Sum the records.  Exact only while no thread is
+ *     retiring.
+ */
+void mm_epoch_stats(mm_epoch_stats_t *stats)
+{
+  epoch_rec_t *r;
+
+  memset(stats, 0, sizeof(*stats));
+  stats->epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  for (r = __atomic_load_n(&records, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+    stats->retired += r->retired;
+    stats->reclaimed += r->reclaimed;
+    if (r->max_pending > stats->max_pending)
+      stats->max_pending = r->max_pending;
+    stats->nthreads++;
+  }
+}
+
+/* $begin helper functions */
+
+/*
+ * thread_rec - The calling thread's record: adopted from an exited
+ *     thread if there is one, else allocated and linked
+ */
+static epoch_rec_t *thread_rec(void)
+{
+  epoch_rec_t *r;
+  char *raw;
+  int unowned = 0;
+
+  if (trec != NULL && trec_gen == epoch_gen)
+    return trec;
+
+  pthread_once(&rec_once, rec_key_init);
+  for (r = __atomic_load_n(&records, __ATOMIC_ACQUIRE); r != NULL; r = r->next)
+    if (__atomic_load_n(&r->owned, __ATOMIC_RELAXED) == 0 &&
+        __atomic_compare_exchange_n(&r->owned, &unowned, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+    else
+      unowned = 0;
+
+  if (r == NULL) {
+    /* The state is written by its thread and read by all: give the
+       record lines of its own */
+    if ((raw = mm_mt_malloc(sizeof(epoch_rec_t) + 2 * EPOCH_LINE)) == NULL)
+      rec_error();
+    r = (epoch_rec_t *)(((size_t)raw + EPOCH_LINE - 1) &
+                        ~(size_t)(EPOCH_LINE - 1));
+    memset(r, 0, sizeof(*r));
+    r->raw = raw;
+    r->owned = 1;
+    r->cap = EPOCH_LIMBO0;
+    if ((r->limbo = mm_mt_malloc(r->cap * sizeof(limbo_t))) == NULL)
+      rec_error();
+    r->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&records, &r->next, r, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+  trec = r;
+  trec_gen = epoch_gen;
+  pthread_setspecific(rec_key, r);
+  return r;
+}
+
+/*
+ * rec_release - pthread key destructor: free what can be freed now and
+ *     leave the record, and the rest, to the next new thread
+ */
+static void rec_release(void *arg)
+{
+  epoch_rec_t *r = arg;
+
+  if (trec_gen != epoch_gen)
+    return;  /* r went with the heap it was in */
+  collect(r);
+  r->nest = 0;
+  __atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+  trec = NULL;
+  __atomic_store_n(&r->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void rec_key_init(void)
+{
+  pthread_key_create(&rec_key, rec_release);
+}
+
+/*
+ * rec_error - A thread without a record could not enter a section
+ *     safely, so running out of memory for one is fatal
+ */
+static void rec_error(void)
+{
+  fprintf(stderr, "mm_epoch: out of memory for a thread record\n");
+  exit(1);
+}
+
+/*
+ * try_advance - Move the global epoch on if every thread inside a
+ *     section has seen it
+ */
+static void try_advance(void)
+{
+  unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  unsigned long s;
+  epoch_rec_t *r;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (r = __atomic_load_n(&records, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+    s = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+    if ((s & EPOCH_INSIDE) && (s >> 1) != e)
+      return;
+  }
+  __atomic_compare_exchange_n(&global_epoch, &e, e + 1, 0,
+                              __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/*
+ * collect - Try to move the epoch on, then free the retired nodes of r
+ *     that are two epochs old
+ */
+static void collect(epoch_rec_t *r)
+{
+  unsigned long e;
+  long i;
+
+  try_advance();
+  e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  for (i = 0; i < r->npending && r->limbo[i].epoch + 2 <= e; i++)
+    mm_mt_free(r->limbo[i].ptr);
+  if (i == 0)
+    return;
+  memmove(r->limbo, r->limbo + i, (r->npending - i) * sizeof(limbo_t));
+  r->npending -= i;
+  r->reclaimed += i;
+}
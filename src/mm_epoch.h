@@ -0,0 +1,41 @@
+/*
+ * mm_epoch.h - epoch-based deferred free for lock-free data structures.
+ *
+ * A lock-free structure cannot mm_mt_free a node as soon as it unlinks
+ * it, because other threads may still be reading the node.  Readers
+ * bracket every access to the structure with mm_epoch_enter and
+ * mm_epoch_exit (they nest), and the thread that unlinks a node passes
+ * it to mm_free_deferred instead of mm_mt_free.  The node is freed, in
+ * a batch with the others the thread retired, through mm_mt_free into
+ * the thread's cache once every thread that was inside a section when
+ * it was retired has left it.  A thread whose retired nodes pass
+ * EPOCH_HIGH waits for them on its way out of its outermost section,
+ * so retired memory stays bounded as long as sections are short.
+ *
+ * Call mm_epoch_init after every mm_mt_init, with no other threads
+ * running; nodes must come from mm_mt_malloc.
+ */
+#include <stddef.h>
+
+#define EPOCH_BATCH 64     /* retirements between reclaim attempts */
+#define EPOCH_HIGH  4096   /* retired nodes a thread may hold */
+
+/* Bookkeeping summed over all threads */
+typedef struct {
+  unsigned long epoch;  /* the global epoch */
+  long retired;         /* nodes passed to mm_free_deferred */
+  long reclaimed;       /* of those, freed */
+  long max_pending;     /* most nodes one thread held at once */
+  int nthreads;         /* threads that ever retired or entered */
+} mm_epoch_stats_t;
+
+extern void mm_epoch_init(void);
+extern void mm_epoch_enter(void);
+extern void mm_epoch_exit(void);
+extern void mm_free_deferred(void *ptr);
+
+/* Outside any section: wait until the calling thread's retired nodes
+   are all freed */
+extern void mm_epoch_barrier(void);
+
+extern void mm_epoch_stats(mm_epoch_stats_t *stats);
@@ -0,0 +1,173 @@
+/*
+ * mm_frame.h - coroutine frame allocation on top of mm_mt (C++20).
+ *
+ * Every call of a C++20 coroutine allocates its frame through the
+ * operator new of the coroutine's promise type, or the global one if
+ * the promise has none.  Frames are short lived and every coroutine
+ * function always asks for the same size, but most are larger than
+ * mm_mt's small size classes, so each call would take the heap lock
+ * and run find_fit.  A promise type that derives from
+ * mm_frame::allocated gets frames from per-thread pools instead: one
+ * list of recycled frames per FRAME_STEP bytes of frame size, up to
+ * FRAME_MAX bytes.  Allocation pops the list of the frame's size and
+ * only goes to mm_mt_malloc when it is empty; the sized operator
+ * delete, which the compiler calls with the frame size, pushes the
+ * frame back, and only hands it to mm_mt_free when the list already
+ * holds FRAME_KEEP frames.  Neither touches anything shared with
+ * other threads.  A frame freed by another thread than the one that
+ * allocated it joins the pool of the thread that frees it.  A thread's
+ * pools go back to mm_mt when it exits, or on mm_frame::flush().
+ *
+ * operator new must return memory aligned to
+ * __STDCPP_DEFAULT_NEW_ALIGNMENT__ (16 on x86-64, where frames may hold
+ * long double and SSE locals), but mm_mt only aligns to ALIGNMENT (8
+ * by default).  So a frame is carved out of an mm_mt block FRAME_ALIGN
+ * bytes larger, with the block's address just below it; pools hold
+ * frames, which stay aligned, and aligned_new and aligned_delete
+ * serve other frame allocators the same way.
+ *
+ * mm_mt_init must have been called before the first frame is made.
+ *
+ *   struct promise_type : mm_frame::allocated { ... };
+ */
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+extern "C" {
+#include "mm_mt.h"
+}
+
+namespace mm_frame {
+
+constexpr std::size_t FRAME_STEP = 16;    /* pool size spacing (bytes) */
+constexpr std::size_t FRAME_MAX  = 2048;  /* larger frames are not pooled */
+constexpr unsigned    FRAME_KEEP = 64;    /* frames kept per pool */
+constexpr std::size_t NPOOLS     = FRAME_MAX / FRAME_STEP;
+constexpr std::size_t FRAME_ALIGN = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+/*
+ * aligned_new, aligned_delete - n bytes from mm_mt, aligned to
+ *     FRAME_ALIGN; the mm_mt block's address is kept in the word in
+ *     front (mm_mt blocks are at least word aligned, so there is room)
+ */
+inline void *aligned_new(std::size_t n) {
+  void *block;
+  void **frame;
+
+  if ((block = mm_mt_malloc(n + FRAME_ALIGN)) == nullptr)
+    throw std::bad_alloc();
+  frame = reinterpret_cast<void **>(
+      (reinterpret_cast<std::uintptr_t>(block) + FRAME_ALIGN) & ~(FRAME_ALIGN - 1));
+  frame[-1] = block;
+  return frame;
+}
+
+inline void aligned_delete(void *frame) noexcept {
+  mm_mt_free(static_cast<void **>(frame)[-1]);
+}
+
+/* Counts of this thread's frame requests */
+struct stats {
+  long hits;     /* served from a pool */
+  long misses;   /* served by mm_mt_malloc */
+  long spills;   /* freed to mm_mt_free, the pool being full */
+};
+
+namespace detail {
+
+/* A free frame in a pool links to the next one with its first word */
+struct free_frame {
+  free_frame *next;
+};
+
+/* The pools of one thread */
+struct pools {
+  free_frame *head[NPOOLS] = {};
+  unsigned count[NPOOLS] = {};
+  mm_frame::stats stats = {};
+
+  void flush() {
+    for (std::size_t i = 0; i < NPOOLS; i++) {
+      while (head[i] != nullptr) {
+        free_frame *f = head[i];
+        head[i] = f->next;
+        aligned_delete(f);
+      }
+      count[i] = 0;
+    }
+  }
+  ~pools() { flush(); }
+};
+
+inline thread_local pools local;
+
+/* Pool of frames of n bytes (n > 0) */
+constexpr std::size_t pool_of(std::size_t n) {
+  return (n - 1) / FRAME_STEP;
+}
+
+} /* namespace detail */
+
+/*
+ * frame_new, frame_delete - Allocate and free a frame of n bytes
+ */
+inline void *frame_new(std::size_t n) {
+  detail::pools &p = detail::local;
+
+  if (n > 0 && n <= FRAME_MAX) {
+    std::size_t i = detail::pool_of(n);
+    if (detail::free_frame *f = p.head[i]) {
+      p.head[i] = f->next;
+      p.count[i]--;
+      p.stats.hits++;
+      return f;
+    }
+    n = (i + 1) * FRAME_STEP;  /* fit any frame of the pool when recycled */
+  }
+  p.stats.misses++;
+  return aligned_new(n);
+}
+
+inline void frame_delete(void *frame, std::size_t n) noexcept {
+  detail::pools &p = detail::local;
+
+  if (frame == nullptr)
+    return;
+  if (n > 0 && n <= FRAME_MAX) {
+    std::size_t i = detail::pool_of(n);
+    if (p.count[i] < FRAME_KEEP) {
+      auto *f = static_cast<detail::free_frame *>(frame);
+      f->next = p.head[i];
+      p.head[i] = f;
+      p.count[i]++;
+      return;
+    }
+    p.stats.spills++;
+  }
+  aligned_delete(frame);
+}
+
+/* Return this thread's pooled frames to mm_mt */
+inline void flush() {
+  detail::local.flush();
+}
+
+inline stats thread_stats() {
+  return detail::local.stats;
+}
+
+/*
+ * allocated - Base of a promise type whose coroutine frames come from
+ *     the pools
+ */
+struct allocated {
+  static void *operator new(std::size_t n) {
+    return frame_new(n);
+  }
+  static void operator delete(void *frame, std::size_t n) noexcept {
+    frame_delete(frame, n);
+  }
+};
+
+} /* namespace mm_frame */
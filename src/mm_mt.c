@@ -0,0 +1,958 @@
+/*
+ * mm_mt.c - thread-safe front end with per-thread and per-CPU caches.
+ *
+ * The mm package is single threaded, so every call into it is made
+ * under one heap lock.  Small requests (<= MT_MAXSMALL bytes) are
+ * rounded up to one of MT_NCLASS size classes and served from a cache
+ * of free objects instead:
+ *
+ *  - MT_CACHE_THREAD: every thread owns a cache; no synchronization.
+ *  - MT_CACHE_CPU: every CPU owns a cache.  Pushes and pops run as a
+ *    Linux restartable sequence (rseq) on the cache of the CPU the
+ *    thread is running on: the single committing store either happens
+ *    on that CPU or the kernel aborts the sequence and we retry, so the
+ *    fast path needs neither a lock nor an atomic instruction.  Without
+ *    rseq (old kernel/glibc, not x86-64) each per-CPU cache is protected
+ *    by its own mutex instead.
+ *
+ * A cache keeps up to MT_CAP objects per class in an array stack.  An
+ * empty stack is refilled with MT_BATCH objects and a full one flushes
+ * MT_BATCH objects, in both cases through the depot: one lock-free
+ * Treiber stack per class shared by all threads.  Only when the depot
+ * is empty (refill) or holds more than MT_DEPOT_MAX objects of a class
+ * (flush) does the batch go to the heap, in one lock hold.  In
+ * MT_CACHE_SHARED mode there are no caches and every small request is
+ * a single push or pop on the depot.
+ *
+ * Depot heads pack a 32-bit version tag above the 32-bit offset (+1) of
+ * the top object from the start of the heap.  Every push and pop bumps
+ * the tag, so a pop that read a stale next link fails its CAS even if
+ * the same object is back on top (ABA), and a plain 8-byte
+ * compare-and-swap suffices.  Links live in the first payload word of
+ * free objects; a racing pop may read one after the object was handed
+ * out, which is harmless because the heap is never unmapped.  Large
+ * requests and coalescing stay on the locked path.
+ *
+ * With MT_ISOLATE added to a cache mode, objects of different owners
+ * never share a cache line.  A cache (the owner) carves its small
+ * objects from runs of its own: MT_BATCH objects laid out in whole,
+ * line-aligned cache lines of one heap block.  Carved objects record
+ * their owner and always go back to it: a free by the owner lands in
+ * its cache, a free by anyone else (or one that finds the cache full)
+ * on the owner's lock-free remote list, which the owner takes over in
+ * one exchange when its cache runs dry.  Runs are never returned to
+ * the heap; the cache of an exiting thread is kept and adopted by the
+ * next new thread instead.
+ *
+ * Every object carries one ALIGNMENT-sized header in front of the
+ * payload: the usable size in the upper bits, then the owner id of
+ * carved objects (0 otherwise), then the size class (or MT_HEAP for
+ * objects that bypass the caches) in the low byte.
+ *
+ * Caches themselves are allocated from the heap, so their footprint
+ * shows up in the heap size like any other overhead.
+ *
+ * When the process publishes statistics (mm_shm), the summed cache
+ * counters are copied into the shared block every MT_PUBLISH heap
+ * round trips, under the heap lock that also serializes mm's updates.
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__linux__) && __has_include(<sys/rseq.h>)
+# include <sys/rseq.h>
+# define HAVE_RSEQ
+#endif
+
+#include "mm.h"
+#include "mm_mt.h"
+#include "mm_shm.h"
+#include "mm_bulk.h"
+#include "memlib.h"
+#include "config.h"
+
+#define MT_HDR      ALIGNMENT   /* per-object header (bytes) */
+#define MT_STEP     16          /* size class spacing (bytes) */
+#define MT_NCLASS   16          /* number of small size classes */
+#define MT_MAXSMALL (MT_NCLASS*MT_STEP)
+#define MT_CAP      64          /* objects per class in one cache */
+#define MT_BATCH    16          /* objects moved per refill or flush */
+#define MT_DEPOT_MAX 1024       /* depot objects per class before flushing */
+#define MT_MAXCPU   256         /* largest CPU count served by rseq */
+#define MT_MAXOWNER 4096        /* owner ids available to MT_ISOLATE */
+#define MT_LINE     64          /* cache line size (bytes) */
+#define MT_HEAP     0xff        /* class tag of objects owned by the heap */
+#define MT_PUBLISH  64          /* heap round trips between mm_shm updates */
+
+/* Map a request size to its class and back */
+#define MT_CLASS(size)    (((size) + MT_STEP - 1) / MT_STEP - 1)
+#define MT_CLASS_SIZE(c)  (((size_t)(c) + 1) * MT_STEP)
+
+/* Read and write the header in front of payload p */
+#define HDR(p)            (*(size_t *)((char *)(p) - MT_HDR))
+#define PACK_HDR(size, owner, c) \
+  (((size_t)(size) << 24) | ((size_t)(owner) << 8) | (c))
+#define HDR_SIZE(p)       (HDR(p) >> 24)
+#define HDR_OWNER(p)      ((int)(HDR(p) >> 8) & 0xffff)
+#define HDR_CLASS(p)      ((int)(HDR(p) & 0xff))
+
+/* Round n up to a whole number of cache lines */
+#define LINE_ALIGN(n)     (((size_t)(n) + MT_LINE - 1) & ~(size_t)(MT_LINE - 1))
+
+/* Pack and unpack depot heads: version tag above offset+1 of the top */
+#define DEPOT_HEAD(tag, off)  (((unsigned long)(tag) << 32) | (off))
+#define DEPOT_TAG(h)          ((unsigned)((h) >> 32))
+#define DEPOT_OFF(h)          ((unsigned)(h))
+#define DEPOT_LINK(p)         (*(volatile unsigned long *)(p))
+
+typedef struct mt_cache {
+  long top[MT_NCLASS];              /* stack depth per class */
+  void *slots[MT_NCLASS][MT_CAP];   /* free objects per class */
+  long hits, misses;                /* approximate in per-CPU mode */
+  pthread_mutex_t lock;             /* per-CPU fallback path only */
+  struct mt_cache *next;            /* registry of live caches */
+  void *raw;                        /* block returned by mm_malloc */
+  unsigned gen;                     /* mm_mt_init generation */
+  int id;                           /* owner id of its runs (MT_ISOLATE) */
+  int dead;                         /* owner thread exited, may be adopted */
+  /* objects freed by non-owners, on a line of their own (MT_ISOLATE) */
+  void *remote[MT_NCLASS] __attribute__((aligned(MT_LINE)));
+  long remote_count;
+} mt_cache_t;
+
+/* One lock-free class list, alone on its cache line */
+typedef struct {
+  unsigned long head;               /* DEPOT_HEAD of the top object */
+  long count;                       /* approximate number of objects */
+  long hits;                        /* pops that found an object */
+} __attribute__((aligned(MT_LINE))) mt_depot_t;
+
+/* Global variables */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static int mt_mode = MT_CACHE_NONE;
+static int mt_isolate;              /* MT_ISOLATE was requested and applies */
+static unsigned mt_gen;             /* bumped by every mm_mt_init */
+static mt_cache_t *registry;        /* all live caches (heap_lock) */
+static long heap_misses;            /* requests that bypassed the caches */
+static int use_rseq;                /* per-CPU caches run on rseq */
+static int ncpu;                    /* number of per-CPU caches */
+static mt_cache_t *cpu_caches[MT_MAXCPU];
+static mt_depot_t depot[MT_NCLASS];
+static mt_cache_t *owners[MT_MAXOWNER];
+static int nowners;
+static unsigned long heap_trips;    /* heap_alloc and heap_free calls */
+
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static __thread mt_cache_t *tcache;
+
+/* Helper functions */
+static void *heap_alloc(size_t size, int cls);
+static void heap_free(void *p);
+static mt_cache_t *cache_new(void);
+static void cache_drain(mt_cache_t *c);
+static mt_cache_t *thread_cache(void);
+static mt_cache_t *current_cache(void);
+static void *cache_pop(int cls, int count);
+static int cache_push(int cls, int owner, void *p);
+static void depot_push(int cls, void *p);
+static void *depot_pop(int cls);
+static void *refill(int cls);
+static void flush(int cls, void *p);
+static void remote_push(mt_cache_t *c, int cls, void *p);
+static void *refill_isolated(int cls);
+static void gather(mt_stats_t *stats);
+static void publish(void);
+
+/* $begin rseq */
+#ifdef HAVE_RSEQ
+/*
+ * The critical section descriptor lives in __rseq_cs and the abort
+ * handler in __rseq_failure, preceded by the signature glibc registered
+ * (RSEQ_SIG, encoded as the operand of a ud1 instruction).  Label 1 is
+ * the start of the sequence, 2 is right after the committing store and
+ * 4 is the abort handler.
+ */
+#define RSEQ_CS_BEGIN \
+  ".pushsection __rseq_cs, \"aw\"\n\t" \
+  ".balign 32\n\t" \
+  "3:\n\t" \
+  ".long 0x0, 0x0\n\t" \
+  ".quad 1f, (2f - 1f), 4f\n\t" \
+  ".popsection\n\t" \
+  "leaq 3b(%%rip), %%rax\n\t" \
+  "movq %%rax, %%fs:8(%[off])\n\t" \
+  "1:\n\t" \
+  "cmpl %[cpu], %%fs:4(%[off])\n\t" \
+  "jnz 4f\n\t"
+
+#define RSEQ_CS_END \
+  "2:\n\t" \
+  ".pushsection __rseq_failure, \"ax\"\n\t" \
+  ".byte 0x0f, 0xb9, 0x3d\n\t" \
+  ".long 0x53053053\n\t" \
+  "4:\n\t" \
+  "jmp %l[abort]\n\t" \
+  ".popsection\n\t"
+
+/* rseq_cpu - CPU the calling thread runs on, negative if unregistered */
+static inline int rseq_cpu(void)
+{
+  volatile struct rseq *rs =
+    (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+  return (int)rs->cpu_id;
+}
+
+/*
+ * rseq_push - push p on class cls of cache c, which belongs to cpu.
+ *     Return 0 on success, 1 if the stack is full, -1 if aborted.
+ */
+static inline int rseq_push(mt_cache_t *c, int cls, int cpu, void *p)
+{
+  __asm__ __volatile__ goto (
+    RSEQ_CS_BEGIN
+    "movq (%[topp]), %%rax\n\t"
+    "cmpq %[cap], %%rax\n\t"
+    "jae %l[full]\n\t"
+    "movq %[p], (%[slots], %%rax, 8)\n\t"
+    "addq $1, %%rax\n\t"
+    "movq %%rax, (%[topp])\n\t"          /* commit */
+    RSEQ_CS_END
+    : /* no outputs */
+    : [cpu] "r" (cpu), [off] "r" (__rseq_offset),
+      [topp] "r" (&c->top[cls]), [slots] "r" (c->slots[cls]),
+      [cap] "i" (MT_CAP), [p] "r" (p)
+    : "memory", "cc", "rax"
+    : full, abort);
+  return 0;
+full:
+  return 1;
+abort:
+  return -1;
+}
+
+/*
+ * rseq_pop - pop class cls of cache c, which belongs to cpu, into *out.
+ *     Return 0 on success, 1 if the stack is empty, -1 if aborted.
+ */
+static inline int rseq_pop(mt_cache_t *c, int cls, int cpu, void **out)
+{
+  __asm__ __volatile__ goto (
+    RSEQ_CS_BEGIN
+    "movq (%[topp]), %%rax\n\t"
+    "testq %%rax, %%rax\n\t"
+    "jz %l[empty]\n\t"
+    "subq $1, %%rax\n\t"
+    "movq (%[slots], %%rax, 8), %%rdx\n\t"
+    "movq %%rdx, (%[out])\n\t"
+    "movq %%rax, (%[topp])\n\t"          /* commit */
+    RSEQ_CS_END
+    : /* no outputs */
+    : [cpu] "r" (cpu), [off] "r" (__rseq_offset),
+      [topp] "r" (&c->top[cls]), [slots] "r" (c->slots[cls]),
+      [out] "r" (out)
+    : "memory", "cc", "rax", "rdx"
+    : empty, abort);
+  return 0;
+empty:
+  return 1;
+abort:
+  return -1;
+}
+#endif
+
+/* rseq_available - true if this thread can use the rseq fast path */
+static int rseq_available(void)
+{
+#ifdef HAVE_RSEQ
+  return __rseq_size > 0 && rseq_cpu() >= 0;
+#else
+  return 0;
+#endif
+}
+/* $end rseq */
+
+/*
+ * mm_mt_init - Discard all caches and select a cache mode.  Must be
+ *     called after mm_init and while no other thread uses the package.
+ *     Return -1 on error, 0 on success.
+ */
+int mm_mt_init(int mode)
+{
+  int i;
+
+  pthread_mutex_lock(&heap_lock);
+  mt_mode = mode & ~MT_ISOLATE;
+  mt_isolate = (mode & MT_ISOLATE) &&
+    (mt_mode == MT_CACHE_THREAD || mt_mode == MT_CACHE_CPU);
+  mt_gen++;
+  registry = NULL;
+  heap_misses = 0;
+  use_rseq = 0;
+  ncpu = 0;
+  memset(cpu_caches, 0, sizeof(cpu_caches));
+  memset(depot, 0, sizeof(depot));
+  memset(owners, 0, sizeof(owners));
+  nowners = 0;
+
+  if (mt_mode == MT_CACHE_CPU) {
+    ncpu = (int)sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpu < 1)
+      ncpu = 1;
+    use_rseq = rseq_available() && ncpu <= MT_MAXCPU;
+    if (ncpu > MT_MAXCPU)
+      ncpu = MT_MAXCPU;
+    for (i = 0; i < ncpu; i++)
+      if ((cpu_caches[i] = cache_new()) == NULL) {
+        pthread_mutex_unlock(&heap_lock);
+        return -1;
+      }
+  }
+  pthread_mutex_unlock(&heap_lock);
+  return 0;
+}
+
+/*
+ * mm_mt_malloc - Allocate a block with at least size bytes of payload
+ */
+void *mm_mt_malloc(size_t size)
+{
+  void *p;
+  int cls;
+
+  if (size == 0)
+    return NULL;
+
+  if (mt_mode == MT_CACHE_NONE || size > MT_MAXSMALL) {
+    pthread_mutex_lock(&heap_lock);
+    p = heap_alloc(size, MT_HEAP);
+    heap_misses++;
+    pthread_mutex_unlock(&heap_lock);
+    return p;
+  }
+
+  cls = MT_CLASS(size);
+  if (mt_mode == MT_CACHE_SHARED)
+    p = depot_pop(cls);
+  else
+    p = cache_pop(cls, 1);
+  if (p != NULL)
+    return p;
+  if (mt_isolate)
+    return refill_isolated(cls);
+  return refill(cls);
+}
+
+/*
+ * mm_mt_free - Return a block to the calling thread's (or CPU's) cache
+ */
+void mm_mt_free(void *ptr)
+{
+  int cls, owner;
+
+  if (ptr == NULL)
+    return;
+
+  cls = HDR_CLASS(ptr);
+  if (cls == MT_HEAP) {
+    pthread_mutex_lock(&heap_lock);
+    heap_free(ptr);
+    pthread_mutex_unlock(&heap_lock);
+    return;
+  }
+
+  if ((owner = HDR_OWNER(ptr)) != 0) {
+    /* Carved objects only ever go back to their owner */
+    if (cache_push(cls, owner, ptr) != 0)
+      remote_push(owners[owner], cls, ptr);
+    return;
+  }
+
+  if (mt_mode == MT_CACHE_SHARED || cache_push(cls, 0, ptr) != 0)
+    flush(cls, ptr);
+}
+
+/*
+ * mm_mt_realloc - Heap-owned blocks that stay heap-owned are resized by
+ *     mm_realloc; everything else is moved.
+ */
+void *mm_mt_realloc(void *ptr, size_t size)
+{
+  char *newp;
+  size_t oldsize;
+
+  if (size == 0) {
+    mm_mt_free(ptr);
+    return NULL;
+  }
+  if (ptr == NULL)
+    return mm_mt_malloc(size);
+
+  oldsize = HDR_SIZE(ptr);
+  if (HDR_CLASS(ptr) == MT_HEAP) {
+    if (mt_mode == MT_CACHE_NONE || size > MT_MAXSMALL) {
+      pthread_mutex_lock(&heap_lock);
+      newp = mm_realloc((char *)ptr - MT_HDR, size + MT_HDR);
+      pthread_mutex_unlock(&heap_lock);
+      if (newp == NULL)
+        return NULL;
+      newp += MT_HDR;
+      HDR(newp) = PACK_HDR(size, 0, MT_HEAP);
+      return newp;
+    }
+  } else if (size <= oldsize)
+    return ptr;
+
+  if ((newp = mm_mt_malloc(size)) == NULL)
+    return NULL;
+  mm_bulk_copy(newp, ptr, size < oldsize ? size : oldsize);
+  mm_mt_free(ptr);
+  return newp;
+}
+
+/*
+ * mm_mt_reserve - mm_reserve for the front end.  MM_RESERVE_CARVE first
+ *     fills every class list of the depot with MT_BATCH objects, so the
+ *     first small requests of all threads are served without the heap
+ *     lock (not under MT_ISOLATE, whose runs belong to one thread, nor
+ *     without caches).  Return -1 on error, 0 on success.
+ */
+int mm_mt_reserve(size_t bytes, int flags)
+{
+  void *p;
+  int cls, i, ret;
+
+  pthread_mutex_lock(&heap_lock);
+  if ((flags & MM_RESERVE_CARVE) && mt_mode != MT_CACHE_NONE && !mt_isolate)
+    for (cls = 0; cls < MT_NCLASS; cls++)
+      for (i = 0; i < MT_BATCH; i++) {
+        if ((p = heap_alloc(MT_CLASS_SIZE(cls), cls)) == NULL) {
+          pthread_mutex_unlock(&heap_lock);
+          return -1;
+        }
+        depot_push(cls, p);
+      }
+  ret = mm_reserve(bytes, flags);
+  pthread_mutex_unlock(&heap_lock);
+  return ret;
+}
+
+/*
+ * mm_mt_thread_exit - Flush the calling thread's cache back to the heap
+ *     (under MT_ISOLATE, leave it for adoption).  Threads that exit
+ *     through pthread_exit or by returning are flushed automatically;
+ *     this is for threads that want to do it earlier.
+ */
+void mm_mt_thread_exit(void)
+{
+  mt_cache_t *c = tcache;
+
+  if (c == NULL)
+    return;
+  tcache = NULL;
+  pthread_setspecific(tcache_key, NULL);
+
+  pthread_mutex_lock(&heap_lock);
+  if (c->gen == mt_gen) {
+    if (mt_isolate)
+      c->dead = 1;
+    else
+      cache_drain(c);
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * mm_mt_stats - Sum the bookkeeping of every live cache.  The numbers
+ *     are only exact while no other thread is allocating.
+ */
+void mm_mt_stats(mt_stats_t *stats)
+{
+  pthread_mutex_lock(&heap_lock);
+  gather(stats);
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * gather - The body of mm_mt_stats (heap_lock held)
+ */
+static void gather(mt_stats_t *stats)
+{
+  mt_cache_t *c;
+  int cls;
+
+  memset(stats, 0, sizeof(*stats));
+  for (c = registry; c != NULL; c = c->next) {
+    for (cls = 0; cls < MT_NCLASS; cls++)
+      stats->cached_bytes += c->top[cls] * (MT_CLASS_SIZE(cls) + MT_HDR);
+    /* remote objects counted at the smallest class size */
+    stats->cached_bytes += c->remote_count * (MT_STEP + MT_HDR);
+    stats->meta_bytes += sizeof(mt_cache_t) + MT_LINE;
+    stats->hits += c->hits;
+    stats->misses += c->misses;
+    stats->ncaches++;
+  }
+  for (cls = 0; cls < MT_NCLASS; cls++) {
+    stats->cached_bytes += depot[cls].count * (MT_CLASS_SIZE(cls) + MT_HDR);
+    stats->hits += depot[cls].hits;
+  }
+  stats->misses += heap_misses;
+  stats->rseq = use_rseq;
+}
+
+/*
+ * publish - Copy the cache counters into the mm_shm block (heap_lock
+ *     held)
+ */
+static void publish(void)
+{
+  mt_stats_t stats;
+
+  gather(&stats);
+  mm_shm_begin();
+  mm_shm->cache.hits = stats.hits;
+  mm_shm->cache.misses = stats.misses;
+  mm_shm->cache.cached_bytes = stats.cached_bytes;
+  mm_shm->cache.ncaches = stats.ncaches;
+  mm_shm->cache.mode = mt_mode | (mt_isolate ? MT_ISOLATE : 0);
+  mm_shm_end();
+}
+
+/*
+ * mm_mt_modename - Printable name of a cache mode
+ */
+const char *mm_mt_modename(int mode)
+{
+  switch (mode) {
+  case MT_CACHE_THREAD:
+    return "thread";
+  case MT_CACHE_THREAD | MT_ISOLATE:
+    return "thread+iso";
+  case MT_CACHE_CPU:
+    return "cpu";
+  case MT_CACHE_CPU | MT_ISOLATE:
+    return "cpu+iso";
+  case MT_CACHE_SHARED:
+    return "shared";
+  default:
+    return "none";
+  }
+}
+
+/* $begin helper functions */
+
+/*
+ * heap_alloc - Allocate a tagged object from the heap (heap_lock held)
+ */
+static void *heap_alloc(size_t size, int cls)
+{
+  char *p;
+
+  if (mm_shm != NULL && ++heap_trips % MT_PUBLISH == 0)
+    publish();
+  if ((p = mm_malloc(size + MT_HDR)) == NULL)
+    return NULL;
+  p += MT_HDR;
+  HDR(p) = PACK_HDR(size, 0, cls);
+  return p;
+}
+
+/*
+ * heap_free - Return a tagged object to the heap (heap_lock held)
+ */
+static void heap_free(void *p)
+{
+  if (mm_shm != NULL && ++heap_trips % MT_PUBLISH == 0)
+    publish();
+  mm_free((char *)p - MT_HDR);
+}
+
+/*
+ * cache_new - Allocate an empty, line-aligned cache from the heap and
+ *     add it to the registry (heap_lock held)
+ */
+static mt_cache_t *cache_new(void)
+{
+  char *raw;
+  mt_cache_t *c;
+
+  if ((raw = mm_malloc(sizeof(mt_cache_t) + MT_LINE)) == NULL)
+    return NULL;
+  c = (mt_cache_t *)(((size_t)raw + MT_LINE - 1) & ~(size_t)(MT_LINE - 1));
+  memset(c, 0, sizeof(*c));
+  pthread_mutex_init(&c->lock, NULL);
+  c->raw = raw;
+  c->gen = mt_gen;
+  if (mt_isolate) {
+    if (nowners == MT_MAXOWNER - 1) {
+      mm_free(raw);
+      return NULL;
+    }
+    c->id = ++nowners;
+    owners[c->id] = c;
+  }
+  c->next = registry;
+  registry = c;
+  return c;
+}
+
+/*
+ * cache_drain - Return every object of c and c itself to the heap and
+ *     drop it from the registry (heap_lock held)
+ */
+static void cache_drain(mt_cache_t *c)
+{
+  mt_cache_t **pp;
+  int cls;
+
+  for (pp = &registry; *pp != NULL; pp = &(*pp)->next)
+    if (*pp == c) {
+      *pp = c->next;
+      break;
+    }
+
+  for (cls = 0; cls < MT_NCLASS; cls++)
+    while (c->top[cls] > 0)
+      heap_free(c->slots[cls][--c->top[cls]]);
+  pthread_mutex_destroy(&c->lock);
+  mm_free(c->raw);
+}
+
+/*
+ * tcache_destroy - pthread key destructor, flushes an exiting thread
+ */
+static void tcache_destroy(void *arg)
+{
+  mt_cache_t *c = arg;
+
+  pthread_mutex_lock(&heap_lock);
+  if (c->gen == mt_gen) {
+    if (mt_isolate)
+      c->dead = 1;
+    else
+      cache_drain(c);
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+static void tcache_key_init(void)
+{
+  pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/*
+ * thread_cache - The calling thread's cache, created (or, under
+ *     MT_ISOLATE, adopted from an exited thread) on first use.  Returns
+ *     NULL if the heap is out of memory.
+ */
+static mt_cache_t *thread_cache(void)
+{
+  mt_cache_t *c;
+
+  if (tcache != NULL && tcache->gen == mt_gen)
+    return tcache;
+
+  pthread_once(&tcache_once, tcache_key_init);
+  pthread_mutex_lock(&heap_lock);
+  tcache = NULL;
+  if (mt_isolate)
+    for (c = registry; c != NULL && tcache == NULL; c = c->next)
+      if (c->dead) {
+        c->dead = 0;
+        tcache = c;
+      }
+  if (tcache == NULL)
+    tcache = cache_new();
+  pthread_mutex_unlock(&heap_lock);
+  pthread_setspecific(tcache_key, tcache);
+  return tcache;
+}
+
+/*
+ * current_cache - The cache the calling thread allocates from right now
+ */
+static mt_cache_t *current_cache(void)
+{
+  int cpu;
+
+  if (mt_mode == MT_CACHE_THREAD)
+    return thread_cache();
+#ifdef HAVE_RSEQ
+  if (use_rseq && (cpu = rseq_cpu()) >= 0)
+    return cpu_caches[cpu];
+#endif
+  cpu = sched_getcpu();
+  return cpu_caches[(cpu < 0 ? 0 : cpu) % ncpu];
+}
+
+/*
+ * cache_pop - Take one object of class cls from the calling thread's
+ *     (or CPU's) cache, NULL if it has none.  If count is set the
+ *     outcome is recorded as a hit or a miss.
+ */
+static void *cache_pop(int cls, int count)
+{
+  mt_cache_t *c;
+  void *p = NULL;
+  int cpu;
+
+  if (mt_mode == MT_CACHE_THREAD) {
+    if ((c = thread_cache()) == NULL)
+      return NULL;
+    if (c->top[cls] > 0)
+      p = c->slots[cls][--c->top[cls]];
+  }
+#ifdef HAVE_RSEQ
+  else if (use_rseq) {
+    /* The caches are changed under rseq alone, so a thread without
+       rseq must not take their locks: it goes without a cache */
+    int ret = 1;
+    c = NULL;
+    while ((cpu = rseq_cpu()) >= 0) {
+      c = cpu_caches[cpu];
+      if ((ret = rseq_pop(c, cls, cpu, &p)) >= 0)
+        break;
+    }
+    if (c == NULL)
+      return NULL;
+    if (ret != 0)
+      p = NULL;
+  }
+#endif
+  else {
+    cpu = sched_getcpu();
+    c = cpu_caches[(cpu < 0 ? 0 : cpu) % ncpu];
+    pthread_mutex_lock(&c->lock);
+    if (c->top[cls] > 0)
+      p = c->slots[cls][--c->top[cls]];
+    pthread_mutex_unlock(&c->lock);
+  }
+
+  if (count) {
+    if (p != NULL)
+      c->hits++;
+    else
+      c->misses++;
+  }
+  return p;
+}
+
+/*
+ * cache_push - Put p on class cls of the calling thread's (or CPU's)
+ *     cache, if owner is 0 or the cache's owner id.  Return nonzero if
+ *     the cache had no room or belongs to another owner.
+ */
+static int cache_push(int cls, int owner, void *p)
+{
+  mt_cache_t *c;
+  int cpu, full = 0;
+
+  if (mt_mode == MT_CACHE_THREAD) {
+    if ((c = thread_cache()) == NULL || (owner != 0 && c->id != owner) ||
+        c->top[cls] == MT_CAP)
+      return 1;
+    c->slots[cls][c->top[cls]++] = p;
+    return 0;
+  }
+#ifdef HAVE_RSEQ
+  if (use_rseq) {
+    /* The owner is checked on the cache of cpu, and the push commits
+       only if the thread is still on cpu.  Without rseq the thread
+       goes without a cache, as in cache_pop. */
+    int ret;
+    while ((cpu = rseq_cpu()) >= 0) {
+      c = cpu_caches[cpu];
+      if (owner != 0 && c->id != owner)
+        return 1;
+      if ((ret = rseq_push(c, cls, cpu, p)) >= 0)
+        return ret;
+    }
+    return 1;
+  }
+#endif
+  cpu = sched_getcpu();
+  c = cpu_caches[(cpu < 0 ? 0 : cpu) % ncpu];
+  if (owner != 0 && c->id != owner)
+    return 1;
+  pthread_mutex_lock(&c->lock);
+  if (c->top[cls] == MT_CAP)
+    full = 1;
+  else
+    c->slots[cls][c->top[cls]++] = p;
+  pthread_mutex_unlock(&c->lock);
+  return full;
+}
+
+/*
+ * depot_push - Push p on the shared class list cls (lock free)
+ */
+static void depot_push(int cls, void *p)
+{
+  mt_depot_t *d = &depot[cls];
+  unsigned off = (char *)p - (char *)mem_heap_lo() + 1;
+  unsigned long old, new;
+
+  old = __atomic_load_n(&d->head, __ATOMIC_RELAXED);
+  do {
+    DEPOT_LINK(p) = DEPOT_OFF(old);
+    new = DEPOT_HEAD(DEPOT_TAG(old) + 1, off);
+  } while (!__atomic_compare_exchange_n(&d->head, &old, new, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  __atomic_fetch_add(&d->count, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * depot_pop - Pop the shared class list cls (lock free), NULL if empty
+ */
+static void *depot_pop(int cls)
+{
+  mt_depot_t *d = &depot[cls];
+  char *base = mem_heap_lo();
+  unsigned long old, new;
+  char *p;
+
+  old = __atomic_load_n(&d->head, __ATOMIC_ACQUIRE);
+  do {
+    if (DEPOT_OFF(old) == 0)
+      return NULL;
+    p = base + DEPOT_OFF(old) - 1;
+    new = DEPOT_HEAD(DEPOT_TAG(old) + 1, (unsigned)DEPOT_LINK(p));
+  } while (!__atomic_compare_exchange_n(&d->head, &old, new, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+  __atomic_fetch_sub(&d->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&d->hits, 1, __ATOMIC_RELAXED);
+  return p;
+}
+
+/*
+ * refill - Gather a batch of class cls objects, from the depot if it
+ *     has any and otherwise from the heap in one lock hold; return one
+ *     and stash the rest in the calling thread's cache (the depot in
+ *     MT_CACHE_SHARED mode)
+ */
+static void *refill(int cls)
+{
+  void *batch[MT_BATCH];
+  size_t size = MT_CLASS_SIZE(cls);
+  int i, n = 0;
+
+  if (mt_mode != MT_CACHE_SHARED)
+    while (n < MT_BATCH && (batch[n] = depot_pop(cls)) != NULL)
+      n++;
+
+  if (n == 0) {
+    pthread_mutex_lock(&heap_lock);
+    for (n = 0; n < MT_BATCH; n++)
+      if ((batch[n] = heap_alloc(size, cls)) == NULL)
+        break;
+    pthread_mutex_unlock(&heap_lock);
+    if (n == 0)
+      return NULL;
+  }
+
+  i = 1;
+  if (mt_mode != MT_CACHE_SHARED)
+    for (; i < n; i++)
+      if (cache_push(cls, 0, batch[i]) != 0)
+        break;
+  for (; i < n; i++)
+    depot_push(cls, batch[i]);
+  return batch[0];
+}
+
+/*
+ * flush - The cache has no room for p (or there is no cache): hand p
+ *     and up to MT_BATCH-1 cached objects of the same class to the
+ *     depot, or to the heap once the depot holds MT_DEPOT_MAX of them
+ */
+static void flush(int cls, void *p)
+{
+  void *batch[MT_BATCH];
+  int i, n = 1;
+
+  batch[0] = p;
+  if (mt_mode != MT_CACHE_SHARED)
+    while (n < MT_BATCH && (batch[n] = cache_pop(cls, 0)) != NULL)
+      n++;
+
+  if (__atomic_load_n(&depot[cls].count, __ATOMIC_RELAXED) < MT_DEPOT_MAX) {
+    for (i = 0; i < n; i++)
+      depot_push(cls, batch[i]);
+    return;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  for (i = 0; i < n; i++)
+    heap_free(batch[i]);
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * remote_push - Hand carved object p back to its owner c (lock free)
+ */
+static void remote_push(mt_cache_t *c, int cls, void *p)
+{
+  void *old = __atomic_load_n(&c->remote[cls], __ATOMIC_RELAXED);
+
+  do {
+    *(void **)p = old;
+  } while (!__atomic_compare_exchange_n(&c->remote[cls], &old, p, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  __atomic_fetch_add(&c->remote_count, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * refill_isolated - MT_ISOLATE refill: take over everything returned
+ *     to the calling thread's cache, or carve a fresh run of MT_BATCH
+ *     objects in whole cache lines of one heap block
+ */
+static void *refill_isolated(int cls)
+{
+  mt_cache_t *c;
+  size_t stride = MT_CLASS_SIZE(cls) + MT_HDR;
+  char *list, *raw, *run, *p;
+  long n = 0;
+  int i;
+
+  if ((c = current_cache()) == NULL)
+    return NULL;
+
+  /* Pushers only ever add, so taking the whole list is ABA-safe */
+  if ((list = __atomic_exchange_n(&c->remote[cls], NULL, __ATOMIC_ACQUIRE))) {
+    p = list;
+    list = *(void **)p;
+    n = 1;
+    while (list != NULL) {
+      char *next = *(void **)list;
+      if (cache_push(cls, c->id, list) != 0)
+        remote_push(c, cls, list);
+      else
+        n++;
+      list = next;
+    }
+    __atomic_fetch_sub(&c->remote_count, n, __ATOMIC_RELAXED);
+    return p;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  raw = mm_malloc(LINE_ALIGN(MT_BATCH * stride) + MT_LINE);
+  pthread_mutex_unlock(&heap_lock);
+  if (raw == NULL)
+    return NULL;
+
+  run = (char *)LINE_ALIGN(raw);
+  for (i = MT_BATCH - 1; i >= 0; i--) {
+    p = run + i * stride + MT_HDR;
+    HDR(p) = PACK_HDR(MT_CLASS_SIZE(cls), c->id, cls);
+    if (i > 0 && cache_push(cls, c->id, p) != 0)
+      remote_push(c, cls, p);
+  }
+  return p;
+}
+
+/* $end helper functions */
@@ -0,0 +1,38 @@
+/*
+ * mm_mt.h - thread-safe small-object front end for the mm package.
+ *
+ * The mm package itself is single threaded; mm_mt serializes it behind
+ * one heap lock and keeps small objects in per-thread or per-CPU caches
+ * and lock-free per-class lists so that most requests never take that
+ * lock.
+ */
+#include <stddef.h>
+
+/* Cache modes for mm_mt_init */
+#define MT_CACHE_NONE    0   /* every request takes the heap lock */
+#define MT_CACHE_THREAD  1   /* one cache per thread */
+#define MT_CACHE_CPU     2   /* one cache per CPU (rseq, locked fallback) */
+#define MT_CACHE_SHARED  3   /* no caches, only the lock-free class lists */
+
+/* Add to MT_CACHE_THREAD or MT_CACHE_CPU: never let objects of two
+   caches share a cache line (avoids false sharing between threads) */
+#define MT_ISOLATE       0x100
+
+/* Snapshot of the front end's bookkeeping, summed over all caches */
+typedef struct {
+  size_t cached_bytes;  /* bytes of free objects in caches and lists */
+  size_t meta_bytes;    /* bytes of cache structures themselves */
+  long hits;            /* requests served by a cache */
+  long misses;          /* requests that had to take the heap lock */
+  int ncaches;          /* number of live caches */
+  int rseq;             /* per-CPU mode runs on rseq, not the fallback */
+} mt_stats_t;
+
+extern int mm_mt_init(int mode);
+extern void *mm_mt_malloc(size_t size);
+extern void mm_mt_free(void *ptr);
+extern void *mm_mt_realloc(void *ptr, size_t size);
+extern int mm_mt_reserve(size_t bytes, int flags);
+extern void mm_mt_thread_exit(void);
+extern void mm_mt_stats(mt_stats_t *stats);
+extern const char *mm_mt_modename(int mode);
@@ -0,0 +1,29 @@
+/*
+ * mm_null.c - An allocator that does nothing, for calibrating the driver.
+ *
+ * mdriver replays every trace through these functions as well as through
+ * the mm package and subtracts the time, so that the throughput it
+ * reports is the allocator's alone and not the cost of the replay loop.
+ * They live in their own file so that, like the mm package, every call
+ * to them is a real call that the compiler cannot inline or drop.
+ */
+#include <stddef.h>
+
+#include "mm_null.h"
+
+/* Every request gets the same dummy payload */
+static char null_block[16];
+
+void *null_malloc(size_t size)
+{
+  return null_block;
+}
+
+void null_free(void *ptr)
+{
+}
+
+void *null_realloc(void *ptr, size_t size)
+{
+  return size ? null_block : NULL;
+}
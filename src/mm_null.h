@@ -0,0 +1,8 @@
+/*
+ * mm_null.h - do-nothing allocator used to measure the driver's overhead
+ */
+#include <stddef.h>
+
+extern void *null_malloc(size_t size);
+extern void null_free(void *ptr);
+extern void *null_realloc(void *ptr, size_t size);
@@ -0,0 +1,109 @@
+/*
+ * mm_shm.c - publish allocator statistics in shared memory (see mm_shm.h)
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mm_shm.h"
+
+mm_shm_t *mm_shm = NULL;
+static char shm_name[64];
+
+/*
+ * mm_shm_open - Create the shared-memory segment name (default
+ *     /mmstats.<pid>) and start publishing to it.  Returns -1 on error.
+ */
+int mm_shm_open(const char *name)
+{
+  mm_shm_t *s;
+  int fd;
+
+  if (mm_shm != NULL)
+    mm_shm_close();
+  if (name == NULL)
+    snprintf(shm_name, sizeof(shm_name), "/mmstats.%ld", (long)getpid());
+  else
+    snprintf(shm_name, sizeof(shm_name), "%s", name);
+
+  if ((fd = shm_open(shm_name, O_CREAT | O_RDWR | O_TRUNC, 0644)) < 0)
+    return -1;
+  if (ftruncate(fd, sizeof(mm_shm_t)) < 0) {
+    close(fd);
+    shm_unlink(shm_name);
+    return -1;
+  }
+  s = mmap(NULL, sizeof(mm_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (s == MAP_FAILED) {
+    shm_unlink(shm_name);
+    return -1;
+  }
+
+  memset(s, 0, sizeof(*s));
+  s->version = MM_SHM_VERSION;
+  s->size = sizeof(mm_shm_t);
+  s->pid = getpid();
+  s->stamp = mm_shm_now();
+  __sync_synchronize();
+  s->magic = MM_SHM_MAGIC;         /* readers check this last */
+  mm_shm = s;
+  return 0;
+}
+
+/*
+ * mm_shm_close - Stop publishing and remove the segment
+ */
+void mm_shm_close(void)
+{
+  if (mm_shm == NULL)
+    return;
+  munmap(mm_shm, sizeof(mm_shm_t));
+  shm_unlink(shm_name);
+  mm_shm = NULL;
+}
+
+/*
+ * mm_shm_begin, mm_shm_end - Bracket an update of the block.  Callers
+ *     serialize their updates (mm is single threaded, and mm_mt holds
+ *     its heap lock).
+ */
+void mm_shm_begin(void)
+{
+  mm_shm->seq++;
+  __sync_synchronize();
+}
+
+void mm_shm_end(void)
+{
+  mm_shm->updates++;
+  mm_shm->stamp = mm_shm_now();
+  __sync_synchronize();
+  mm_shm->seq++;
+}
+
+/*
+ * mm_shm_bucket - Latency bucket of ns nanoseconds
+ */
+int mm_shm_bucket(double ns)
+{
+  int b = 0;
+
+  while (b < MM_SHM_BUCKETS - 1 && ns >= (double)(1 << (b + MM_SHM_MINLOG)))
+    b++;
+  return b;
+}
+
+/*
+ * mm_shm_now - CLOCK_MONOTONIC in seconds
+ */
+double mm_shm_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,76 @@
+/*
+ * mm_shm.h - live allocator statistics in a named shared-memory segment.
+ *
+ * A process that calls mm_shm_open publishes one mm_shm_t block under
+ * /dev/shm.  The allocator keeps its counters in private memory and
+ * copies them into the block only on slow paths (heap growth, mapping
+ * calls, heap-lock round trips of mm_mt, and every MM_SHM_PERIOD
+ * requests), so the block may lag the process a little.  Every copy is
+ * bracketed by a sequence count that is odd while the copy is under
+ * way; readers such as mmtop map the block read-only and retry until
+ * they see the same even count before and after reading.
+ */
+#include <stddef.h>
+
+#define MM_SHM_MAGIC   0x6d6d7374  /* "mmst" */
+#define MM_SHM_VERSION 2           /* bumped whenever mm_shm_t changes */
+#define MM_SHM_PERIOD  4096        /* mm requests between refreshes */
+#define MM_SHM_CLASSES 24          /* class c: blocks of [2^(c+4), 2^(c+5)) bytes */
+#define MM_SHM_BUCKETS 16          /* log2 latency buckets ... */
+#define MM_SHM_MINLOG  8           /* ... the first is < 2^MM_SHM_MINLOG ns */
+
+/* Counters kept by mm */
+typedef struct {
+  size_t heap_bytes;               /* heap size (brk) */
+  size_t mapped_bytes;             /* bytes in mappings for large blocks */
+  size_t live_bytes;               /* bytes in allocated blocks */
+  size_t free_bytes;               /* bytes in free heap blocks */
+  size_t largest_free;             /* bytes in the largest of them */
+  long sbrk_calls;                 /* heap extensions */
+  long map_calls, unmap_calls;     /* mappings made and released */
+  long map_hits;                   /* large requests served by the map cache */
+  long mallocs, frees, reallocs;
+  long live_blocks[MM_SHM_CLASSES];
+  long free_blocks[MM_SHM_CLASSES];
+  long slow_ns[MM_SHM_BUCKETS];    /* latency of heap extension and mapping */
+} mm_heap_stats_t;
+
+/* Counters kept by the mm_mt front end */
+typedef struct {
+  long hits;                       /* requests served by a cache */
+  long misses;                     /* requests that took the heap lock */
+  size_t cached_bytes;             /* bytes of free objects in caches */
+  int ncaches;                     /* number of live caches */
+  int mode;                        /* cache mode of mm_mt_init */
+} mm_cache_stats_t;
+
+/* The published block */
+typedef struct {
+  unsigned magic;                  /* MM_SHM_MAGIC */
+  unsigned version;                /* MM_SHM_VERSION */
+  unsigned size;                   /* sizeof(mm_shm_t) */
+  volatile unsigned seq;           /* odd while being written */
+  long pid;                        /* publishing process */
+  unsigned long updates;           /* refreshes so far */
+  double stamp;                    /* CLOCK_MONOTONIC seconds of the last */
+  mm_heap_stats_t heap;
+  mm_cache_stats_t cache;
+} mm_shm_t;
+
+/* The block of this process, NULL unless publishing */
+extern mm_shm_t *mm_shm;
+
+extern int mm_shm_open(const char *name);
+extern void mm_shm_close(void);
+extern void mm_shm_begin(void);
+extern void mm_shm_end(void);
+extern int mm_shm_bucket(double ns);
+extern double mm_shm_now(void);
+
+/* Statistics class of a block of size bytes */
+static inline int mm_shm_class(size_t size)
+{
+  int c = 59 - __builtin_clzl(size | 31);  /* floor(log2(size)) - 4 */
+
+  return c < MM_SHM_CLASSES - 1 ? c : MM_SHM_CLASSES - 1;
+}
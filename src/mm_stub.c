@@ -0,0 +1,62 @@
+/*
+ * mm_stub.c - mm's optional entry points for the allocators that lack
+ *     them (mm_work.c, mm-implicit.c, mm-naive.c, mm-page.c), so that
+ *     those link with the driver and mm_mt.  Reservations only prefault
+ *     what is already there, the tunables are ignored, no object is
+ *     ever worth moving, the free space goes uncounted and there are
+ *     no checkpoints.
+ */
+#include <stddef.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+int mm_reserve(size_t bytes, int flags)
+{
+  if (flags & MM_RESERVE_PREFAULT)
+    mem_prefault(mem_heap_lo(), mem_heapsize());
+  return 0;
+}
+
+void mm_set_search_budget(unsigned nodes)
+{
+}
+
+void mm_set_map_cache(size_t bytes)
+{
+}
+
+int mm_ctl(const char *name, size_t *oldval, const size_t *newval)
+{
+  return -1;
+}
+
+const char *mm_ctl_name(int i)
+{
+  return NULL;
+}
+
+int mm_defrag_hint(void *ptr)
+{
+  return 0;
+}
+
+size_t mm_defrag(void **objs, size_t n, mm_fixup_t fixup, void *arg)
+{
+  return 0;
+}
+
+int mm_census(mm_census_t *census)
+{
+  return -1;
+}
+
+long mm_save(void *buf, size_t len)
+{
+  return -1;
+}
+
+int mm_restore(const void *buf, size_t len)
+{
+  return -1;
+}
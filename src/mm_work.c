@@ -12,6 +12,8 @@
 
 #include "mm.h"
 #include "memlib.h"
+#include "mm_cachesim.h"
+#include "mm_demand.h"
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
@@ -31,11 +33,16 @@
 #define FIRST_FIT
 // #define BEST_FIT
 
-/* single word (4) or double word (8) alignment */
+/* double word (8) alignment, or 16 (build with -DALIGNMENT=16) for the
+ * x86-64 ABI.  Block pointers are ALIGNMENT-aligned and blocks are
+ * multiples of ALIGNMENT, so the 4-byte tags need no padding (see mm.c);
+ * the initial heap is sized so that the first block starts aligned */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
 
 /* Use macros and global values from the textbook */
 #define WSIZE       4       /* Word size (bytes) */
@@ -43,6 +50,9 @@
 #define QSIZE       16      /* Quad word size (bytes) */
 #define CHUNKSIZE  (1<<12)  /* Extend heap by this amount (bytes) */
 #define OVERHEAD    8       /* overhead of header and footer (bytes) */
+#define MINBLOCK   ALIGN(QSIZE + OVERHEAD) /* free list links and tags */
+#define PROLOGUE   ALIGN(OVERHEAD)  /* keeps the prologue payload, and the
+                                       first block, ALIGNMENT-aligned */
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))
 
@@ -50,11 +60,11 @@
 #define PACK(size, alloc)  ((size) | (alloc))
 
 /* Read and write a word at address p */
-#define GET(p)            (*(unsigned int *)(p))
-#define PUT(p, val)       (*(unsigned int *)(p) = (val))
-#define GET_8(p)          (*(unsigned long *)(p))
-#define PUT_8(p, val)     (*(unsigned long *)(p) = (unsigned long)(val))
-#define GET_8add(p)       ((char **)(p))
+#define GET(p)            (*SIM((unsigned int *)(p), WSIZE))
+#define PUT(p, val)       (*SIM((unsigned int *)(p), WSIZE) = (val))
+#define GET_8(p)          (*SIM((unsigned long *)(p), DSIZE))
+#define PUT_8(p, val)     (*SIM((unsigned long *)(p), DSIZE) = (unsigned long)(val))
+#define GET_8add(p)       (SIM((char **)(p), DSIZE))
 #define PUT_8add(p, val)  ((char **)(p) = (unsigned long)(val))
 
 /* Read the size and allocated fields from address p */
@@ -106,40 +116,38 @@ static void checkblock(void *bp);
   static int get_segid(size_t asize);
   static inline void *get_root(int segid, void *newroot);
   static inline void *get_rootd(size_t size);
-  static inline void root_init();
+  static inline void root_init(void);
 #endif
 
 /*
  * Initialize: return -1 on error, 0 on success.
  */
 int mm_init(void) {
+  int i;
+
+  mm_demand_reset();
+
   /* Create the initial empty heap */
-  if ((heap_listp = mem_sbrk(18*DSIZE)) == (void *)-1)
+  if ((heap_listp = mem_sbrk(SEG_SIZE*3*DSIZE + ALIGNMENT + PROLOGUE)) == (void *)-1)
     return -1;
 
+  /* One sentinel per list: a zero-size header, then NEXT and PREV.
+   * find_fit reaches the sentinels at the tail of every list and must
+   * neither read outside the heap nor take them for a fit, and a push
+   * writes PREV of the sentinel, so each header needs a word of its own */
   start_root = heap_listp;
-  PUT_8(heap_listp, 0);           /* Group 1 */
-  PUT_8(heap_listp+DSIZE, 0);     /* Group 1 */
-  PUT_8(heap_listp+DSIZE*2, 0);   /* Group 2 */
-  PUT_8(heap_listp+DSIZE*3, 0);   /* Group 2 */
-  PUT_8(heap_listp+DSIZE*4, 0);   /* Group 3 */
-  PUT_8(heap_listp+DSIZE*5, 0);   /* Group 3 */
-  PUT_8(heap_listp+DSIZE*6, 0);   /* Group 4 */
-  PUT_8(heap_listp+DSIZE*7, 0);   /* Group 4 */
-  PUT_8(heap_listp+DSIZE*8, 0);   /* Group 5 */
-  PUT_8(heap_listp+DSIZE*9, 0);   /* Group 5 */
-  PUT_8(heap_listp+DSIZE*10, 0);  /* Group 6 */
-  PUT_8(heap_listp+DSIZE*11, 0);  /* Group 6 */
-  PUT_8(heap_listp+DSIZE*12, 0);  /* Group 7 */
-  PUT_8(heap_listp+DSIZE*13, 0);  /* Group 7 */
-  PUT_8(heap_listp+DSIZE*14, 0);  /* Group 8 */
-  PUT_8(heap_listp+DSIZE*15, 0);  /* Group 8 */
-  PUT(heap_listp+DSIZE*16, 0);                            /* alignment padding */
-  PUT(heap_listp+DSIZE*16+WSIZE, PACK(OVERHEAD, 1));      /* prologue header */
-  PUT(heap_listp+DSIZE*17, PACK(OVERHEAD, 1));            /* prologue footer */
-  PUT(heap_listp+DSIZE*17+WSIZE, PACK(0, 1));             /* epilogue header */
-  heap_listp += DSIZE*17;                                 /* Reallocate heap_listp */
-  root_init(0);                                           /* Initialize root container */
+  for (i = 0; i < SEG_SIZE; i++) {
+    PUT_8(heap_listp, 0);                       /* Group i+1 header */
+    PUT_8(heap_listp+DSIZE, 0);                 /* Group i+1 NEXT */
+    PUT_8(heap_listp+QSIZE, 0);                 /* Group i+1 PREV */
+    heap_listp += 3*DSIZE;
+  }
+  PUT(heap_listp+ALIGNMENT-DSIZE, 0);                     /* alignment padding */
+  PUT(heap_listp+ALIGNMENT-WSIZE, PACK(PROLOGUE, 1));     /* prologue header */
+  PUT(heap_listp+ALIGNMENT+PROLOGUE-DSIZE, PACK(PROLOGUE, 1)); /* prologue footer */
+  PUT(heap_listp+ALIGNMENT+PROLOGUE-WSIZE, PACK(0, 1));   /* epilogue header */
+  heap_listp += ALIGNMENT;                                /* Reallocate heap_listp */
+  root_init();                                            /* Initialize root container */
 
   /* Extend the empty heap with a free block of CHUNKSIZE bytes */
   if ( extend_heap(CHUNKSIZE/WSIZE) == NULL )
@@ -153,6 +161,7 @@ int mm_init(void) {
  */
 void *mm_malloc(size_t size) {
   size_t asize;                              /* adjusted block size */
+  size_t rsize;                              /* asize rounded for demand */
   size_t extendsize;                         /* amount to extend heap if no fit */
   char *bp;
   if (heap_listp == NULL)
@@ -166,15 +175,15 @@ void *mm_malloc(size_t size) {
    *  Overhead is header and footer, 8 bytes
    *  Payload must be 16 bytes */
   if (size <= QSIZE)
-    asize = QSIZE + OVERHEAD;
-  else if (size <= 449 && size >= 448)  /* Special optimization for binary-bal */
-    asize = 512;
+    asize = MINBLOCK;
   else
-    asize = DSIZE * ((size + (OVERHEAD) + (DSIZE-1)) / DSIZE); /* Conform to alignment requirement */
+    asize = ALIGN(size + OVERHEAD);     /* Conform to alignment requirement */
+  rsize = mm_demand_round(asize);       /* Leave holes later requests fit */
 
   /* Search the free list for a fit */
-  if ((bp = find_fit(asize)) != NULL) {
-    place(bp, asize);
+  if ((bp = find_fit(rsize)) != NULL) {
+    mm_demand_fit(asize, GET_SIZE(HDRP(bp)));
+    place(bp, rsize);
 
 #ifdef DEBUG
   assert(in_heap(bp) == 1);
@@ -185,10 +194,11 @@ void *mm_malloc(size_t size) {
   }
 
   /* No fit found. Get more memory and place the block */
-  extendsize = MAX(asize, CHUNKSIZE);
+  mm_demand_fit(asize, 0);
+  extendsize = MAX(rsize, CHUNKSIZE);
   if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
     return NULL;
-  place(bp, asize);
+  place(bp, rsize);
 
 #ifdef DEBUG
   assert(in_heap(bp) == 1);
@@ -207,6 +217,7 @@ void mm_free(void *ptr) {
   size_t size = GET_SIZE(HDRP(ptr));
   if (heap_listp == NULL)
     mm_init();
+  mm_demand_free(size);
 
   /* alloc = 0 for footers and headers */
   PUT(HDRP(ptr), PACK(size, 0));
@@ -238,9 +249,9 @@ void *mm_realloc(void *oldptr, size_t size) {
     return 0;
 
   /* Copy the old data. */
-  oldsize = GET_SIZE(HDRP(oldptr));
+  oldsize = GET_SIZE(HDRP(oldptr)) - OVERHEAD;
   if (size < oldsize) oldsize = size;
-  memcpy(newptr, oldptr, oldsize);
+  memcpy(SIM(newptr, oldsize), SIM(oldptr, oldsize), oldsize);
 
   /* Free the old block. */
   mm_free(oldptr);
@@ -285,8 +296,8 @@ static void *extend_heap(size_t words)
   size_t size;
   void *return_ptr;
 
-  /* Allocate an even number of words to maintain alignment */
-  size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+  /* Allocate whole ALIGNMENT units to maintain alignment */
+  size = ALIGN(words * WSIZE);
   if ((long)(bp = mem_sbrk(size)) < 0)
     return NULL;
 
@@ -347,18 +358,20 @@ static void place(void *bp, size_t asize)
   size_t csize = GET_SIZE(HDRP(bp));
   int segid;
 
-  if ((csize - asize) >= (QSIZE + OVERHEAD)) {
+  /* Unlink while the header still holds the size of its list */
+  mm_unlink(bp);
+
+  if ((csize - asize) >= MINBLOCK) {
     /* Allocate Memory */
     PUT(HDRP(bp), PACK(asize, 1));
     PUT(FTRP(bp), PACK(asize, 1));
-    mm_unlink(bp);
 
     bp = NEXT_BLKP(bp);
     PUT(HDRP(bp), PACK(csize-asize, 0));
     PUT(FTRP(bp), PACK(csize-asize, 0));
 
-    /* Push remaining into linkedlist */
-    segid = get_segid(asize);
+    /* Push remaining into the list of its size */
+    segid = get_segid(csize-asize);
     NEXT(bp) = get_root(segid, NULL);
     PREV(bp) = NULL;
     PREV(get_root(segid, NULL)) = bp;
@@ -367,7 +380,6 @@ static void place(void *bp, size_t asize)
   else {
     PUT(HDRP(bp), PACK(csize, 1));
     PUT(FTRP(bp), PACK(csize, 1));
-    mm_unlink(bp);
   }
 }
 
@@ -434,10 +446,6 @@ static void *coalesce(void *bp)
 
   NEXT(thisHead) = get_root(segid, NULL);
 
-#ifdef DEBUG
-  assert(this_root != NULL);
-#endif
-
   PREV(thisHead) = NULL;
   PREV(get_root(segid, NULL)) = thisHead;
   get_root(segid, thisHead);
@@ -484,7 +492,7 @@ static inline void mm_unlink(void *bp)
    if (verbose)
      printf("Heap (%p):\n", heap_listp);
 
-   if ((GET_SIZE(HDRP(heap_listp)) != OVERHEAD) || !GET_ALLOC(HDRP(heap_listp)))
+   if ((GET_SIZE(HDRP(heap_listp)) != PROLOGUE) || !GET_ALLOC(HDRP(heap_listp)))
      printf("Bad prologue header %d\n", GET_SIZE(HDRP(heap_listp)) );
    checkblock(heap_listp);
 
@@ -541,9 +549,9 @@ static inline void mm_unlink(void *bp)
     return get_root( get_segid(size), NULL);
   }
 
-  static inline void root_init() {
+  static inline void root_init(void) {
     for (int i=0; i<SEG_SIZE; ++i)
-      get_root(i, start_root+i*2*DSIZE);
+      get_root(i, start_root+i*3*DSIZE+DSIZE);
   }
 
 #endif
@@ -580,8 +588,8 @@ static void printblock(void *bp)
 
 static void checkblock(void *bp)
 {
-  if ((size_t)bp % 8)
-    printf("Error: %p is not doubleword aligned\n", bp);
+  if ((size_t)bp % ALIGNMENT)
+    printf("Error: %p is not %d-byte aligned\n", bp, ALIGNMENT);
   if (GET(HDRP(bp)) != GET(FTRP(bp)))
     printf("Error: header does not match footer\n");
 }
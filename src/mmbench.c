@@ -0,0 +1,1078 @@
+/*
+ * mmbench.c - Synthetic multithreaded benchmarks for the mm_mt front end
+ *
+ * Unlike mdriver, which replays traces, mmbench runs small fixed access
+ * patterns that stress one property of the allocator at a time:
+ *
+ *   cache-thrash   every thread allocates its own small objects and then
+ *                  writes them over and over (active false sharing: the
+ *                  allocator itself puts objects of different threads
+ *                  on one cache line).
+ *   cache-scratch  the main thread allocates all objects and hands them
+ *                  out; every thread frees the ones it got, allocates
+ *                  its own and writes them (passive false sharing: a
+ *                  thread cache recycles lines still shared with others).
+ *   large-churn    one thread allocates, touches and frees buffers of a
+ *                  few MB and grows one by realloc from 256KB to 8MB,
+ *                  with mm's cache of freed large mappings off and on;
+ *                  it reports the time and the mmap/munmap calls made.
+ *   bulk-mix       one thread callocs buffers of a few MB and grows one
+ *                  by realloc to 8MB, and between these walks a hot
+ *                  working set of 256KB, with mm_bulk's streaming
+ *                  stores off and on; it reports the time of the bulk
+ *                  requests and of the walks, and the cache misses the
+ *                  walks take where the kernel lets us count them.
+ *   defrag         one thread allocates small objects, frees four in
+ *                  five at random and then compacts the survivors with
+ *                  mm_defrag until nothing moves; it reports the pages
+ *                  the survivors touch before and after, and the time.
+ *   obj-cache      one thread allocates up to a few dozen parser objects,
+ *                  each with a table its constructor computes, uses and
+ *                  frees them, round after round, first with mm_malloc
+ *                  and the constructor on every allocation, then from an
+ *                  mm_cache that keeps freed objects constructed; it
+ *                  reports the time and the constructor calls of each,
+ *                  and what reaping the cache frees and destructs.
+ *   epoch-stack    every thread pushes objects onto one lock-free stack
+ *                  and pops them off, freeing what it pops with
+ *                  mm_free_deferred, since the other threads may still
+ *                  be reading it; it reports the time and how many of
+ *                  the retired objects one thread held at most.
+ *
+ * The allocations are issued in strict round-robin order across the
+ * threads, so the placement, and hence the number of cache lines that
+ * hold objects of more than one thread, does not depend on scheduling
+ * or on how many CPUs the machine has.  That count is what false
+ * sharing avoidance (MT_ISOLATE) is meant to bring to zero; the write
+ * loop time shows what it costs on machines with several CPUs.
+ * large-churn, bulk-mix, defrag and obj-cache ignore the thread and
+ * object options, and epoch-stack the object count.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mm.h"
+#include "mm_mt.h"
+#include "mm_bulk.h"
+#include "mm_cache.h"
+#include "mm_epoch.h"
+#include "memlib.h"
+#include "config.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define LINESIZE    64 /* cache line size assumed by the sharing count */
+#define RUNS         3 /* keep the fastest of this many runs per mode */
+
+/* Default workload */
+#define DEF_THREADS  4
+#define DEF_OBJS     8
+#define DEF_SIZE     8
+#define DEF_ITERS    1000000
+
+/* large-churn workload */
+#define CHURN_ROUNDS 200       /* rounds of buffers and realloc growth */
+#define CHURN_MIN    (1<<18)   /* realloc growth starts here ... */
+#define CHURN_MAX    (1<<23)   /* ... and ends here (bytes) */
+#define CHURN_CACHE  (1<<25)   /* map cache size when it is on (bytes) */
+
+/* bulk-mix workload */
+#define BULK_ROUNDS  50        /* rounds of callocs and realloc growth */
+#define BULK_MIN     (1<<20)   /* realloc growth starts here ... */
+#define BULK_MAX     (1<<23)   /* ... and ends here (bytes) */
+#define BULK_HOT     (1<<18)   /* working set walked between requests */
+
+/* defrag workload */
+#define DEFRAG_OBJS  20000     /* objects allocated ... */
+#define DEFRAG_KEEP  5         /* ... of which one in this many survive */
+#define DEFRAG_MAX   256       /* object sizes are 16..DEFRAG_MAX bytes */
+#define DEFRAG_PAGE  4096      /* page size for the touched page count */
+
+/* obj-cache workload */
+#define OBJ_ROUNDS   100000    /* rounds of allocation, use and free */
+#define OBJ_LIVE     32        /* objects live at once, at most */
+
+/******************************
+ * The key compound data types
+ *****************************/
+
+/* One benchmark */
+typedef struct bench {
+	const char *name;
+	int scratch;          /* objects are handed out by the main thread */
+	void (*run)(const struct bench *bench);
+} bench_t;
+
+/* Per-thread state */
+typedef struct {
+	int id;
+	char **objs;          /* the thread's own objects */
+	char **handoff;       /* objects to free first (cache-scratch) */
+	int failed;
+	double start, end;    /* wall clock around the write loop */
+} bench_thread_t;
+
+/* An object with an expensive constructor: a parser whose CRC table
+   is computed when it is made */
+typedef struct {
+	unsigned table[256];
+	char line[128];
+	unsigned crc;
+} parser_t;
+
+/* An object on the epoch-stack stack */
+typedef struct stack_node {
+	struct stack_node *next;
+} stack_node_t;
+
+/* A cache line touched by an object of one thread */
+typedef struct {
+	unsigned long line;
+	int id;
+} line_use_t;
+
+/*********************
+ * Function prototypes
+ *********************/
+
+static void run_bench(const bench_t *bench);
+static void run_churn(const bench_t *bench);
+static int churn(void);
+static void touch(char *p, size_t size);
+static void run_bulk(const bench_t *bench);
+static int bulk(char *hot, int fd, double *walk_secs);
+static void walk(char *hot, int fd, double *walk_secs);
+static int miss_counter(void);
+static void run_defrag(const bench_t *bench);
+static void fixup(void *oldptr, void *newptr, void *arg);
+static long pages_touched(void **objs, long n);
+static void run_objcache(const bench_t *bench);
+static unsigned objcache_round(parser_t **objs, long round, mm_cache_t *cache);
+static void parser_init(void *obj);
+static void parser_fini(void *obj);
+static void parser_use(parser_t *p, long round);
+static void run_epoch(const bench_t *bench);
+static void *epoch_thread(void *arg);
+static void *bench_thread(void *arg);
+static void wait_turn(long t);
+static void next_turn(void);
+static int shared_lines(bench_thread_t *threads, int *nlines);
+static int cmp_line_use(const void *a, const void *b);
+static double wallclock(void);
+static void usage(void);
+static void unix_error(const char *msg);
+
+/**************
+ * Global data
+ **************/
+
+static const bench_t benches[] = {
+	{ "cache-thrash", 0, run_bench },
+	{ "cache-scratch", 1, run_bench },
+	{ "large-churn", 0, run_churn },
+	{ "bulk-mix", 0, run_bulk },
+	{ "defrag", 0, run_defrag },
+	{ "obj-cache", 0, run_objcache },
+	{ "epoch-stack", 0, run_epoch },
+};
+
+static const int modes[] = {
+	MT_CACHE_NONE, MT_CACHE_SHARED, MT_CACHE_THREAD, MT_CACHE_CPU,
+	MT_CACHE_THREAD | MT_ISOLATE, MT_CACHE_CPU | MT_ISOLATE
+};
+
+static int nthreads = DEF_THREADS;
+static int nobjs = DEF_OBJS;
+static size_t objsize = DEF_SIZE;
+static long niters = DEF_ITERS;
+
+/* Round-robin turns for the allocation phases */
+static pthread_mutex_t turn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turn_cond = PTHREAD_COND_INITIALIZER;
+static long turn;
+
+static pthread_barrier_t barrier;
+
+/* Constructor and destructor calls of the obj-cache parsers */
+static long parser_inits, parser_finis;
+
+/* The epoch-stack stack */
+static stack_node_t *stack_top;
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+	char c;
+	int i, j, ran = 0;
+
+	while ((c = getopt(argc, argv, "ht:n:s:i:")) != EOF) {
+		switch (c) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'n':
+			nobjs = atoi(optarg);
+			break;
+		case 's':
+			objsize = atol(optarg);
+			break;
+		case 'i':
+			niters = atol(optarg);
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+	if (nthreads < 1 || nobjs < 1 || objsize < 1 || niters < 1) {
+		usage();
+		exit(1);
+	}
+
+	mem_init();
+	for (i = optind; i < argc; i++) {
+		for (j = 0; j < sizeof(benches) / sizeof(benches[0]); j++)
+			if (strcmp(argv[i], benches[j].name) == 0)
+				break;
+		if (j == sizeof(benches) / sizeof(benches[0])) {
+			fprintf(stderr, "mmbench: unknown benchmark %s\n", argv[i]);
+			exit(1);
+		}
+		benches[j].run(&benches[j]);
+		ran = 1;
+	}
+	if (!ran)
+		for (j = 0; j < sizeof(benches) / sizeof(benches[0]); j++)
+			benches[j].run(&benches[j]);
+	exit(0);
+}
+
+/*
+ * run_bench - Run one benchmark once per cache mode and print the
+ *    write loop time next to the number of shared cache lines
+ */
+static void run_bench(const bench_t *bench)
+{
+	bench_thread_t *threads;
+	pthread_t *tids;
+	double start, end, secs, best;
+	int m, r, t, k, failed, shared, nlines;
+
+	if ((threads = calloc(nthreads, sizeof(bench_thread_t))) == NULL ||
+			(tids = calloc(nthreads, sizeof(pthread_t))) == NULL)
+		unix_error("calloc failed in run_bench");
+	for (t = 0; t < nthreads; t++) {
+		threads[t].id = t;
+		if ((threads[t].objs = calloc(nobjs, sizeof(char *))) == NULL ||
+				(threads[t].handoff = calloc(nobjs, sizeof(char *))) == NULL)
+			unix_error("calloc failed in run_bench");
+	}
+
+	printf("\n%s: %d threads, %d objects of %lu bytes each, %ld writes\n",
+			bench->name, nthreads, nobjs, (unsigned long)objsize, niters);
+	printf("%10s%10s%8s%8s\n", "cache", "secs", "lines", "shared");
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		best = 1e30;
+		failed = 0;
+		shared = nlines = 0;
+		for (r = 0; r < RUNS && !failed; r++) {
+			mem_reset_brk();
+			if (mm_init() < 0 || mm_mt_init(modes[m]) < 0) {
+				fprintf(stderr, "mmbench: mm_init failed\n");
+				exit(1);
+			}
+
+			/* The main thread's objects are carved in the same order */
+			if (bench->scratch)
+				for (k = 0; k < nobjs; k++)
+					for (t = 0; t < nthreads; t++)
+						if ((threads[t].handoff[k] = mm_mt_malloc(objsize)) == NULL)
+							failed = 1;
+			if (failed)
+				break;
+
+			turn = bench->scratch ? 0 : (long)nobjs * nthreads;
+			pthread_barrier_init(&barrier, NULL, nthreads + 1);
+			for (t = 0; t < nthreads; t++) {
+				threads[t].failed = 0;
+				if (pthread_create(&tids[t], NULL, bench_thread, &threads[t]) != 0)
+					unix_error("pthread_create failed in run_bench");
+			}
+			pthread_barrier_wait(&barrier);	/* all threads allocated */
+			pthread_barrier_wait(&barrier);	/* all threads done writing */
+
+			start = 1e30;
+			end = 0;
+			for (t = 0; t < nthreads; t++) {
+				failed |= threads[t].failed;
+				start = threads[t].start < start ? threads[t].start : start;
+				end = threads[t].end > end ? threads[t].end : end;
+			}
+			if (!failed)
+				shared = shared_lines(threads, &nlines);
+			pthread_barrier_wait(&barrier);	/* let them free and exit */
+			for (t = 0; t < nthreads; t++)
+				pthread_join(tids[t], NULL);
+			pthread_barrier_destroy(&barrier);
+
+			secs = end - start;
+			best = secs < best ? secs : best;
+		}
+
+		if (failed)
+			printf("%10s%10s%8s%8s\n", mm_mt_modename(modes[m]), "oom", "-", "-");
+		else
+			printf("%10s%10.3f%8d%8d\n", mm_mt_modename(modes[m]),
+					best, nlines, shared);
+	}
+
+	for (t = 0; t < nthreads; t++) {
+		free(threads[t].objs);
+		free(threads[t].handoff);
+	}
+	free(threads);
+	free(tids);
+}
+
+/*
+ * run_churn - Run large-churn with the map cache off and on and print
+ *    the time next to the mappings made and released
+ */
+static void run_churn(const bench_t *bench)
+{
+	static const size_t caches[] = { 0, CHURN_CACHE };
+	double start, secs, best;
+	long maps, unmaps;
+	size_t mapped;
+	int c, r, failed;
+
+	printf("\n%s: %d rounds, realloc growth %dKB to %dKB\n", bench->name,
+			CHURN_ROUNDS, CHURN_MIN / 1024, CHURN_MAX / 1024);
+	printf("%10s%10s%8s%8s\n", "map cache", "secs", "maps", "unmaps");
+
+	for (c = 0; c < sizeof(caches) / sizeof(caches[0]); c++) {
+		best = 1e30;
+		failed = 0;
+		maps = unmaps = 0;
+		for (r = 0; r < RUNS && !failed; r++) {
+			mem_reset_brk();
+			if (mm_init() < 0) {
+				fprintf(stderr, "mmbench: mm_init failed\n");
+				exit(1);
+			}
+			mm_set_map_cache(caches[c]);
+
+			start = wallclock();
+			failed = churn();
+			secs = wallclock() - start;
+			best = secs < best ? secs : best;
+			mem_map_stats(&maps, &unmaps, &mapped);
+		}
+
+		if (failed)
+			printf("%9luK%10s%8s%8s\n", (unsigned long)(caches[c] / 1024),
+					"oom", "-", "-");
+		else
+			printf("%9luK%10.3f%8ld%8ld\n", (unsigned long)(caches[c] / 1024),
+					best, maps, unmaps);
+	}
+	mm_set_map_cache(CHURN_CACHE);
+}
+
+/*
+ * churn - The large-churn workload: every round allocates, touches and
+ *    frees three buffers of different sizes, then grows one buffer by
+ *    realloc, touching each new part.  Returns nonzero on failure.
+ */
+static int churn(void)
+{
+	static const size_t sizes[] = { 3 << 20, 1 << 20, 5 << 19 };
+	char *bufs[sizeof(sizes) / sizeof(sizes[0])], *p, *q;
+	size_t size;
+	int i, k;
+
+	for (i = 0; i < CHURN_ROUNDS; i++) {
+		for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+			if ((bufs[k] = mm_malloc(sizes[k])) == NULL)
+				return 1;
+			touch(bufs[k], sizes[k]);
+		}
+		for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++)
+			mm_free(bufs[k]);
+
+		if ((p = mm_malloc(CHURN_MIN)) == NULL)
+			return 1;
+		touch(p, CHURN_MIN);
+		for (size = CHURN_MIN; size < CHURN_MAX; size *= 2) {
+			if ((q = mm_realloc(p, size * 2)) == NULL) {
+				mm_free(p);
+				return 1;
+			}
+			p = q;
+			touch(p + size, size);
+		}
+		mm_free(p);
+	}
+	return 0;
+}
+
+/*
+ * touch - Write one byte in every page of [p, p+size)
+ */
+static void touch(char *p, size_t size)
+{
+	size_t off;
+
+	for (off = 0; off < size; off += 4096)
+		p[off] = (char)off;
+}
+
+/*
+ * run_bulk - Run the bulk-mix workload with streaming off and on, and
+ *    print the bulk request time and throughput next to the time and
+ *    cache misses of the working set walks
+ */
+static void run_bulk(const bench_t *bench)
+{
+	static const size_t cutoffs[] = { 0, MM_BULK_CUTOFF };
+	double start, secs, best, walk_secs, best_walk;
+	long long misses, best_misses;
+	char *hot, label[32];
+	size_t bytes;
+	int c, r, fd, failed;
+
+	if ((hot = malloc(BULK_HOT)) == NULL)
+		unix_error("malloc failed in run_bulk");
+	memset(hot, 0, BULK_HOT);
+	fd = miss_counter();
+
+	printf("\n%s: %d rounds, realloc growth %dKB to %dKB, %dKB hot set, "
+			"%s kernel\n", bench->name, BULK_ROUNDS, BULK_MIN / 1024,
+			BULK_MAX / 1024, BULK_HOT / 1024, mm_bulk_kernel());
+	printf("%10s%10s%10s%10s%12s\n", "stream", "secs", "MB/s", "walk",
+			"walk misses");
+
+	for (c = 0; c < sizeof(cutoffs) / sizeof(cutoffs[0]); c++) {
+		best = best_walk = 1e30;
+		best_misses = -1;
+		failed = 0;
+		for (r = 0; r < RUNS && !failed; r++) {
+			mem_reset_brk();
+			if (mm_init() < 0) {
+				fprintf(stderr, "mmbench: mm_init failed\n");
+				exit(1);
+			}
+			mm_bulk_set_cutoff(cutoffs[c]);
+
+			walk_secs = 0;
+			if (fd >= 0)
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			start = wallclock();
+			failed = bulk(hot, fd, &walk_secs);
+			secs = wallclock() - start - walk_secs;
+			if (fd >= 0 && read(fd, &misses, sizeof(misses)) == sizeof(misses) &&
+					(best_misses < 0 || misses < best_misses))
+				best_misses = misses;
+			best = secs < best ? secs : best;
+			best_walk = walk_secs < best_walk ? walk_secs : best_walk;
+		}
+
+		/* Bytes written by the callocs and the realloc copies */
+		bytes = (size_t)BULK_ROUNDS * (3 * BULK_MIN + BULK_MAX - BULK_MIN);
+		if (cutoffs[c] == 0)
+			snprintf(label, sizeof(label), "off");
+		else
+			snprintf(label, sizeof(label), ">=%luK",
+					(unsigned long)(cutoffs[c] / 1024));
+		if (failed)
+			printf("%10s%10s%10s%10s%12s\n", label, "oom", "-", "-", "-");
+		else if (best_misses < 0)
+			printf("%10s%10.3f%10.0f%10.4f%12s\n", label, best,
+					bytes / best / 1e6, best_walk, "-");
+		else
+			printf("%10s%10.3f%10.0f%10.4f%12lld\n", label, best,
+					bytes / best / 1e6, best_walk, best_misses);
+	}
+	mm_bulk_set_cutoff(MM_BULK_CUTOFF);
+	if (fd >= 0)
+		close(fd);
+	free(hot);
+}
+
+/*
+ * bulk - The bulk-mix workload: every round callocs and frees a 1MB
+ *    and a 2MB buffer, then grows one buffer by realloc from BULK_MIN
+ *    to BULK_MAX, walking the hot set after each request.  The walks
+ *    are timed into *walk_secs.  Returns nonzero on failure.
+ */
+static int bulk(char *hot, int fd, double *walk_secs)
+{
+	char *p, *q;
+	size_t size;
+	int i;
+
+	for (i = 0; i < BULK_ROUNDS; i++) {
+		for (size = BULK_MIN; size <= 2 * BULK_MIN; size *= 2) {
+			if ((p = mm_calloc(1, size)) == NULL)
+				return 1;
+			walk(hot, fd, walk_secs);
+			mm_free(p);
+		}
+
+		if ((p = mm_malloc(BULK_MIN)) == NULL)
+			return 1;
+		touch(p, BULK_MIN);
+		for (size = BULK_MIN; size < BULK_MAX; size *= 2) {
+			if ((q = mm_realloc(p, size * 2)) == NULL) {
+				mm_free(p);
+				return 1;
+			}
+			p = q;
+			walk(hot, fd, walk_secs);
+		}
+		mm_free(p);
+	}
+	return 0;
+}
+
+/*
+ * walk - Read and write every cache line of the hot set, as the code
+ *    running next to the allocator would, counting misses (fd) and
+ *    time (*walk_secs) of the walk only
+ */
+static void walk(char *hot, int fd, double *walk_secs)
+{
+	double start = wallclock();
+	size_t off;
+
+	if (fd >= 0)
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	for (off = 0; off < BULK_HOT; off += LINESIZE)
+		hot[off]++;
+	if (fd >= 0)
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	*walk_secs += wallclock() - start;
+}
+
+/*
+ * miss_counter - A disabled hardware cache-miss counter for this
+ *    thread, or -1 where the kernel or CPU offers none
+ */
+static int miss_counter(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * run_defrag - Fragment the heap with small survivors, compact them with
+ *    mm_defrag pass by pass, and print the pages they touch after each
+ */
+static void run_defrag(const bench_t *bench)
+{
+	void **objs;
+	long i, n, moved, fixups, total;
+	double start, secs;
+	size_t size;
+	int pass;
+
+	if ((objs = calloc(DEFRAG_OBJS, sizeof(void *))) == NULL)
+		unix_error("calloc failed in run_defrag");
+	mem_reset_brk();
+	if (mm_init() < 0) {
+		fprintf(stderr, "mmbench: mm_init failed\n");
+		exit(1);
+	}
+
+	srand(1);
+	for (i = 0; i < DEFRAG_OBJS; i++) {
+		size = 16 + rand() % (DEFRAG_MAX - 15);
+		if ((objs[i] = mm_malloc(size)) == NULL) {
+			fprintf(stderr, "mmbench: out of memory in run_defrag\n");
+			exit(1);
+		}
+		memset(objs[i], (int)i, size);
+	}
+	for (n = i = 0; i < DEFRAG_OBJS; i++) {
+		if (rand() % DEFRAG_KEEP == 0)
+			objs[n++] = objs[i];
+		else
+			mm_free(objs[i]);
+	}
+
+	printf("\n%s: %ld of %d objects of 16-%d bytes survive\n", bench->name,
+			n, DEFRAG_OBJS, DEFRAG_MAX);
+	printf("%10s%10s%10s%10s\n", "pass", "moved", "pages", "secs");
+	printf("%10s%10s%10ld%10s\n", "-", "-", pages_touched(objs, n), "-");
+
+	total = 0;
+	for (pass = 1, moved = 1; moved > 0; pass++) {
+		fixups = 0;
+		start = wallclock();
+		moved = mm_defrag(objs, n, fixup, &fixups);
+		secs = wallclock() - start;
+		if (fixups != moved) {
+			fprintf(stderr, "mmbench: %ld moves but %ld fixups\n", moved, fixups);
+			exit(1);
+		}
+		total += moved;
+		printf("%10d%10ld%10ld%10.4f\n", pass, moved, pages_touched(objs, n), secs);
+	}
+	printf("%ld objects moved\n", total);
+
+	for (i = 0; i < n; i++)
+		mm_free(objs[i]);
+	free(objs);
+}
+
+/*
+ * fixup - The client side of a move: count it
+ */
+static void fixup(void *oldptr, void *newptr, void *arg)
+{
+	(*(long *)arg)++;
+}
+
+/*
+ * pages_touched - Distinct pages holding the first byte of objs[0..n)
+ */
+static long pages_touched(void **objs, long n)
+{
+	size_t pages = mem_heapsize() / DEFRAG_PAGE + 1;
+	char *seen;
+	long i, count = 0;
+	size_t page;
+
+	if ((seen = calloc(pages, 1)) == NULL)
+		unix_error("calloc failed in pages_touched");
+	for (i = 0; i < n; i++) {
+		page = ((char *)objs[i] - (char *)mem_heap_lo()) / DEFRAG_PAGE;
+		if (!seen[page]) {
+			seen[page] = 1;
+			count++;
+		}
+	}
+	free(seen);
+	return count;
+}
+
+/*
+ * run_objcache - Allocate, use and free parsers round after round with
+ *    mm_malloc and then from an object cache, and print the time and
+ *    the constructor calls of each
+ */
+static void run_objcache(const bench_t *bench)
+{
+	parser_t *objs[OBJ_LIVE];
+	mm_cache_t *cache;
+	mm_cache_stats_t cs;
+	unsigned sum[2] = { 0, 0 };
+	double start, secs;
+	size_t reaped;
+	long round;
+	int c;
+
+	printf("\n%s: %d rounds of up to %d parsers of %zu bytes\n", bench->name,
+			OBJ_ROUNDS, OBJ_LIVE, sizeof(parser_t));
+	printf("%10s%10s%12s\n", "alloc", "secs", "ctors");
+	for (c = 0; c < 2; c++) {
+		mem_reset_brk();
+		if (mm_init() < 0) {
+			fprintf(stderr, "mmbench: mm_init failed\n");
+			exit(1);
+		}
+		mm_cache_init();
+		cache = NULL;
+		if (c == 1 && (cache = mm_cache_create(sizeof(parser_t), 0,
+						parser_init, parser_fini)) == NULL) {
+			fprintf(stderr, "mmbench: mm_cache_create failed\n");
+			exit(1);
+		}
+		parser_inits = parser_finis = 0;
+		srand(1);
+		start = wallclock();
+		for (round = 0; round < OBJ_ROUNDS; round++)
+			sum[c] += objcache_round(objs, round, cache);
+		secs = wallclock() - start;
+		printf("%10s%10.4f%12ld\n", c ? "mm_cache" : "mm_malloc", secs,
+				parser_inits);
+	}
+	if (sum[0] != sum[1]) {
+		fprintf(stderr, "mmbench: parsers disagree (%x, %x)\n", sum[0], sum[1]);
+		exit(1);
+	}
+
+	mm_cache_stats(cache, &cs);
+	printf("cache: %zu slabs of %zu bytes, %zu objects kept constructed\n",
+			cs.slabs, cs.slab_bytes, cs.cached);
+	reaped = mm_cache_reap();
+	printf("reap: %zu bytes freed, %ld objects destructed\n", reaped,
+			parser_finis);
+	mm_cache_destroy(cache);
+}
+
+/*
+ * objcache_round - Allocate a random number of parsers, from the cache
+ *    if there is one, use them and free them; returns their checksum
+ */
+static unsigned objcache_round(parser_t **objs, long round, mm_cache_t *cache)
+{
+	unsigned sum = 0;
+	int i, n = 1 + rand() % OBJ_LIVE;
+
+	for (i = 0; i < n; i++) {
+		if (cache != NULL)
+			objs[i] = mm_cache_alloc(cache);
+		else if ((objs[i] = mm_malloc(sizeof(parser_t))) != NULL)
+			parser_init(objs[i]);
+		if (objs[i] == NULL) {
+			fprintf(stderr, "mmbench: out of memory in run_objcache\n");
+			exit(1);
+		}
+		parser_use(objs[i], round * OBJ_LIVE + i);
+		sum += objs[i]->crc;
+	}
+	for (i = 0; i < n; i++) {
+		objs[i]->crc = 0;   /* back to the constructed state */
+		if (cache != NULL)
+			mm_cache_free(cache, objs[i]);
+		else {
+			parser_fini(objs[i]);
+			mm_free(objs[i]);
+		}
+	}
+	return sum;
+}
+
+/*
+ * parser_init - Construct a parser: compute its CRC-32 table
+ */
+static void parser_init(void *obj)
+{
+	parser_t *p = obj;
+	unsigned c;
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		p->table[i] = c;
+	}
+	memset(p->line, 0, sizeof(p->line));
+	p->crc = 0;
+	parser_inits++;
+}
+
+static void parser_fini(void *obj)
+{
+	parser_finis++;
+}
+
+/*
+ * parser_use - Checksum a request line with the parser's table
+ */
+static void parser_use(parser_t *p, long round)
+{
+	unsigned c = ~0u;
+	int i, n;
+
+	n = snprintf(p->line, sizeof(p->line), "GET /item/%ld HTTP/1.1", round);
+	for (i = 0; i < n; i++)
+		c = p->table[(c ^ p->line[i]) & 0xff] ^ (c >> 8);
+	p->crc = ~c;
+}
+
+/*
+ * run_epoch - Push and pop a shared lock-free stack on every thread,
+ *    once per cache mode, and print the time and the retired objects
+ *    held
+ */
+static void run_epoch(const bench_t *bench)
+{
+	bench_thread_t *threads;
+	pthread_t *tids;
+	mm_epoch_stats_t es;
+	stack_node_t *node;
+	double start, end, secs, best;
+	long held;
+	int m, r, t, failed;
+
+	if ((threads = calloc(nthreads, sizeof(bench_thread_t))) == NULL ||
+			(tids = calloc(nthreads, sizeof(pthread_t))) == NULL)
+		unix_error("calloc failed in run_epoch");
+
+	printf("\n%s: %d threads, objects of %lu bytes, %ld pushes and pops each\n",
+			bench->name, nthreads, (unsigned long)objsize, niters);
+	printf("%10s%10s%10s%10s\n", "cache", "secs", "epochs", "held");
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		best = 1e30;
+		failed = 0;
+		held = 0;
+		es.epoch = 0;
+		for (r = 0; r < RUNS && !failed; r++) {
+			mem_reset_brk();
+			if (mm_init() < 0 || mm_mt_init(modes[m]) < 0) {
+				fprintf(stderr, "mmbench: mm_init failed\n");
+				exit(1);
+			}
+			mm_epoch_init();
+			stack_top = NULL;
+
+			pthread_barrier_init(&barrier, NULL, nthreads);
+			for (t = 0; t < nthreads; t++) {
+				threads[t].failed = 0;
+				if (pthread_create(&tids[t], NULL, epoch_thread, &threads[t]) != 0)
+					unix_error("pthread_create failed in run_epoch");
+			}
+			for (t = 0; t < nthreads; t++)
+				pthread_join(tids[t], NULL);
+			pthread_barrier_destroy(&barrier);
+
+			start = 1e30;
+			end = 0;
+			for (t = 0; t < nthreads; t++) {
+				failed |= threads[t].failed;
+				start = threads[t].start < start ? threads[t].start : start;
+				end = threads[t].end > end ? threads[t].end : end;
+			}
+			mm_epoch_stats(&es);
+			if (es.reclaimed != es.retired) {
+				fprintf(stderr, "mmbench: %ld objects retired, %ld freed\n",
+						es.retired, es.reclaimed);
+				exit(1);
+			}
+			held = es.max_pending > held ? es.max_pending : held;
+			while ((node = stack_top) != NULL) {
+				stack_top = node->next;
+				mm_mt_free(node);
+			}
+
+			secs = end - start;
+			best = secs < best ? secs : best;
+		}
+
+		if (failed)
+			printf("%10s%10s%10s%10s\n", mm_mt_modename(modes[m]), "oom", "-", "-");
+		else
+			printf("%10s%10.3f%10lu%10ld\n", mm_mt_modename(modes[m]),
+					best, es.epoch, held);
+	}
+
+	free(threads);
+	free(tids);
+}
+
+/*
+ * epoch_thread - Push a new object and pop one, niters times, retiring
+ *    what is popped, then wait for the retired objects to be freed
+ */
+static void *epoch_thread(void *arg)
+{
+	bench_thread_t *t = arg;
+	stack_node_t *node, *next;
+	size_t size = objsize < sizeof(stack_node_t) ? sizeof(stack_node_t) : objsize;
+	long i;
+
+	pthread_barrier_wait(&barrier);
+	t->start = wallclock();
+	for (i = 0; i < niters; i++) {
+		if ((node = mm_mt_malloc(size)) == NULL) {
+			t->failed = 1;
+			break;
+		}
+		node->next = __atomic_load_n(&stack_top, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&stack_top, &node->next, node, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+
+		/* The top may be popped and retired by another thread while
+		   this one reads its next link */
+		mm_epoch_enter();
+		node = __atomic_load_n(&stack_top, __ATOMIC_ACQUIRE);
+		do {
+			next = node ? node->next : NULL;
+		} while (node != NULL && !__atomic_compare_exchange_n(&stack_top,
+					&node, next, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+		mm_epoch_exit();
+		mm_free_deferred(node);
+	}
+	mm_epoch_barrier();
+	t->end = wallclock();
+	return NULL;
+}
+
+/*
+ * bench_thread - Free the handed out objects (cache-scratch), allocate
+ *    the thread's own in round-robin order with the other threads,
+ *    then write them niters times
+ */
+static void *bench_thread(void *arg)
+{
+	bench_thread_t *t = arg;
+	volatile char *p;
+	long i;
+	int k;
+
+	if (t->handoff[0] != NULL)
+		for (k = 0; k < nobjs; k++) {
+			wait_turn((long)k * nthreads + t->id);
+			mm_mt_free(t->handoff[k]);
+			t->handoff[k] = NULL;
+			next_turn();
+		}
+
+	for (k = 0; k < nobjs; k++) {
+		wait_turn((long)(nobjs + k) * nthreads + t->id);
+		if ((t->objs[k] = mm_mt_malloc(objsize)) == NULL)
+			t->failed = 1;
+		next_turn();
+	}
+	pthread_barrier_wait(&barrier);
+
+	t->start = wallclock();
+	if (!t->failed)
+		for (i = 0; i < niters; i++) {
+			p = t->objs[i % nobjs];
+			p[i % objsize]++;
+		}
+	t->end = wallclock();
+	pthread_barrier_wait(&barrier);
+
+	pthread_barrier_wait(&barrier);
+	for (k = 0; k < nobjs; k++)
+		if (t->objs[k] != NULL)
+			mm_mt_free(t->objs[k]);
+	return NULL;
+}
+
+/*
+ * wait_turn - Block until it is allocation turn t.  Turns before the
+ *    first nobjs*nthreads belong to the cache-scratch free phase, so
+ *    cache-thrash runs start counting at that offset.
+ */
+static void wait_turn(long t)
+{
+	pthread_mutex_lock(&turn_lock);
+	while (turn != t)
+		pthread_cond_wait(&turn_cond, &turn_lock);
+	pthread_mutex_unlock(&turn_lock);
+}
+
+/*
+ * next_turn - Pass the turn on to the next thread
+ */
+static void next_turn(void)
+{
+	pthread_mutex_lock(&turn_lock);
+	turn++;
+	pthread_cond_broadcast(&turn_cond);
+	pthread_mutex_unlock(&turn_lock);
+}
+
+/*
+ * shared_lines - Count the cache lines holding the objects of more
+ *    than one thread; *nlines gets the number of lines touched at all
+ */
+static int shared_lines(bench_thread_t *threads, int *nlines)
+{
+	line_use_t *uses;
+	unsigned long lo, hi, line;
+	int n = 0, shared = 0, i, j, t, k;
+
+	if ((uses = malloc(sizeof(line_use_t) * nthreads * nobjs *
+					(objsize / LINESIZE + 2))) == NULL)
+		unix_error("malloc failed in shared_lines");
+	for (t = 0; t < nthreads; t++)
+		for (k = 0; k < nobjs; k++) {
+			lo = (unsigned long)threads[t].objs[k] / LINESIZE;
+			hi = ((unsigned long)threads[t].objs[k] + objsize - 1) / LINESIZE;
+			for (line = lo; line <= hi; line++) {
+				uses[n].line = line;
+				uses[n++].id = t;
+			}
+		}
+	qsort(uses, n, sizeof(line_use_t), cmp_line_use);
+
+	*nlines = 0;
+	for (i = 0; i < n; i = j) {
+		(*nlines)++;
+		for (j = i + 1; j < n && uses[j].line == uses[i].line; j++)
+			;
+		if (uses[j - 1].id != uses[i].id)
+			shared++;
+	}
+	free(uses);
+	return shared;
+}
+
+static int cmp_line_use(const void *a, const void *b)
+{
+	const line_use_t *x = a, *y = b;
+
+	if (x->line != y->line)
+		return x->line < y->line ? -1 : 1;
+	return x->id - y->id;
+}
+
+/*
+ * wallclock - Monotonic wall clock time in seconds
+ */
+static double wallclock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: mmbench [-h] [-t <n>] [-n <n>] [-s <n>] [-i <n>] "
+			"[benchmark...]\n");
+	fprintf(stderr, "Options\n");
+	fprintf(stderr, "\t-h         Print this message.\n");
+	fprintf(stderr, "\t-t <n>     Run <n> threads (default %d).\n", DEF_THREADS);
+	fprintf(stderr, "\t-n <n>     Objects per thread (default %d).\n", DEF_OBJS);
+	fprintf(stderr, "\t-s <n>     Object size in bytes (default %d).\n", DEF_SIZE);
+	fprintf(stderr, "\t-i <n>     Writes per thread (default %d).\n", DEF_ITERS);
+	fprintf(stderr, "Benchmarks: cache-thrash cache-scratch large-churn "
+			"bulk-mix defrag obj-cache epoch-stack (default: all)\n");
+}
+
+/*
+ * unix_error - Report Unix-style error and terminate the program
+ */
+static void unix_error(const char *msg)
+{
+	fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+	exit(1);
+}
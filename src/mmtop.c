@@ -0,0 +1,247 @@
+/*
+ * mmtop.c - Watch the statistics a process publishes through mm_shm
+ *
+ * mmtop maps the process's mm_shm block read-only and prints it every
+ * few seconds: heap and mapping sizes, request rates, live and free
+ * blocks per size class, slow path latencies and the hit rate of the
+ * mm_mt caches.  It never writes to the block and never signals the
+ * process, so watching does not perturb it; a snapshot that raced with
+ * an update (odd or changed sequence count) is simply read again.
+ *
+ * Start the process with publishing turned on (mdriver -S, or a call
+ * to mm_shm_open), then run "mmtop <pid>".
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mm_shm.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define DEF_DELAY    2.0   /* seconds between screens */
+#define MAX_RETRIES  1000  /* snapshot attempts before giving up */
+
+/**************
+ * Global data
+ **************/
+
+static const volatile mm_shm_t *shm;
+static int clear_screen;
+
+/*********************
+ * Function prototypes
+ *********************/
+
+static const volatile mm_shm_t *attach(const char *arg, char *name);
+static int snapshot(mm_shm_t *s);
+static void show(const char *name, const mm_shm_t *s, const mm_shm_t *prev,
+		double secs);
+static void usage(void);
+static void unix_error(const char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+	mm_shm_t cur, prev;
+	char name[64];
+	double delay = DEF_DELAY;
+	long count = -1;
+	char c;
+
+	while ((c = getopt(argc, argv, "hbd:n:")) != EOF) {
+		switch (c) {
+		case 'b':
+			clear_screen = -1;
+			break;
+		case 'd':
+			delay = atof(optarg);
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+	if (optind != argc - 1 || delay <= 0) {
+		usage();
+		exit(1);
+	}
+	if (clear_screen == 0)
+		clear_screen = isatty(STDOUT_FILENO);
+	else
+		clear_screen = 0;
+
+	shm = attach(argv[optind], name);
+	if (snapshot(&prev) < 0) {
+		fprintf(stderr, "mmtop: %s is being updated too often to read\n", name);
+		exit(1);
+	}
+	show(name, &prev, NULL, 0);
+
+	while (count < 0 || --count > 0) {
+		usleep((useconds_t)(delay * 1e6));
+		if (kill(prev.pid, 0) < 0 && errno == ESRCH) {
+			printf("mmtop: process %ld has exited\n", prev.pid);
+			break;
+		}
+		if (snapshot(&cur) < 0)
+			continue;
+		show(name, &cur, &prev, cur.stamp - prev.stamp);
+		prev = cur;
+	}
+	exit(0);
+}
+
+/*
+ * attach - Map the block named by arg (a pid or a segment name)
+ *    read-only, after checking that it is one we understand
+ */
+static const volatile mm_shm_t *attach(const char *arg, char *name)
+{
+	const volatile mm_shm_t *s;
+	char *end;
+	int fd;
+
+	strtol(arg, &end, 10);
+	if (*arg != '\0' && *end == '\0')
+		snprintf(name, 64, "/mmstats.%s", arg);
+	else
+		snprintf(name, 64, "%s", arg);
+
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+		unix_error(name);
+	s = mmap(NULL, sizeof(mm_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s == MAP_FAILED)
+		unix_error("mmap failed in attach");
+	if (s->magic != MM_SHM_MAGIC || s->version != MM_SHM_VERSION ||
+			s->size != sizeof(mm_shm_t)) {
+		fprintf(stderr, "mmtop: %s is not an mm_shm block of version %d\n",
+				name, MM_SHM_VERSION);
+		exit(1);
+	}
+	return s;
+}
+
+/*
+ * snapshot - Copy the block into s, retrying while it is being
+ *    updated.  Returns -1 if no consistent copy could be made.
+ */
+static int snapshot(mm_shm_t *s)
+{
+	unsigned seq;
+	int i;
+
+	for (i = 0; i < MAX_RETRIES; i++) {
+		seq = shm->seq;
+		if (seq & 1)
+			continue;
+		__sync_synchronize();
+		memcpy(s, (const void *)shm, sizeof(*s));
+		__sync_synchronize();
+		if (shm->seq == seq)
+			return 0;
+	}
+	return -1;
+}
+
+/*
+ * show - Print one screen.  Rates are per second since prev (none on
+ *    the first screen, when prev is NULL).
+ */
+static void show(const char *name, const mm_shm_t *s, const mm_shm_t *prev,
+		double secs)
+{
+	const mm_heap_stats_t *h = &s->heap;
+	long hits, lookups, total;
+	char label[32];
+	int c, b;
+
+	if (clear_screen)
+		printf("\033[H\033[2J");
+	printf("%s  pid %ld  updates %lu\n\n", name, s->pid, s->updates);
+
+	printf("heap %10.1fK  mapped %10.1fK  live %10.1fK  free %10.1fK"
+			"  largest %10.1fK\n",
+			h->heap_bytes / 1024.0, h->mapped_bytes / 1024.0,
+			h->live_bytes / 1024.0, h->free_bytes / 1024.0,
+			h->largest_free / 1024.0);
+	printf("sbrk %ld  maps %ld  unmaps %ld  map cache hits %ld\n",
+			h->sbrk_calls, h->map_calls, h->unmap_calls, h->map_hits);
+	printf("mallocs %ld  frees %ld  reallocs %ld", h->mallocs, h->frees,
+			h->reallocs);
+	if (prev != NULL && secs > 0)
+		printf("  (%.0f/s)", (h->mallocs + h->frees + h->reallocs -
+					prev->heap.mallocs - prev->heap.frees -
+					prev->heap.reallocs) / secs);
+	printf("\n");
+
+	lookups = s->cache.hits + s->cache.misses;
+	hits = s->cache.hits;
+	if (lookups > 0)
+		printf("caches %d  cached %.1fK  hits %ld  misses %ld  hit rate %.1f%%\n",
+				s->cache.ncaches, s->cache.cached_bytes / 1024.0, hits,
+				s->cache.misses, 100.0 * hits / lookups);
+
+	printf("\n%20s%10s%10s\n", "class", "live", "free");
+	for (c = 0; c < MM_SHM_CLASSES; c++)
+		if (h->live_blocks[c] != 0 || h->free_blocks[c] != 0)
+			printf("%9lu-%-10lu%10ld%10ld\n", 16UL << c, (32UL << c) - 1,
+					h->live_blocks[c], h->free_blocks[c]);
+
+	for (total = 0, b = 0; b < MM_SHM_BUCKETS; b++)
+		total += h->slow_ns[b];
+	if (total > 0) {
+		printf("\n%20s%10s%8s\n", "slow path", "count", "share");
+		for (b = 0; b < MM_SHM_BUCKETS; b++) {
+			if (h->slow_ns[b] == 0)
+				continue;
+			if (b < MM_SHM_BUCKETS - 1)
+				snprintf(label, sizeof(label), "< %luns", 1UL << (b + MM_SHM_MINLOG));
+			else
+				snprintf(label, sizeof(label), ">= %luns", 1UL << (b + MM_SHM_MINLOG - 1));
+			printf("%20s%10ld%7.1f%%\n", label, h->slow_ns[b],
+					100.0 * h->slow_ns[b] / total);
+		}
+	}
+	fflush(stdout);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: mmtop [-hb] [-d <secs>] [-n <count>] <pid|name>\n");
+	fprintf(stderr, "Options\n");
+	fprintf(stderr, "\t-h         Print this message.\n");
+	fprintf(stderr, "\t-b         Batch mode: do not clear the screen.\n");
+	fprintf(stderr, "\t-d <secs>  Delay between screens (default %.0f).\n",
+			DEF_DELAY);
+	fprintf(stderr, "\t-n <count> Print <count> screens, then exit.\n");
+}
+
+/*
+ * unix_error - Report Unix-style error and terminate the program
+ */
+static void unix_error(const char *msg)
+{
+	fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+	exit(1);
+}